@@ -0,0 +1,70 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+static double rmse(const HDRImage &a, const HDRImage &b)
+{
+    double sum = 0.0;
+    for(size_t k = 0; k < a.pixels.size(); ++k)
+    {
+        glm::vec3 d = a.pixels[k] - b.pixels[k];
+        sum += glm::dot(d, d)/3.0;
+    }
+    return std::sqrt(sum/a.pixels.size());
+}
+
+//Error against cost of uniform and adaptive sampling on the Cornell box with
+//next event estimation. For every average sample count it renders the image
+//uniformly and adaptively with the same total sample budget, and then
+//adaptively in the time the uniform render took. Prints times and the RMSE of
+//each against a high sample count reference.
+//Usage: adaptive_benchmark [max spp] [reference spp] [target error]
+int main(int argc, char **argv) {
+    int w = 64, h = 48;
+    int maxSamples = argc > 1 ? std::atoi(argv[1]) : 64;
+    int referenceSamples = argc > 2 ? std::atoi(argv[2]) : 2048;
+    float target = argc > 3 ? std::atof(argv[3]) : 0.001f;
+    ThreadPool pool;
+
+    Scene scene;
+    makeCornellBox(scene);
+    scene.pathSettings.iterative = true;
+    scene.pathSettings.nextEventEstimation = true;
+    scene.buildBVH();
+
+    RenderSettings settings;
+    settings.pixelJitter = true;
+    settings.numberOfSamples = referenceSamples;
+    settings.seed = 12345;
+    HDRImage reference(w, h);
+    render(scene, reference, settings, pool);
+
+    settings.seed = 1;
+    std::cout<<"spp\tuniform s\tuniform rmse\tadaptive s\tadaptive rmse\tequal time rmse\tconverged pixels"<<std::endl;
+    for(int spp = 8; spp <= maxSamples; spp *= 2)
+    {
+        HDRImage uniform(w, h), adaptive(w, h);
+        settings.numberOfSamples = spp;
+        auto start = std::chrono::steady_clock::now();
+        render(scene, uniform, settings, pool);
+        double uniformSeconds = secondsSince(start);
+
+        AdaptiveSettings options;
+        options.targetError = target;
+        options.sampleBudget = (long)spp*w*h;
+        AdaptiveStats stats = renderAdaptive(scene, adaptive, settings, options, pool);
+        HDRImage timed(w, h);
+        options.sampleBudget = 0;
+        options.timeBudget = uniformSeconds;
+        renderAdaptive(scene, timed, settings, options, pool);
+        std::cout<<spp<<"\t"<<uniformSeconds<<"\t"<<rmse(uniform, reference)<<"\t"<<stats.seconds<<"\t"
+                 <<rmse(adaptive, reference)<<"\t"<<rmse(timed, reference)<<"\t"<<stats.converged<<std::endl;
+    }
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+}
@@ -0,0 +1,181 @@
+#include "../src/scene.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+//Animates part of a random scene over a number of frames and keeps its BVH
+//up to date with Scene::update, against building it again every frame.
+//"jitter" moves 1% of the objects by a small random walk, which refitting
+//alone handles. "swirl" turns the objects in a ball around its center, faster
+//inside, which mixes up the subtrees there until they are rebuilt. "orbit"
+//sends 5% of the objects around the scene center, the whole tree degrades
+//until it is built again. Every few frames
+//the updated scene is compared with one built from scratch over the same
+//objects, ray by ray, and both are timed on the same camera rays. Last, the
+//light of the Cornell box is moved and the renders of the updated and the
+//rebuilt scene are compared.
+//Usage: animation_benchmark [objects] [frames]
+//Exits with 1 if a closest hit or a pixel differs.
+
+//Moves obj by offset from where base put it
+static void place(Object *obj, const glm::mat4 &base, const glm::vec3 &offset)
+{
+    glm::mat4 W = glm::translate(glm::mat4(1.0f), offset)*base;
+    obj->transform = AffineTransform(W);
+    obj->normalTransform = AffineTransform(glm::inverseTranspose(W));
+    obj->inverse = AffineTransform(glm::inverse(W));
+}
+
+//A scene over the same objects and settings, to be built from scratch
+static void shareObjects(const Scene &from, Scene &to)
+{
+    to.objects = from.objects;
+    to.camera = from.camera;
+    to.lights = from.lights;
+    to.sky = from.sky;
+    to.ambientLight = from.ambientLight;
+    to.pathSettings = from.pathSettings;
+}
+
+//Closest hits of the camera rays through both scenes: the number that differ
+//in object or distance, and the seconds each took
+static long compareHits(const Scene &updated, const Scene &fresh, int res, double &updatedSeconds, double &freshSeconds)
+{
+    Interval t_range = Interval(0.001f, std::numeric_limits<float>::max());
+    std::vector<Ray> rays;
+    for(int j = 0; j < res; j++)
+    {
+        for(int i = 0; i < res; i++) rays.push_back(updated.camera->make_ray(2*(i + 0.5f)/res - 1, 1 - 2*(j + 0.5f)/res));
+    }
+    std::vector<HitRecord> a(rays.size()), b(rays.size());
+    std::vector<char> hitA(rays.size()), hitB(rays.size());
+    auto start = std::chrono::steady_clock::now();
+    for(size_t k = 0; k < rays.size(); ++k) hitA[k] = updated.compiled.intersect(rays[k], t_range, a[k]);
+    updatedSeconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for(size_t k = 0; k < rays.size(); ++k) hitB[k] = fresh.compiled.intersect(rays[k], t_range, b[k]);
+    freshSeconds = secondsSince(start);
+    long differ = 0;
+    for(size_t k = 0; k < rays.size(); ++k)
+    {
+        if(hitA[k] != hitB[k] || (hitA[k] && (a[k].object != b[k].object || a[k].t != b[k].t))) differ++;
+    }
+    return differ;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int frames = argc > 2 ? std::atoi(argv[2]) : 60;
+    const int res = 256, checkEvery = 10;
+    bool ok = true;
+
+    const char *names[] = {"jitter", "swirl", "orbit"};
+    std::cout<<"animation\tframe\tmoving\taction\tupdate ms\tfull build ms\tSAH cost x\tupdated Mrays/s\trebuilt Mrays/s\tdiffering hits"<<std::endl;
+    for(int animation = 0; animation < 3; ++animation)
+    {
+        Scene scene;
+        makeRandomScene(scene, n);
+        float extent = 2.0f*std::cbrt((float)n)*0.15f;
+        glm::vec3 sceneCenter(0.0f, 0.0f, -2.0f*extent);
+        scene.buildBVH();
+
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+        glm::vec3 ballCenter = sceneCenter + glm::vec3(0.4f*extent, 0.0f, 0.0f);
+        float ballRadius = 0.6f*extent;
+        std::vector<int> movers;
+        std::vector<glm::mat4> bases;
+        std::vector<glm::vec3> centers, offsets;
+        std::vector<float> speeds;
+        for(int i = 0; i < n; ++i)
+        {
+            glm::vec3 c = scene.objects[i]->worldBounds().centroid();
+            if(animation == 1 ? glm::length(c - ballCenter) > ballRadius : i % (animation == 0 ? 100 : 20) != 0) continue;
+            movers.push_back(i);
+            bases.push_back(scene.objects[i]->transform.toMat4());
+            centers.push_back(c);
+            offsets.push_back(glm::vec3(0.0f));
+            speeds.push_back(animation == 1 ? 0.1f*(1.0f - glm::length(c - ballCenter)/ballRadius) : 0.02f + 0.03f*uniform(rng));
+        }
+        int moving = movers.size();
+
+        int actions[3] = {0, 0, 0};
+        double updateMs = 0.0, maxUpdateMs = 0.0, buildMs = 0.0;
+        int builds = 0;
+        UpdateStats last;
+        for(int frame = 1; frame <= frames; ++frame)
+        {
+            for(int k = 0; k < moving; ++k)
+            {
+                if(animation == 0) offsets[k] += 0.002f*extent*glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+                else
+                {
+                    //Around the vertical axis through the ball or scene center
+                    glm::vec3 r = centers[k] - (animation == 1 ? ballCenter : sceneCenter);
+                    float a = speeds[k]*frame, c = std::cos(a), s = std::sin(a);
+                    offsets[k] = glm::vec3(c*r.x + s*r.z, r.y, -s*r.x + c*r.z) - r;
+                }
+                place(scene.objects[movers[k]], bases[k], offsets[k]);
+            }
+            last = scene.update(movers);
+            actions[last.action]++;
+            updateMs += last.milliseconds;
+            maxUpdateMs = std::max(maxUpdateMs, last.milliseconds);
+            if(frame % checkEvery != 0 && frame != frames) continue;
+
+            Scene fresh;
+            shareObjects(scene, fresh);
+            auto start = std::chrono::steady_clock::now();
+            fresh.buildBVH(scene.bvh.options);
+            double freshMs = 1000.0*secondsSince(start);
+            buildMs += freshMs;
+            builds++;
+            double updatedSeconds, freshSeconds;
+            long differ = compareHits(scene, fresh, res, updatedSeconds, freshSeconds);
+            static const char *actionNames[] = {"refit", "partial rebuild", "full rebuild"};
+            std::cout<<names[animation]<<"\t"<<frame<<"\t"<<moving<<"\t"<<actionNames[last.action]<<"\t"
+                     <<last.milliseconds<<"\t"<<freshMs<<"\t"<<last.degradation<<"\t"<<res*res/updatedSeconds/1e6<<"\t"
+                     <<res*res/freshSeconds/1e6<<"\t"<<differ<<std::endl;
+            ok = ok && differ == 0;
+        }
+        std::cout<<names[animation]<<": "<<actions[UpdateStats::Refit]<<" refits, "<<actions[UpdateStats::PartialRebuild]
+                 <<" partial and "<<actions[UpdateStats::FullRebuild]<<" full rebuilds, update "<<updateMs/frames
+                 <<" ms per frame (max "<<maxUpdateMs<<"), full build "<<buildMs/builds<<" ms"<<std::endl;
+        for(auto obj:scene.objects) delete obj;
+        delete scene.camera;
+    }
+
+    //The light and the sphere of the Cornell box move, the emitters are
+    //collected again and the render must not change
+    Scene cornell;
+    makeCornellBox(cornell);
+    cornell.buildBVH();
+    RenderSettings settings;
+    settings.numberOfSamples = 4;
+    std::vector<int> changed = {0, 7};
+    long differ = 0;
+    for(int frame = 1; frame <= 3; ++frame)
+    {
+        place(cornell.objects[0], glm::mat4(1.0f), glm::vec3(0.8f*frame, 0.0f, 0.0f));
+        place(cornell.objects[7], glm::mat4(1.0f), glm::vec3(-0.6f*frame, 0.0f, 0.3f*frame));
+        cornell.update(changed);
+        Scene fresh;
+        shareObjects(cornell, fresh);
+        fresh.buildBVH(cornell.bvh.options);
+        HDRImage a(64, 48), b(64, 48);
+        render(cornell, a, settings);
+        render(fresh, b, settings);
+        for(size_t k = 0; k < a.pixels.size(); ++k) differ += a.pixels[k] != b.pixels[k];
+    }
+    std::cout<<"Cornell box, moving light: "<<differ<<" differing pixels"<<std::endl;
+    ok = ok && differ == 0;
+    for(auto obj:cornell.objects) delete obj;
+    delete cornell.camera;
+
+    if(!ok) std::cout<<"animation check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+#ifndef BENCH_SCENES_HPP
+#define BENCH_SCENES_HPP
+
+#include "../src/scene.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+//Scenes shared by the benchmark executables
+
+//The image_gen Cornell box: five walls, a rotated metallic box, a white sphere and
+//an emissive rectangle in the ceiling
+inline void makeCornellBox(Scene &scene)
+{
+    scene.camera = new Camera();
+    Material* lsrc2 = new EmissiveRectangle(glm::vec3(1.0f,1.0f,1.0f) * 10.0f);
+    Material* blue_mat = new Lambertian(glm::vec3(0.0f, 0.0f, 1.0f));
+    Material* red_mat = new Lambertian(glm::vec3(1.0f, 0.0f, 0.0f));
+    Material* green_mat = new Lambertian(glm::vec3(0.0f, 1.0f, 0.0f));
+    Material* grey_mat = new Lambertian(glm::vec3(0.5f, 0.5f, 0.5f));
+    Material* white_mat = new Lambertian(glm::vec3(1.0f, 1.0f, 1.0f));
+    Material* mat3 = new Metallic(glm::vec3(0.5f, 0.2f, 0.5f), 1, glm::vec3(1.0f, 1.0f, 1.0f));
+
+    Object* b1 = new Object(new Box(glm::vec3(-4.0f, -5.0f, -11.5f), glm::vec3(-2.0f, 0.0f, -13.5f)), mat3);
+    b1->setTransform(glm::rotate(glm::mat4(1.0f), glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+    scene.objects.push_back(new Object(new Rectangle(glm::vec3(-1.0f, 4.8f, -12.0f), glm::vec3(1.0f, 4.8f, -14.0f)), lsrc2));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-4.5f, -5.01f, -9.5f), glm::vec3(4.5f, -5.0f, -15.0f)), grey_mat));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-4.5f, -5.0f, -9.5f), glm::vec3(-4.51f, 5.0f, -15.0f)), red_mat));
+    scene.objects.push_back(new Object(new Box(glm::vec3(4.5f, -5.0f, -9.5f), glm::vec3(4.51f, 5.0f, -15.0f)), green_mat));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-4.5f, 5.0f, -9.5f), glm::vec3(4.5f, 5.01f, -15.0f)), grey_mat));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-4.5f, 5.0f, -15.0f), glm::vec3(4.5f, -5.0f, -15.1f)), blue_mat));
+    scene.objects.push_back(b1);
+    scene.objects.push_back(new Object(new Sphere(glm::vec3(1.0f, -3.5, -13.0), 1.5f), white_mat));
+    scene.sky = glm::vec3(0.0f);
+}
+
+//n spheres, boxes and rectangles scattered in front of the camera, one in
+//eight boxes is rotated
+inline void makeRandomScene(Scene &scene, int n, unsigned seed = 1)
+{
+    scene.camera = new Camera();
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> pos(-1.0f, 1.0f), size(0.02f, 0.2f);
+    Material* mats[3] = {new Lambertian(glm::vec3(0.8f, 0.3f, 0.3f)),
+                         new Lambertian(glm::vec3(0.3f, 0.8f, 0.3f)),
+                         new Metallic(glm::vec3(0.5f), 10, glm::vec3(1.0f))};
+    float extent = 2.0f*std::cbrt((float)n)*0.15f;
+    for(int i = 0; i < n; ++i)
+    {
+        glm::vec3 c = glm::vec3(pos(gen), pos(gen), pos(gen))*extent + glm::vec3(0.0f, 0.0f, -2.0f*extent);
+        float s = size(gen);
+        Material* mat = mats[i % 3];
+        Object* obj;
+        switch(i % 3)
+        {
+        case 0:
+            obj = new Object(new Sphere(c, s), mat);
+            break;
+        case 1:
+            obj = new Object(new Box(c - glm::vec3(s), c + glm::vec3(s, 2.0f*s, s)), mat);
+            if(i % 8 == 1) obj->setTransform(glm::rotate(glm::mat4(1.0f), glm::radians(30.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+            break;
+        default:
+            obj = new Object(new Rectangle(c - glm::vec3(s, 0.0f, s), c + glm::vec3(s, 0.0f, s)), mat);
+            break;
+        }
+        scene.objects.push_back(obj);
+    }
+    scene.sky = glm::vec3(0.5f, 0.6f, 0.8f);
+}
+
+//n spheres of mixed sizes filling a cube in front of the camera
+inline void makeRandomSpheres(Scene &scene, int n, unsigned seed = 1)
+{
+    scene.camera = new Camera();
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> pos(-1.0f, 1.0f), size(0.01f, 0.1f);
+    Material* mats[2] = {new Lambertian(glm::vec3(0.8f, 0.3f, 0.3f)), new Lambertian(glm::vec3(0.3f, 0.3f, 0.8f))};
+    float extent = 2.0f*std::cbrt((float)n)*0.08f;
+    for(int i = 0; i < n; ++i)
+    {
+        glm::vec3 c = glm::vec3(pos(gen), pos(gen), pos(gen))*extent + glm::vec3(0.0f, 0.0f, -2.0f*extent);
+        scene.objects.push_back(new Object(new Sphere(c, size(gen)), mats[i % 2]));
+    }
+    scene.sky = glm::vec3(0.5f, 0.6f, 0.8f);
+}
+
+//A floor and back wall lit by n small lights spread over the floor: emissive
+//spheres, downward facing emissive rectangles and point lights in turn. The
+//total emitted power does not depend on n.
+inline void makeManyLightsScene(Scene &scene, int n, unsigned seed = 1)
+{
+    scene.camera = new Camera();
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    Material* floor_mat = new Lambertian(glm::vec3(0.7f, 0.7f, 0.7f));
+    Material* wall_mat = new Lambertian(glm::vec3(0.6f, 0.5f, 0.4f));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-8.0f, -1.01f, -16.0f), glm::vec3(8.0f, -1.0f, -2.0f)), floor_mat));
+    scene.objects.push_back(new Object(new Box(glm::vec3(-8.0f, -1.0f, -16.1f), glm::vec3(8.0f, 6.0f, -16.0f)), wall_mat));
+    scene.objects.push_back(new Object(new Sphere(glm::vec3(-1.5f, 0.0f, -9.0f), 1.0f), floor_mat));
+    scene.objects.push_back(new Object(new Sphere(glm::vec3(2.0f, -0.4f, -7.0f), 0.6f), wall_mat));
+
+    float scale = 1.0f/n;
+    for(int i = 0; i < n; ++i)
+    {
+        glm::vec3 c = glm::vec3(-7.0f + 14.0f*unit(gen), -0.8f + 1.5f*unit(gen), -15.0f + 12.0f*unit(gen));
+        glm::vec3 tint = glm::vec3(0.5f) + 0.5f*glm::vec3(unit(gen), unit(gen), unit(gen));
+        switch(i % 3)
+        {
+        case 0:
+            scene.objects.push_back(new Object(new Sphere(c, 0.05f), new Emissive(tint*(4000.0f*scale))));
+            break;
+        case 1:
+            scene.objects.push_back(new Object(new Rectangle(c - glm::vec3(0.1f, 0.0f, 0.1f), c + glm::vec3(0.1f, 0.0f, 0.1f)),
+                                               new EmissiveRectangle(tint*(1000.0f*scale))));
+            break;
+        default:
+            scene.lights.push_back(PointLight(c, tint*(100.0f*scale)));
+            break;
+        }
+    }
+    scene.sky = glm::vec3(0.0f);
+}
+
+//Writes the scene as a scene file. Every transformed object is written with
+//the statements in transform, which must be the ones that made its matrix.
+inline bool writeSceneFile(const Scene &scene, const std::string &path, const char *transform = "rotate 30 0 1 0")
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(!file) return false;
+    std::vector<Material*> mats;
+    for(auto obj:scene.objects)
+    {
+        if(std::find(mats.begin(), mats.end(), obj->mat) != mats.end()) continue;
+        mats.push_back(obj->mat);
+        int m = (int)mats.size() - 1;
+        glm::vec3 a = obj->mat->albedo;
+        if(Metallic *metal = dynamic_cast<Metallic*>(obj->mat))
+        {
+            glm::vec3 f = metal->parallelReflection;
+            std::fprintf(file, "material m%d metallic %.9g %.9g %.9g %d %.9g %.9g %.9g\n", m, f.x, f.y, f.z, metal->shininess,
+                         a.x, a.y, a.z);
+        }
+        else if(TorrenceSparrow *ts = dynamic_cast<TorrenceSparrow*>(obj->mat))
+        {
+            glm::vec3 f = ts->parallelReflection, b = ts->albedo;
+            std::fprintf(file, "material m%d torrance_sparrow %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", m, f.x, f.y, f.z,
+                         ts->roughness, b.x, b.y, b.z);
+        }
+        else if(Emissive *e = dynamic_cast<Emissive*>(obj->mat))
+        {
+            glm::vec3 L = e->emittedRadiance;
+            std::fprintf(file, "material m%d emissive %.9g %.9g %.9g\n", m, L.x, L.y, L.z);
+        }
+        else if(EmissiveRectangle *e = dynamic_cast<EmissiveRectangle*>(obj->mat))
+        {
+            glm::vec3 L = e->emittedRadiance;
+            std::fprintf(file, "material m%d emissive_rectangle %.9g %.9g %.9g\n", m, L.x, L.y, L.z);
+        }
+        else std::fprintf(file, "material m%d lambertian %.9g %.9g %.9g\n", m, a.x, a.y, a.z);
+    }
+    std::fprintf(file, "sky %.9g %.9g %.9g\n", scene.sky.x, scene.sky.y, scene.sky.z);
+    for(auto const &light:scene.lights)
+    {
+        std::fprintf(file, "light %.9g %.9g %.9g %.9g %.9g %.9g\n", light.location.x, light.location.y, light.location.z,
+                     light.intensity.x, light.intensity.y, light.intensity.z);
+    }
+    for(auto obj:scene.objects)
+    {
+        int m = (int)(std::find(mats.begin(), mats.end(), obj->mat) - mats.begin());
+        if(!obj->transform.identity) std::fprintf(file, "%s\n", transform);
+        if(Sphere *s = dynamic_cast<Sphere*>(obj->shape))
+            std::fprintf(file, "sphere m%d %.9g %.9g %.9g %.9g\n", m, s->c.x, s->c.y, s->c.z, s->r);
+        else if(Box *b = dynamic_cast<Box*>(obj->shape))
+            std::fprintf(file, "box m%d %.9g %.9g %.9g %.9g %.9g %.9g\n", m, b->low.x, b->low.y, b->low.z,
+                         b->hi.x, b->hi.y, b->hi.z);
+        else if(Rectangle *r = dynamic_cast<Rectangle*>(obj->shape))
+            std::fprintf(file, "rectangle m%d %.9g %.9g %.9g %.9g %.9g %.9g\n", m, r->low.x, r->low.y, r->low.z,
+                         r->hi.x, r->hi.y, r->hi.z);
+        else if(Plane *p = dynamic_cast<Plane*>(obj->shape))
+            std::fprintf(file, "plane m%d %.9g %.9g %.9g %.9g %.9g %.9g\n", m, p->point.x, p->point.y, p->point.z,
+                         p->normal.x, p->normal.y, p->normal.z);
+        if(!obj->transform.identity) std::fprintf(file, "identity\n");
+    }
+    return std::fclose(file) == 0;
+}
+
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#endif
@@ -0,0 +1,78 @@
+#include "../src/scene.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//Builds median and SAH hierarchies over a random scene, prints their build
+//statistics and the rate at which camera rays are traced through each, with
+//the compiled scene and with the pointer-based objects. The two must agree
+//bit for bit on the hit t, point, normal, object and material of every ray,
+//and on the occlusion of a shadow ray from every hit point.
+//Usage: bvh_benchmark [objects] [rays per axis]
+//Exits with 1 if the compiled scene and the pointer path disagree.
+
+static bool sameHit(const std::pair<HitRecord,int> &a, const std::pair<HitRecord,int> &b)
+{
+    if((a.second > 0) != (b.second > 0)) return false;
+    if(a.second == 0) return true;
+    return a.first.t == b.first.t && a.first.p == b.first.p && a.first.n == b.first.n &&
+           a.first.object == b.first.object && a.first.mat == b.first.mat;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int res = argc > 2 ? std::atoi(argv[2]) : 512;
+    bool ok = true;
+    Scene scene;
+    makeRandomScene(scene, n);
+    glm::vec3 light(0.0f, 10.0f, 0.0f);
+
+    const char *names[2] = {"median", "SAH"};
+    BVHBuildOptions::SplitMethod methods[2] = {BVHBuildOptions::Median, BVHBuildOptions::SAH};
+    for(int m = 0; m < 2; ++m)
+    {
+        BVHBuildOptions options;
+        options.splitMethod = methods[m];
+        scene.buildBVH(options);
+        std::cout<<"== "<<names[m]<<" ("<<n<<" objects)"<<std::endl;
+        scene.bvh.stats().print();
+
+        //Compiled scene first, then the pointer-based objects it was built from
+        CompiledScene compiled = scene.compiled;
+        std::vector<std::pair<HitRecord,int> > results[2];
+        std::vector<char> shadows[2];
+        for(int pass = 0; pass < 2; ++pass)
+        {
+            scene.compiled = pass == 0 ? compiled : CompiledScene();
+            results[pass].reserve(res*res);
+            auto start = std::chrono::steady_clock::now();
+            int hits = 0;
+            for (int j = 0; j < res; j++) {
+                for (int i = 0; i < res; i++) {
+                    float x = 2*(i+0.5)/res - 1;
+                    float y = 1 - 2*(j+0.5)/res;
+                    results[pass].push_back(scene.traceRay(scene.camera->make_ray(x, y)));
+                    hits += results[pass].back().second > 0;
+                }
+            }
+            double seconds = secondsSince(start);
+            for(const auto &hit: results[pass])
+            {
+                if(hit.second > 0) shadows[pass].push_back(scene.inShadow(hit.first.p, PointLight(light, glm::vec3(1.0f))));
+            }
+            std::cout<<(pass == 0 ? "compiled" : "pointer ")<<": traced "<<res*res<<" rays ("<<hits<<" hits) at "
+                     <<res*res/seconds/1e6<<" Mrays/s"<<std::endl;
+        }
+        scene.compiled = compiled;
+        long differ = 0;
+        for(size_t k = 0; k < results[0].size(); ++k) differ += !sameHit(results[0][k], results[1][k]);
+        if(shadows[0] != shadows[1]) differ++;
+        std::cout<<"compiled and pointer results differ on "<<differ<<" rays"<<std::endl;
+        ok = ok && differ == 0;
+    }
+    delete scene.camera;
+    if(!ok) std::cout<<"compiled scene check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
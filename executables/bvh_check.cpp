@@ -0,0 +1,127 @@
+#include "../src/scene.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+//Checks that the BVH changes no query result: traceRay, getColor and
+//inShadow through the pointer-based BVH and through the compiled scene give
+//the same t, object, normal, color and shadow as the linear scan over the
+//objects, bit for bit, on camera rays and on rays between random points of a
+//random scene and of the Cornell box.
+//Usage: bvh_check [objects] [rays per axis]
+//Exits with 1 if any result differs.
+
+//Counts the queries whose results differ from those of the linear scan
+class Mismatches {
+public:
+    long hits = 0, colors = 0, shadows = 0, queries = 0;
+    long total() const { return hits + colors + shadows; }
+};
+
+static bool sameHit(const std::pair<HitRecord,int> &a, const std::pair<HitRecord,int> &b)
+{
+    if((a.second > 0) != (b.second > 0)) return false;
+    if(a.second == 0) return true;
+    return a.first.t == b.first.t && a.first.object == b.first.object && a.first.n == b.first.n && a.first.mat == b.first.mat;
+}
+
+//scene answers with its BVH or compiled scene, linear has the same objects and none
+static void compare(const Scene &scene, const Scene &linear, const std::vector<Ray> &rays,
+                    const std::vector<glm::vec3> &points, Mismatches &m)
+{
+    for(const Ray &ray: rays)
+    {
+        m.queries++;
+        if(!sameHit(scene.traceRay(ray), linear.traceRay(ray))) m.hits++;
+        if(scene.getColor(ray) != linear.getColor(ray)) m.colors++;
+    }
+    for(const glm::vec3 &p: points)
+    {
+        for(const PointLight &light: scene.lights)
+        {
+            if(scene.inShadow(p, light) != linear.inShadow(p, light)) m.shadows++;
+        }
+    }
+}
+
+static bool check(const char *name, Scene &scene, int res, unsigned seed)
+{
+    Scene linear;
+    linear.objects = scene.objects;
+    linear.camera = scene.camera;
+    linear.lights = scene.lights;
+    linear.sky = scene.sky;
+    linear.ambientLight = scene.ambientLight;
+
+    //Camera rays, and rays between random points of the scene bounds so that
+    //every direction and many origins inside the hierarchy are covered
+    std::vector<Ray> rays;
+    for(int j = 0; j < res; j++)
+    {
+        for(int i = 0; i < res; i++) rays.push_back(scene.camera->make_ray(2*(i + 0.5f)/res - 1, 1 - 2*(j + 0.5f)/res));
+    }
+    AABB box;
+    for(const Object *obj: scene.objects)
+    {
+        if(obj->worldBounds().isFinite()) box.expand(obj->worldBounds());
+    }
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto randomPoint = [&]() {
+        return box.lo + (box.hi - box.lo)*glm::vec3(unit(gen), unit(gen), unit(gen));
+    };
+    std::vector<glm::vec3> points;
+    for(int k = 0; k < res*res; ++k)
+    {
+        glm::vec3 o = randomPoint();
+        rays.push_back(Ray(o, glm::normalize(randomPoint() - o)));
+        if(k % 4 == 0) points.push_back(randomPoint());
+    }
+
+    bool ok = true;
+    scene.buildBVH();
+    CompiledScene compiled = scene.compiled;
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        //The compiled scene first, then the pointer-based BVH alone
+        scene.compiled = pass == 0 ? compiled : CompiledScene();
+        Mismatches m;
+        compare(scene, linear, rays, points, m);
+        std::cout<<name<<"\t"<<(pass == 0 ? "compiled" : "BVH")<<"\t"<<m.queries<<"\t"<<m.hits<<"\t"<<m.colors<<"\t"
+                 <<points.size()*scene.lights.size()<<"\t"<<m.shadows<<std::endl;
+        ok = ok && m.total() == 0;
+    }
+    scene.compiled = compiled;
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int res = argc > 2 ? std::atoi(argv[2]) : 128;
+    bool ok = true;
+    std::cout<<"scene\tpath\trays\tdiffering hits\tdiffering colors\tshadow queries\tdiffering shadows"<<std::endl;
+
+    Scene random;
+    makeRandomScene(random, n);
+    float extent = 2.0f*std::cbrt((float)n)*0.15f;
+    for(int k = 0; k < 4; ++k)
+    {
+        glm::vec3 p(k % 2 ? extent : -extent, 2.0f*extent, (k < 2 ? -1.0f : -3.0f)*extent);
+        random.lights.push_back(PointLight(p, glm::vec3(10.0f*extent*extent)));
+    }
+    ok = check("random", random, res, 2) && ok;
+    for(auto obj:random.objects) delete obj;
+    delete random.camera;
+
+    Scene cornell;
+    makeCornellBox(cornell);
+    cornell.lights.push_back(PointLight(glm::vec3(0.0f, 4.5f, -12.0f), glm::vec3(20.0f)));
+    ok = check("cornell", cornell, res, 3) && ok;
+    for(auto obj:cornell.objects) delete obj;
+    delete cornell.camera;
+
+    if(!ok) std::cout<<"BVH check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
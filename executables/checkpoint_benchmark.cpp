@@ -0,0 +1,83 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Renders the Cornell box progressively without interruption, and again
+//stopping after a few passes, checkpointing, and resuming in a new renderer.
+//Prints the time and size of a checkpoint and whether the resumed image is
+//bit-identical to the uninterrupted one, for every sampler.
+//Usage: checkpoint_benchmark [spp per pass] [passes] [passes before the stop]
+//Exits with 1 if a resumed image differs.
+int main(int argc, char **argv) {
+    int w = 160, h = 120;
+    int samples = argc > 1 ? std::atoi(argv[1]) : 4;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 8;
+    int stop = argc > 3 ? std::atoi(argv[3]) : 3;
+    const char *names[3] = {"independent", "sobol", "blue noise"};
+    std::string path = "checkpoint_benchmark.ckpt";
+    ThreadPool pool;
+
+    Scene scene;
+    makeCornellBox(scene);
+    scene.pathSettings.iterative = true;
+    scene.pathSettings.nextEventEstimation = true;
+    scene.buildBVH();
+
+    bool ok = true;
+    std::cout<<"sampler\tsave ms\tbytes\tdiffering pixels"<<std::endl;
+    for(int type = 0; type < 3; ++type)
+    {
+        RenderSettings settings;
+        settings.numberOfSamples = samples;
+        settings.samplerType = (Sampler::Type)type;
+        settings.seed = 7;
+        HDRImage uninterrupted(w, h), resumed(w, h);
+        ProgressiveRenderer reference(scene, w, h, settings, pool);
+        reference.renderPasses(passes);
+        reference.snapshot(uninterrupted);
+
+        double saveSeconds;
+        {
+            ProgressiveRenderer first(scene, w, h, settings, pool);
+            first.renderPasses(stop);
+            auto start = std::chrono::steady_clock::now();
+            first.saveCheckpoint(path);
+            saveSeconds = secondsSince(start);
+        }
+        ProgressiveRenderer second(scene, w, h, settings, pool);
+        if(!second.resume(path))
+        {
+            std::cout<<"could not resume from "<<path<<std::endl;
+            return 1;
+        }
+        second.renderPasses(passes - stop);
+        second.snapshot(resumed);
+
+        int differing = 0;
+        for(size_t k = 0; k < resumed.pixels.size(); ++k)
+        {
+            differing += std::memcmp(&resumed.pixels[k], &uninterrupted.pixels[k], sizeof(color)) != 0;
+        }
+        ok = ok && differing == 0 && second.passes() == passes;
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        long bytes = 0;
+        if(file)
+        {
+            std::fseek(file, 0, SEEK_END);
+            bytes = std::ftell(file);
+            std::fclose(file);
+        }
+        std::cout<<names[type]<<"\t"<<saveSeconds*1e3<<"\t"<<bytes<<"\t"<<differing<<std::endl;
+    }
+    std::remove(path.c_str());
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+    if(!ok) std::cout<<"resumed image differs"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "../src/distributed.hpp"
+#include "../src/scene_cache.hpp"
+#include "bench_scenes.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Renders the Cornell box with worker processes started on this host, one of
+//them slowed down so that its jobs get issued again, and compares the merged
+//image with a local render. Prints the time, jobs and re-issued jobs.
+//Usage: distributed_render [workers] [spp] [samples per job] [listen address]
+//The coordinator listens on the loopback interface unless given an address,
+//workers on other hosts: distributed_render --worker host port [delay]
+//Exits with 1 if the merged image differs from the local one.
+//Workers take the built-in scene names or the path of a scene file, which
+//they map from its cache next to it once one of them has built it
+static bool loadScene(const std::string &description, Scene &scene)
+{
+    static SceneCache cache;
+    if(description == "cornell") makeCornellBox(scene);
+    else if(description == "spheres") makeRandomSpheres(scene, 10000);
+    else return cache.open(description, description + ".cache", scene);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if(argc > 3 && std::strcmp(argv[1], "--worker") == 0)
+        return runWorker(argv[2], std::atoi(argv[3]), loadScene, argc > 4 ? std::atof(argv[4]) : 0.0);
+
+    int count = argc > 1 ? std::max(1, std::atoi(argv[1])) : 3;
+    int w = 160, h = 120;
+    RenderSettings settings;
+    settings.numberOfSamples = argc > 2 ? std::atoi(argv[2]) : 16;
+    settings.seed = 3;
+    DistributedSettings distributed;
+    distributed.samplesPerJob = argc > 3 ? std::atoi(argv[3]) : 0;
+    PathSettings path;
+    path.iterative = true;
+    path.nextEventEstimation = true;
+
+    Coordinator coordinator(0, argc > 4 ? argv[4] : "");
+    if(!coordinator.listening())
+    {
+        std::cout<<"cannot listen"<<std::endl;
+        return 1;
+    }
+    std::string port = std::to_string(coordinator.port());
+    if(argc > 4) std::cout<<"listening on "<<argv[4]<<" port "<<port<<std::endl;
+    std::vector<pid_t> children;
+    for(int k = 0; k < count; ++k)
+    {
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            const char *delay = k == 0 && count > 1 ? "2" : "0";
+            execl(argv[0], argv[0], "--worker", "127.0.0.1", port.c_str(), delay, (char*)nullptr);
+            _exit(127);
+        }
+        if(pid > 0) children.push_back(pid);
+    }
+    int connected = coordinator.acceptWorkers(count, distributed.workerTimeout);
+
+    HDRImage merged(w, h);
+    DistributedStats stats;
+    bool finished = connected > 0 && coordinator.render("cornell", path, merged, settings, distributed, stats);
+    coordinator.finish();
+    for(pid_t pid:children) waitpid(pid, nullptr, 0);
+
+    Scene scene;
+    loadScene("cornell", scene);
+    scene.pathSettings = path;
+    scene.buildBVH();
+    HDRImage local(w, h);
+    auto start = std::chrono::steady_clock::now();
+    render(scene, local, settings);
+    double localSeconds = secondsSince(start);
+    int differing = 0;
+    for(int k = 0; k < w*h; ++k) differing += std::memcmp(&merged.pixels[k], &local.pixels[k], sizeof(color)) != 0;
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+
+    std::cout<<"workers\tjobs\treissued\tduplicates\tlost\tseconds\tlocal seconds\tdiffering pixels"<<std::endl;
+    std::cout<<connected<<"\t"<<stats.jobs<<"\t"<<stats.reissued<<"\t"<<stats.duplicates<<"\t"<<stats.lostWorkers
+             <<"\t"<<stats.seconds<<"\t"<<localSeconds<<"\t"<<differing<<std::endl;
+    //Sample ranges merged in double precision may round differently
+    bool ok = finished && (distributed.samplesPerJob > 0 || differing == 0);
+    if(!ok) std::cout<<"distributed render failed"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+#include "../src/scene.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+//Times Object::hit and Object::occluded for every shape type, untransformed
+//and rotated. Rays start on a sphere around the shape and aim at points near
+//it, so roughly half of them hit. Every ray also checks that occluded agrees
+//with hit, over the whole range and over one ending at a random distance.
+//Last, Scene::occluded is compared with the closest-hit loop over the objects
+//on shadow rays between random points of a random scene.
+//Usage: hit_benchmark [rays] [objects]
+//Exits with 1 if occluded and hit disagree on any ray.
+int main(int argc, char **argv) {
+    int rayCount = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    int objectCount = argc > 2 ? std::atoi(argv[2]) : 3000;
+    bool ok = true;
+    Material* mat = new Lambertian(glm::vec3(0.5f));
+    const char *names[4] = {"sphere", "box", "plane", "rectangle"};
+    Shape* shapes[4] = {new Sphere(glm::vec3(0.0f), 0.5f),
+                        new Box(glm::vec3(-0.5f), glm::vec3(0.5f)),
+                        new Plane(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)),
+                        new Rectangle(glm::vec3(-0.5f, 0.0f, -0.5f), glm::vec3(0.5f, 0.0f, 0.5f))};
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<Ray> rays;
+    rays.reserve(rayCount);
+    for(int i = 0; i < rayCount; ++i)
+    {
+        glm::vec3 o = glm::normalize(glm::vec3(unit(gen), unit(gen), unit(gen)))*3.0f;
+        glm::vec3 target = glm::vec3(unit(gen), unit(gen), unit(gen))*0.7f;
+        rays.push_back(Ray(o, glm::normalize(target - o)));
+    }
+
+    std::cout<<"shape\ttransform\thit Mrays/s\toccluded Mrays/s\thits\tdisagreeing"<<std::endl;
+    for(int s = 0; s < 4; ++s)
+    {
+        for(int rotated = 0; rotated < 2; ++rotated)
+        {
+            Object obj(shapes[s], mat);
+            if(rotated) obj.setTransform(glm::rotate(glm::mat4(1.0f), glm::radians(30.0f), glm::vec3(1.0f, 1.0f, 0.0f)));
+            Interval t_range = Interval(0.001f, std::numeric_limits<float>::max());
+            HitRecord rec = HitRecord();
+            int hits = 0, blocked = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(auto const &ray:rays) hits += obj.hit(ray, t_range, rec);
+            double hitSeconds = secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            for(auto const &ray:rays) blocked += obj.occluded(ray, t_range);
+            double occludedSeconds = secondsSince(start);
+            std::uniform_real_distribution<float> distance(0.5f, 5.0f);
+            long disagree = 0;
+            for(auto const &ray:rays)
+            {
+                Interval shortRange = Interval(0.001f, distance(gen));
+                if(obj.occluded(ray, t_range) != obj.hit(ray, t_range, rec)) disagree++;
+                if(obj.occluded(ray, shortRange) != obj.hit(ray, shortRange, rec)) disagree++;
+            }
+            std::cout<<names[s]<<"\t"<<(rotated ? "rotated" : "identity")<<"\t"<<rayCount/hitSeconds*1e-6<<"\t"
+                     <<rayCount/occludedSeconds*1e-6<<"\t"<<hits<<"/"<<blocked<<"\t"<<disagree<<std::endl;
+            ok = ok && disagree == 0;
+        }
+    }
+
+    //Shadow rays through a scene, the BVH any-hit query against the closest
+    //hit of every object
+    Scene scene;
+    makeRandomScene(scene, objectCount);
+    scene.buildBVH();
+    AABB box;
+    for(const Object *obj: scene.objects) box.expand(obj->worldBounds());
+    std::uniform_real_distribution<float> unit01(0.0f, 1.0f);
+    auto randomPoint = [&]() {
+        return box.lo + (box.hi - box.lo)*glm::vec3(unit01(gen), unit01(gen), unit01(gen));
+    };
+    int shadowRays = 20000;
+    long blocked = 0, disagree = 0;
+    for(int k = 0; k < shadowRays; ++k)
+    {
+        glm::vec3 p = randomPoint(), q = randomPoint();
+        Ray ray(p, q - p);
+        Interval t_range = Interval(0.001f, 1.0f);
+        bool any = false;
+        HitRecord rec = HitRecord();
+        for(const Object *obj: scene.objects) any = obj->hit(ray, t_range, rec) || any;
+        bool occluded = scene.occluded(ray, t_range);
+        blocked += occluded;
+        if(occluded != any) disagree++;
+    }
+    std::cout<<"scene of "<<objectCount<<" objects: "<<shadowRays<<" shadow rays, "<<blocked<<" blocked, "
+             <<disagree<<" disagreeing with the closest-hit loop"<<std::endl;
+    ok = ok && disagree == 0;
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+
+    if(!ok) std::cout<<"occlusion check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include "../src/scene.hpp"
+#include "../src/render.hpp"
+#include "../src/mesh.hpp"
+#include "bench_scenes.hpp"
+
+#include <sys/resource.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+//A forest of instances of one tree: a ShapeGroup of a crown mesh, a trunk
+//and branch boxes and a few spheres. Measures the memory of the unique
+//geometry and of every instance, the top-level build and the rays per
+//second through the compiled scene, and renders it. A small forest is
+//compared with its flattened copy, where every instance gets its own mesh
+//in world space and its own objects, which is what instancing saves.
+//Usage: instancing_benchmark [instances] [crown triangles]
+//Exits with 1 if the instanced and flattened forests disagree on more than
+//one ray in 10^4.
+static TriangleMesh *makeCrown(int triangles)
+{
+    TriangleMesh *mesh = new TriangleMesh();
+    int rings = std::max(3, (int)std::sqrt(triangles/4.0)), segments = std::max(3, triangles/(2*rings));
+    for(int i = 0; i <= rings; ++i)
+    {
+        float theta = (float)M_PI*i/rings;
+        for(int j = 0; j < segments; ++j)
+        {
+            float phi = 2.0f*(float)M_PI*j/segments;
+            float r = 0.6f*(1.0f + 0.08f*std::sin(5.0f*theta)*std::sin(7.0f*phi));
+            glm::vec3 n(std::sin(theta)*std::cos(phi), std::cos(theta), std::sin(theta)*std::sin(phi));
+            mesh->positions.push_back(glm::vec3(0.0f, 1.6f, 0.0f) + r*n);
+            mesh->normals.push_back(n);
+        }
+    }
+    for(int i = 0; i < rings; ++i)
+    {
+        for(int j = 0; j < segments; ++j)
+        {
+            int a = i*segments + j, b = (i + 1)*segments + j;
+            int c = (i + 1)*segments + (j + 1) % segments, d = i*segments + (j + 1) % segments;
+            int quad[6] = {a, b, c, a, c, d};
+            mesh->indices.insert(mesh->indices.end(), quad, quad + 6);
+        }
+    }
+    mesh->normalIndices = mesh->indices;
+    mesh->build();
+    return mesh;
+}
+
+static size_t groupBytes(const ShapeGroup &group)
+{
+    return group.members.capacity()*sizeof(Object) + group.bvh.nodes.size()*sizeof(BVH::Node) +
+           group.bvh.indices.size()*sizeof(int) + group.mbvh.nodes.size()*sizeof(MBVH::Node);
+}
+
+//Objects, the scene BVH and the compiled scene, without the shapes
+static size_t topLevelBytes(const Scene &scene)
+{
+    const CompiledScene &c = scene.compiled;
+    size_t bytes = scene.objects.size()*(sizeof(Object*) + sizeof(Object));
+    for(const BVH *bvh: {&scene.bvh, &c.bvh}) bytes += bvh->nodes.size()*sizeof(BVH::Node) + bvh->indices.size()*sizeof(int);
+    bytes += c.mbvh.nodes.size()*sizeof(MBVH::Node) + c.leaves.size()*sizeof(CompiledScene::Range);
+    bytes += c.others.size()*(sizeof(Object*) + sizeof(int)) + c.materialIndex.size()*sizeof(int);
+    bytes += c.transforms.size()*sizeof(CompiledScene::ObjectTransform);
+    bytes += (c.spheres.r.size() + c.boxes.lox.size())*8*sizeof(float);
+    return bytes;
+}
+
+static double peakMegabytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0;
+}
+
+//side x side trees two apart, turned and scaled at random
+static void plantForest(Scene &scene, ShapeGroup *tree, const std::vector<Material*> &mats, int instances)
+{
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    int side = (int)std::ceil(std::sqrt((double)instances));
+    for(int k = 0; k < instances; ++k)
+    {
+        glm::vec3 p(2.0f*(k % side - 0.5f*side) + 0.6f*uniform(rng), 0.0f, -2.0f*(k/side) + 0.6f*uniform(rng));
+        glm::mat4 M = glm::translate(glm::mat4(1.0f), p);
+        M = glm::rotate(M, 2.0f*(float)M_PI*uniform(rng), glm::vec3(0.0f, 1.0f, 0.0f));
+        M = glm::scale(M, glm::vec3(0.7f + 0.6f*uniform(rng)));
+        Object *obj = new Object(tree, mats[k % mats.size()]);
+        obj->setTransform(M);
+        scene.objects.push_back(obj);
+    }
+}
+
+static void lookAtForest(Scene &scene, int instances, int w, int h)
+{
+    int side = (int)std::ceil(std::sqrt((double)instances));
+    scene.camera = new Camera();
+    scene.camera->width = (float)w;
+    scene.camera->height = (float)h;
+    scene.camera->center = glm::vec3(0.0f, 3.0f + 0.2f*side, 4.0f);
+    glm::vec3 target(0.0f, 0.0f, -0.6f*side);
+    scene.camera->view = glm::normalize(target - scene.camera->center);
+    scene.camera->right = glm::normalize(glm::cross(scene.camera->view, glm::vec3(0.0f, 1.0f, 0.0f)));
+    scene.camera->up = glm::cross(scene.camera->right, scene.camera->view);
+}
+
+static std::vector<Ray> cameraRays(const Camera &camera, int w, int h)
+{
+    std::vector<Ray> rays;
+    for(int j = 0; j < h; ++j)
+        for(int i = 0; i < w; ++i) rays.push_back(camera.make_ray(i, j, w, h, glm::vec2(0.5f)));
+    return rays;
+}
+
+int main(int argc, char **argv) {
+    int instances = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int crownTriangles = argc > 2 ? std::atoi(argv[2]) : 20000;
+    bool ok = true;
+
+    TriangleMesh *crown = makeCrown(crownTriangles);
+    Box *trunk = new Box(glm::vec3(-0.08f, 0.0f, -0.08f), glm::vec3(0.08f, 1.1f, 0.08f));
+    Box *branch = new Box(glm::vec3(-0.03f, 0.6f, -0.03f), glm::vec3(0.03f, 1.2f, 0.03f));
+    std::vector<Sphere*> fruit;
+    for(int k = 0; k < 3; ++k)
+    {
+        float a = 2.1f*k;
+        fruit.push_back(new Sphere(glm::vec3(0.62f*std::cos(a), 1.4f + 0.1f*k, 0.62f*std::sin(a)), 0.07f));
+    }
+    ShapeGroup *tree = new ShapeGroup();
+    tree->add(crown);
+    tree->add(trunk);
+    tree->add(branch, glm::rotate(glm::mat4(1.0f), glm::radians(40.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    tree->add(branch, glm::rotate(glm::mat4(1.0f), glm::radians(-35.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+    for(Sphere *s: fruit) tree->add(s);
+    tree->build();
+    size_t uniqueBytes = crown->memoryBytes() + groupBytes(*tree);
+    std::cout<<"tree: "<<crown->triangleCount()<<" triangles and "<<tree->members.size()<<" members, "
+             <<uniqueBytes/1e6<<" MB"<<std::endl;
+
+    std::vector<Material*> mats = {new Lambertian(glm::vec3(0.2f, 0.6f, 0.2f)), new Lambertian(glm::vec3(0.5f, 0.7f, 0.1f)),
+                                   new Lambertian(glm::vec3(0.7f, 0.4f, 0.1f))};
+    Material *groundMat = new Lambertian(glm::vec3(0.4f, 0.3f, 0.2f));
+    Plane *groundPlane = new Plane(glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    //A small forest against its flattened copy
+    int checkInstances = 49, w = 160, h = 120;
+    Scene instanced, flattened;
+    plantForest(instanced, tree, mats, checkInstances);
+    lookAtForest(instanced, checkInstances, w, h);
+    size_t flatGeometry = 0;
+    std::vector<TriangleMesh*> copies;
+    std::vector<int> instanceOf;
+    for(int k = 0; k < checkInstances; ++k)
+    {
+        const Object *instance = instanced.objects[k];
+        glm::mat4 T = instance->transform.toMat4();
+        for(const Object &member: tree->members)
+        {
+            glm::mat4 W = T*member.transform.toMat4();
+            Object *obj;
+            if(member.shape == crown)
+            {
+                TriangleMesh *copy = new TriangleMesh(*crown);
+                glm::mat4 normalW = glm::inverseTranspose(W);
+                for(glm::vec3 &p: copy->positions) p = glm::vec3(W*glm::vec4(p, 1.0f));
+                for(glm::vec3 &n: copy->normals) n = glm::normalize(glm::vec3(normalW*glm::vec4(n, 0.0f)));
+                copy->build();
+                copies.push_back(copy);
+                flatGeometry += copy->memoryBytes();
+                obj = new Object(copy, instance->mat);
+            }
+            else
+            {
+                obj = new Object(member.shape, instance->mat);
+                obj->transform = AffineTransform(W);
+                obj->normalTransform = AffineTransform(glm::inverseTranspose(W));
+                obj->inverse = AffineTransform(glm::inverse(W));
+            }
+            flattened.objects.push_back(obj);
+            instanceOf.push_back(k);
+        }
+    }
+    instanced.objects.push_back(new Object(groundPlane, groundMat));
+    flattened.objects.push_back(new Object(groundPlane, groundMat));
+    instanceOf.push_back(checkInstances);
+    instanced.buildBVH();
+    flattened.buildBVH();
+    std::vector<Ray> rays = cameraRays(*instanced.camera, 4*w, 4*h);
+    long disagree = 0;
+    Interval range(1e-4f, std::numeric_limits<float>::max());
+    for(const Ray &ray: rays)
+    {
+        HitRecord a, b;
+        bool hitA = instanced.compiled.intersect(ray, range, a), hitB = flattened.compiled.intersect(ray, range, b);
+        if(hitA != hitB) disagree++;
+        else if(hitA && (a.object != instanceOf[b.object] || std::abs(a.t - b.t) > 1e-3f*b.t)) disagree++;
+    }
+    double flatPerInstance = (double)(flatGeometry + topLevelBytes(flattened))/checkInstances;
+    std::cout<<"instances\tunique MB\tper instance bytes\tflattened per instance bytes\trays\tdisagreeing"<<std::endl;
+    std::cout<<checkInstances<<"\t"<<uniqueBytes/1e6<<"\t"<<(double)topLevelBytes(instanced)/checkInstances<<"\t"
+             <<flatPerInstance<<"\t"<<rays.size()<<"\t"<<disagree<<std::endl;
+    ok = ok && disagree*10000 <= (long)rays.size();
+    for(auto obj:flattened.objects) delete obj;
+    for(auto copy:copies) delete copy;
+    for(auto obj:instanced.objects) delete obj;
+    delete instanced.camera;
+
+    //The large forest, instanced only
+    Scene forest;
+    plantForest(forest, tree, mats, instances);
+    forest.objects.push_back(new Object(groundPlane, groundMat));
+    forest.lights.push_back(PointLight(glm::vec3(0.0f, 50.0f, 20.0f), glm::vec3(5000.0f)));
+    forest.sky = glm::vec3(0.5f, 0.7f, 1.0f);
+    lookAtForest(forest, instances, w, h);
+    auto start = std::chrono::steady_clock::now();
+    forest.buildBVH();
+    double buildSeconds = secondsSince(start);
+    rays = cameraRays(*forest.camera, 4*w, 4*h);
+    long hits = 0;
+    start = std::chrono::steady_clock::now();
+    for(const Ray &ray: rays)
+    {
+        HitRecord rec;
+        hits += forest.compiled.intersect(ray, range, rec);
+    }
+    double raySeconds = secondsSince(start);
+    HDRImage image(w, h);
+    RenderSettings settings;
+    settings.numberOfSamples = 1;
+    settings.integrator = RenderSettings::Whitted;
+    start = std::chrono::steady_clock::now();
+    render(forest, image, settings);
+    double renderSeconds = secondsSince(start);
+    double flattenedGB = instances*flatPerInstance/1e9;
+    std::cout<<"instances\ttriangles\ttop-level MB\tper instance bytes\tflattened estimate GB\tbuild s\tMrays/s\trender s\tpeak RSS MB"<<std::endl;
+    std::cout<<instances<<"\t"<<(double)instances*crown->triangleCount()<<"\t"<<topLevelBytes(forest)/1e6<<"\t"
+             <<(double)topLevelBytes(forest)/instances<<"\t"<<flattenedGB<<"\t"<<buildSeconds<<"\t"
+             <<rays.size()/raySeconds/1e6<<"\t"<<renderSeconds<<"\t"<<peakMegabytes()<<std::endl;
+
+    for(auto obj:forest.objects) delete obj;
+    delete forest.camera;
+    delete tree;
+    delete crown;
+    delete trunk;
+    delete branch;
+    for(Sphere *s: fruit) delete s;
+    for(Material *m: mats) delete m;
+    delete groundMat;
+    delete groundPlane;
+    if(!ok) std::cout<<"instancing check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
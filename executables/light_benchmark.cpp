@@ -0,0 +1,68 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+static double rmse(const HDRImage &a, const HDRImage &b)
+{
+    double sum = 0.0;
+    for(size_t k = 0; k < a.pixels.size(); ++k)
+    {
+        glm::vec3 d = a.pixels[k] - b.pixels[k];
+        sum += glm::dot(d, d)/3.0;
+    }
+    return std::sqrt(sum/a.pixels.size());
+}
+
+//Sweeps the number of lights in the many lights scene. For each count it
+//prints the render time of the per-light loops used without next event
+//estimation, then time and RMSE against a light BVH reference for next event
+//estimation picking lights by power and by the light BVH.
+//Usage: light_benchmark [max lights] [spp] [reference spp]
+int main(int argc, char **argv) {
+    int w = 64, h = 48;
+    int maxLights = argc > 1 ? std::atoi(argv[1]) : 1024;
+    int samples = argc > 2 ? std::atoi(argv[2]) : 16;
+    int referenceSamples = argc > 3 ? std::atoi(argv[3]) : 512;
+    ThreadPool pool;
+
+    RenderSettings settings;
+    settings.numberOfBounces = 5;
+    settings.pixelJitter = true;
+    std::cout<<"lights\tloop s\tpower s\tpower rmse\ttree s\ttree rmse"<<std::endl;
+    for(int n = 1; n <= maxLights; n *= 4)
+    {
+        Scene scene;
+        makeManyLightsScene(scene, n);
+        scene.pathSettings.iterative = true;
+        scene.buildBVH();
+
+        scene.pathSettings.nextEventEstimation = true;
+        scene.pathSettings.lightTree = true;
+        settings.numberOfSamples = referenceSamples;
+        settings.seed = 12345;
+        HDRImage reference(w, h);
+        render(scene, reference, settings, pool);
+
+        settings.numberOfSamples = samples;
+        settings.seed = 1;
+        std::cout<<n;
+        for(int mode = 0; mode < 3; ++mode)
+        {
+            scene.pathSettings.nextEventEstimation = mode > 0;
+            scene.pathSettings.lightTree = mode == 2;
+            HDRImage image(w, h);
+            auto start = std::chrono::steady_clock::now();
+            render(scene, image, settings, pool);
+            std::cout<<"\t"<<secondsSince(start);
+            if(mode > 0) std::cout<<"\t"<<rmse(image, reference);
+        }
+        std::cout<<std::endl;
+        for(auto obj:scene.objects) delete obj;
+        delete scene.camera;
+    }
+}
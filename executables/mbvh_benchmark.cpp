@@ -0,0 +1,97 @@
+#include "../src/scene.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+//Compares the binary BVH with the four-wide MBVH on the Cornell box and a
+//random sphere scene. Camera rays are traced for the closest hit, then a
+//shadow ray goes from every hit point to a point above the scene. Prints
+//rays per second and hierarchy nodes visited per ray. The four-wide
+//hierarchy must give the binary one's hits, t, points, normals, objects and
+//shadow results bit for bit.
+//Usage: mbvh_benchmark [spheres] [rays per axis]
+//Exits with 1 if the two widths disagree.
+
+//What the camera rays and the shadow rays from their hit points found
+class Results {
+public:
+    std::vector<HitRecord> records;
+    std::vector<char> hits, shadows;
+};
+
+static long countDifferences(const Results &a, const Results &b)
+{
+    long differ = 0;
+    for(size_t k = 0; k < a.hits.size(); ++k)
+    {
+        if(a.hits[k] != b.hits[k]) differ++;
+        else if(a.hits[k])
+        {
+            const HitRecord &x = a.records[k], &y = b.records[k];
+            differ += x.t != y.t || x.p != y.p || x.n != y.n || x.object != y.object || x.mat != y.mat;
+        }
+    }
+    if(a.shadows != b.shadows) differ++;
+    return differ;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int res = argc > 2 ? std::atoi(argv[2]) : 256;
+    bool ok = true;
+    const char *names[2] = {"cornell", "spheres"};
+    std::cout<<"scene\twidth\tclosest Mrays/s\tsteps/ray\tshadow Mrays/s\tsteps/ray\thits"<<std::endl;
+    for(int s = 0; s < 2; ++s)
+    {
+        Scene scene;
+        if(s == 0) makeCornellBox(scene);
+        else makeRandomSpheres(scene, n);
+        glm::vec3 light = s == 0 ? glm::vec3(0.0f, 4.5f, -12.0f) : glm::vec3(0.0f, 10.0f, 0.0f);
+        Results results[2];
+        for(int width = 2; width <= 4; width += 2)
+        {
+            Results &r = results[width/2 - 1];
+            r.records.resize(res*res);
+            r.hits.resize(res*res);
+            BVHBuildOptions options;
+            options.width = width;
+            scene.buildBVH(options);
+            Interval t_range = Interval(0.001f, std::numeric_limits<float>::max());
+            std::vector<glm::vec3> points;
+            points.reserve(res*res);
+            long closestSteps = 0, shadowSteps = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int j = 0; j < res; j++) {
+                for (int i = 0; i < res; i++) {
+                    float x = 2*(i+0.5)/res - 1;
+                    float y = 1 - 2*(j+0.5)/res;
+                    HitRecord &rec = r.records[j*res + i];
+                    r.hits[j*res + i] = scene.compiled.intersect(scene.camera->make_ray(x, y), t_range, rec, &closestSteps);
+                    if(r.hits[j*res + i]) points.push_back(rec.p);
+                }
+            }
+            double closestSeconds = secondsSince(start);
+            int blocked = 0;
+            start = std::chrono::steady_clock::now();
+            for(auto const &p:points)
+            {
+                r.shadows.push_back(scene.compiled.occluded(Ray(p, light - p), Interval(1e-4f, 1.0f - 1e-3f), false, &shadowSteps));
+                blocked += r.shadows.back();
+            }
+            double shadowSeconds = secondsSince(start);
+            int shadowRays = std::max(1, (int)points.size());
+            std::cout<<names[s]<<"\t"<<width<<"\t"<<res*res/closestSeconds*1e-6<<"\t"<<(double)closestSteps/(res*res)
+                     <<"\t"<<shadowRays/shadowSeconds*1e-6<<"\t"<<(double)shadowSteps/shadowRays
+                     <<"\t"<<points.size()<<"/"<<blocked<<std::endl;
+        }
+        long differ = countDifferences(results[0], results[1]);
+        std::cout<<names[s]<<": width 4 and width 2 differ on "<<differ<<" rays"<<std::endl;
+        ok = ok && differ == 0;
+        for(auto obj:scene.objects) delete obj;
+        delete scene.camera;
+    }
+    if(!ok) std::cout<<"MBVH check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
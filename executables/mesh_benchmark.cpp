@@ -0,0 +1,298 @@
+#include "../src/scene.hpp"
+#include "../src/render.hpp"
+#include "../src/mesh.hpp"
+#include "../src/scene_file.hpp"
+#include "bench_scenes.hpp"
+
+#include <sys/resource.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+//Writes a closed torus of about n triangles with vertex normals as an OBJ
+//and a binary PLY file, loads both with the streaming readers and compares
+//them to the generated mesh, then measures:
+//  - watertightness: rays from inside the tube aimed exactly at vertices and
+//    edge midpoints, where a naive test can slip between two triangles
+//  - random rays against the mesh BVH, in rays and triangle tests per second
+//  - a render of the Cornell box with the mesh added by a scene file
+//Usage: mesh_benchmark [triangles]
+//Exits with 1 if a loaded mesh differs or a ray from inside misses.
+static const float majorRadius = 1.0f, minorRadius = 0.35f;
+
+static void makeTorus(TriangleMesh &mesh, int rings, int segments)
+{
+    for(int i = 0; i < rings; ++i)
+    {
+        float phi = 2.0f*(float)M_PI*i/rings;
+        glm::vec3 radial(std::cos(phi), 0.0f, std::sin(phi));
+        for(int j = 0; j < segments; ++j)
+        {
+            float theta = 2.0f*(float)M_PI*j/segments;
+            glm::vec3 n = std::cos(theta)*radial + glm::vec3(0.0f, std::sin(theta), 0.0f);
+            mesh.positions.push_back(majorRadius*radial + minorRadius*n);
+            mesh.normals.push_back(n);
+        }
+    }
+    for(int i = 0; i < rings; ++i)
+    {
+        for(int j = 0; j < segments; ++j)
+        {
+            int a = i*segments + j, b = ((i + 1) % rings)*segments + j;
+            int c = ((i + 1) % rings)*segments + (j + 1) % segments, d = i*segments + (j + 1) % segments;
+            int quad[6] = {a, d, c, a, c, b};
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    mesh.normalIndices = mesh.indices;
+}
+
+static bool writeOBJ(const TriangleMesh &mesh, const std::string &path)
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(!file) return false;
+    std::fprintf(file, "# torus, %zu triangles\no torus\n", mesh.triangleCount());
+    for(const glm::vec3 &p: mesh.positions) std::fprintf(file, "v %.9g %.9g %.9g\n", p.x, p.y, p.z);
+    for(const glm::vec3 &n: mesh.normals) std::fprintf(file, "vn %.9g %.9g %.9g\n", n.x, n.y, n.z);
+    for(size_t k = 0; k < mesh.indices.size(); k += 3)
+    {
+        std::fprintf(file, "f %d//%d %d//%d %d//%d\n", mesh.indices[k] + 1, mesh.normalIndices[k] + 1,
+                     mesh.indices[k + 1] + 1, mesh.normalIndices[k + 1] + 1, mesh.indices[k + 2] + 1, mesh.normalIndices[k + 2] + 1);
+    }
+    return std::fclose(file) == 0;
+}
+
+static bool writePLY(const TriangleMesh &mesh, const std::string &path)
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if(!file) return false;
+    std::fprintf(file, "ply\nformat binary_little_endian 1.0\ncomment torus\nelement vertex %zu\n"
+                 "property float x\nproperty float y\nproperty float z\n"
+                 "property float nx\nproperty float ny\nproperty float nz\n"
+                 "element face %zu\nproperty list uchar int vertex_indices\nend_header\n",
+                 mesh.positions.size(), mesh.triangleCount());
+    //The benchmark machines are little endian
+    for(size_t k = 0; k < mesh.positions.size(); ++k)
+    {
+        std::fwrite(&mesh.positions[k], sizeof(float), 3, file);
+        std::fwrite(&mesh.normals[k], sizeof(float), 3, file);
+    }
+    unsigned char three = 3;
+    for(size_t k = 0; k < mesh.indices.size(); k += 3)
+    {
+        std::fwrite(&three, 1, 1, file);
+        std::fwrite(&mesh.indices[k], sizeof(int), 3, file);
+    }
+    return std::fclose(file) == 0;
+}
+
+static long fileBytes(const std::string &path)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if(!file) return 0;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fclose(file);
+    return size;
+}
+
+static double peakMegabytes()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0;
+}
+
+//Largest difference of the vertices and normals, -1 if the triangles differ
+static float meshDifference(const TriangleMesh &a, const TriangleMesh &b)
+{
+    if(a.indices != b.indices || a.normalIndices != b.normalIndices ||
+       a.positions.size() != b.positions.size() || a.normals.size() != b.normals.size()) return -1.0f;
+    float difference = 0.0f;
+    for(size_t k = 0; k < a.positions.size(); ++k)
+    {
+        difference = std::max(difference, glm::length(a.positions[k] - b.positions[k]));
+        difference = std::max(difference, glm::length(a.normals[k] - b.normals[k]));
+    }
+    return difference;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    int rings = std::max(3, (int)std::sqrt(1.5*n)), segments = std::max(3, n/(2*rings));
+    std::string objPath = "mesh_benchmark.obj", plyPath = "mesh_benchmark.ply", scenePath = "mesh_benchmark.scene";
+    bool ok = true;
+
+    TriangleMesh generated;
+    makeTorus(generated, rings, segments);
+    size_t triangles = generated.triangleCount();
+    if(!writeOBJ(generated, objPath) || !writePLY(generated, plyPath))
+    {
+        std::cout<<"cannot write the mesh files"<<std::endl;
+        return 1;
+    }
+    std::cout<<triangles<<" triangles, "<<generated.positions.size()<<" vertices"<<std::endl;
+
+    std::cout<<"file\tMB\tload s\tbuild s\tMB/s\tMtris/s\tmesh MB\tbytes/tri\tpeak RSS MB\tmax difference"<<std::endl;
+    TriangleMesh mesh;
+    for(int format = 0; format < 2; ++format)
+    {
+        const std::string &path = format == 0 ? objPath : plyPath;
+        TriangleMesh loaded;
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        bool read = format == 0 ? loaded.loadOBJ(path, error) : loaded.loadPLY(path, error);
+        double loadSeconds = secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        if(read) loaded.build();
+        double buildSeconds = secondsSince(start);
+        if(!read)
+        {
+            std::cout<<error<<std::endl;
+            return 1;
+        }
+        double megabytes = fileBytes(path)/1e6;
+        float difference = meshDifference(generated, loaded);
+        std::cout<<(format == 0 ? "obj" : "ply")<<"\t"<<megabytes<<"\t"<<loadSeconds<<"\t"<<buildSeconds<<"\t"
+                 <<megabytes/loadSeconds<<"\t"<<triangles/loadSeconds/1e6<<"\t"<<loaded.memoryBytes()/1e6<<"\t"
+                 <<(double)loaded.memoryBytes()/triangles<<"\t"<<peakMegabytes()<<"\t"<<difference<<std::endl;
+        //Text round trips to the nearest float, binary is exact
+        ok = ok && difference >= 0.0f && difference <= (format == 0 ? 1e-6f : 0.0f);
+        if(format == 1) mesh = std::move(loaded);
+    }
+    generated = TriangleMesh();
+
+    //From the center of every ring of the tube towards its vertices and the
+    //midpoints of its edges, every ray has to hit
+    long inside = 0, misses = 0;
+    for(int i = 0; i < rings; ++i)
+    {
+        float phi = 2.0f*(float)M_PI*i/rings;
+        glm::vec3 core = majorRadius*glm::vec3(std::cos(phi), 0.0f, std::sin(phi));
+        for(int j = 0; j < segments; ++j)
+        {
+            const glm::vec3 &v = mesh.positions[i*segments + j];
+            const glm::vec3 &next = mesh.positions[((i + 1) % rings)*segments + (j + 1) % segments];
+            const glm::vec3 &up = mesh.positions[i*segments + (j + 1) % segments];
+            glm::vec3 targets[3] = {v, 0.5f*(v + next), 0.5f*(v + up)};
+            for(const glm::vec3 &target: targets)
+            {
+                HitRecord rec;
+                misses += !mesh.hit(Ray(core, target - core), Interval(1e-4f, std::numeric_limits<float>::max()), rec);
+                inside++;
+            }
+        }
+    }
+    std::cout<<"rays from inside\t"<<inside<<"\tmisses\t"<<misses<<std::endl;
+    ok = ok && misses == 0;
+
+    //Random rays from a sphere around the torus towards points in its bounds
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<Ray> rays;
+    AABB box = mesh.bounds();
+    for(int k = 0; k < 500000; ++k)
+    {
+        glm::vec3 origin;
+        do origin = glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+        while(glm::length(origin) > 1.0f || glm::length(origin) < 0.1f);
+        origin = 3.0f*glm::normalize(origin);
+        glm::vec3 target = box.centroid() + 0.5f*(box.hi - box.lo)*glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+        rays.push_back(Ray(origin, target - origin));
+    }
+    Interval range(1e-4f, std::numeric_limits<float>::max());
+    long hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(const Ray &ray: rays)
+    {
+        HitRecord rec;
+        hits += mesh.hit(ray, range, rec);
+    }
+    double hitSeconds = secondsSince(start);
+    //The same closest hit traversal, counting the triangle tests
+    long tests = 0;
+    start = std::chrono::steady_clock::now();
+    for(const Ray &ray: rays)
+    {
+        TriangleMesh::WatertightRay sheared(ray);
+        mesh.traverse(ray, range, [&](int tri, float &tmax) {
+            float t, b1, b2;
+            tests++;
+            if(mesh.intersect(sheared, tri, range.min, tmax, t, b1, b2)) tmax = t;
+            return false;
+        });
+    }
+    double testSeconds = secondsSince(start);
+    //The triangle test alone, every ray against 16 neighbouring triangles
+    long rawTests = 0, rawHits = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t k = 0; k < rays.size(); ++k)
+    {
+        TriangleMesh::WatertightRay sheared(rays[k]);
+        int first = (int)(k*7919 % (triangles - 16));
+        for(int tri = first; tri < first + 16; ++tri)
+        {
+            float t, b1, b2;
+            rawHits += mesh.intersect(sheared, tri, range.min, range.max, t, b1, b2);
+        }
+        rawTests += 16;
+    }
+    double rawSeconds = secondsSince(start);
+    std::cout<<"rays\thits\tMrays/s\ttests/ray\tMtriangles/s intersected\tMtriangles/s without traversal"<<std::endl;
+    std::cout<<rays.size()<<"\t"<<hits<<"\t"<<rays.size()/hitSeconds/1e6<<"\t"<<(double)tests/rays.size()<<"\t"
+             <<tests/testSeconds/1e6<<"\t"<<rawTests/rawSeconds/1e6<<" ("<<rawHits<<" hits)"<<std::endl;
+
+    //The Cornell box with and without the torus, placed by the scene file
+    Scene box1, box2;
+    makeCornellBox(box1);
+    bool written = writeSceneFile(box1, scenePath);
+    for(auto obj:box1.objects) delete obj;
+    delete box1.camera;
+    FILE *file = written ? std::fopen(scenePath.c_str(), "ab") : nullptr;
+    if(!file)
+    {
+        std::cout<<"cannot write "<<scenePath<<std::endl;
+        return 1;
+    }
+    std::fprintf(file, "material torus lambertian 0.8 0.7 0.3\ntranslate -1.5 -3 -11.5\nrotate 60 1 0 0\nscale 1.5 1.5 1.5\n"
+                 "mesh torus %s\nidentity\n", plyPath.c_str());
+    std::fclose(file);
+    SceneFile withMesh;
+    if(!withMesh.load(scenePath, box2))
+    {
+        std::cout<<withMesh.error<<std::endl;
+        return 1;
+    }
+    box2.buildBVH();
+    int w = 160, h = 120;
+    RenderSettings settings;
+    settings.numberOfSamples = 4;
+    box2.pathSettings.nextEventEstimation = true;
+    HDRImage image(w, h);
+    start = std::chrono::steady_clock::now();
+    render(box2, image, settings);
+    double renderSeconds = secondsSince(start);
+    Scene box3;
+    SceneFile withoutMesh;
+    withoutMesh.load(scenePath, box3);
+    box3.objects.pop_back();
+    box3.buildBVH();
+    box3.pathSettings.nextEventEstimation = true;
+    HDRImage reference(w, h);
+    render(box3, reference, settings);
+    int differing = 0;
+    for(size_t k = 0; k < image.pixels.size(); ++k) differing += std::memcmp(&image.pixels[k], &reference.pixels[k], sizeof(color)) != 0;
+    std::cout<<"render "<<w<<"x"<<h<<" "<<settings.numberOfSamples<<" spp\t"<<renderSeconds<<" s\tpixels showing the mesh\t"
+             <<differing<<std::endl;
+    ok = ok && differing > 0;
+
+    std::remove(objPath.c_str());
+    std::remove(plyPath.c_str());
+    std::remove(scenePath.c_str());
+    if(!ok) std::cout<<"mesh check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "../src/scene.hpp"
 #include "../src/image.hpp"
+#include "../src/render.hpp"
 
 #include <SDL2/SDL.h>
 #include <iostream>
@@ -102,22 +103,11 @@ int main() {
     // scene.sky = glm::vec3(0.0,0.0,0.0);
     scene.ambientLight = glm::vec3(1.0,1.0,1.0);
 
-    for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            float x = 2*(i+0.5)/w - 1;
-            float y = 1 - 2*(j+0.5)/h;
-            Ray ray = scene.camera->make_ray(x, y);
+    scene.buildBVH();
 
-
-            // trace the ray and get the colour
-            // color c = glm::normalize(ray.d)*0.5f + 0.5f;;
-            // color c = scene.tracePath(ray, 100, 5);
-            color c = scene.getColor(ray);
-            // std::cout<<x<<" "<<y<<" "<<to_string(c)<<std::endl;
-            image.pixel(i, j) = c;
-
-        }
-    }
+    RenderSettings settings;
+    settings.integrator = RenderSettings::Whitted;
+    render(scene, image, settings);
     SDL_Surface *out = SDL_CreateRGBSurface(0, w, h, 32, 0, 0, 0, 0);
     tonemap(image, out, 1, 2.2f);
     std::string filename = "path_tracing.png";
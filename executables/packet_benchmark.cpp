@@ -0,0 +1,124 @@
+#include "../src/scene.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Traces camera rays in 8x8 pixel blocks one ray at a time and as packets,
+//on the Cornell box and a random sphere scene, then does the same for the
+//shadow rays from every hit to a point light. Prints rays per second and
+//hierarchy nodes visited per ray or per packet.
+//Usage: packet_benchmark [spheres] [rays per axis]
+//Exits with 1 if a packet result differs from the single ray one.
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int res = argc > 2 ? (std::atoi(argv[2]) + 7)/8*8 : 256;
+    const char *names[2] = {"cornell", "spheres"};
+    bool ok = true;
+    std::cout<<"scene\trays\tclosest Mrays/s\tsteps\tshadow Mrays/s\tsteps\tmismatches"<<std::endl;
+    for(int s = 0; s < 2; ++s)
+    {
+        Scene scene;
+        if(s == 0) makeCornellBox(scene);
+        else makeRandomSpheres(scene, n);
+        PointLight light(s == 0 ? glm::vec3(0.0f, 4.5f, -12.0f) : glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(1.0f));
+        scene.buildBVH();
+
+        //Camera packets, then the shadow packets of their hits
+        int blocks = res/8*res/8;
+        std::vector<RayPacket> primary(blocks), shadow(blocks);
+        for(int b = 0; b < blocks; ++b)
+        {
+            int x0 = b % (res/8)*8, y0 = b / (res/8)*8;
+            for(int k = 0; k < RayPacket::maxSize; ++k)
+            {
+                float x = 2*(x0 + k % 8 + 0.5)/res - 1;
+                float y = 1 - 2*(y0 + k / 8 + 0.5)/res;
+                primary[b].set(k, scene.camera->make_ray(x, y), Interval(0.001f, std::numeric_limits<float>::max()));
+            }
+        }
+        std::vector<HitRecord> single(blocks*RayPacket::maxSize), packed(blocks*RayPacket::maxSize);
+        std::vector<uint64_t> singleHits(blocks), packedHits(blocks), singleBlocked(blocks), packedBlocked(blocks);
+
+        for(int packets = 0; packets < 2; ++packets)
+        {
+            long closestSteps = 0, shadowSteps = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(int b = 0; b < blocks; ++b)
+            {
+                HitRecord *recs = (packets ? packed.data() : single.data()) + b*RayPacket::maxSize;
+                if(packets)
+                {
+                    packedHits[b] = scene.compiled.intersect(primary[b], recs, &closestSteps);
+                    continue;
+                }
+                singleHits[b] = 0;
+                for(int k = 0; k < RayPacket::maxSize; ++k)
+                {
+                    if(scene.compiled.intersect(primary[b].ray(k), Interval(primary[b].tmin[k], primary[b].tmax[k]),
+                                                recs[k], &closestSteps))
+                        singleHits[b] |= uint64_t(1) << k;
+                }
+            }
+            double closestSeconds = secondsSince(start);
+
+            int shadowRays = 0;
+            for(int b = 0; b < blocks; ++b)
+            {
+                shadow[b].active = 0;
+                for(int k = 0; k < RayPacket::maxSize; ++k)
+                {
+                    if(!(singleHits[b] >> k & 1)) continue;
+                    Interval t_range = Interval(0.0f, 0.0f);
+                    Ray ray = scene.shadowRay(single[b*RayPacket::maxSize + k].p, light, t_range);
+                    shadow[b].set(k, ray, t_range);
+                    ++shadowRays;
+                }
+            }
+            start = std::chrono::steady_clock::now();
+            for(int b = 0; b < blocks; ++b)
+            {
+                if(packets)
+                {
+                    packedBlocked[b] = scene.compiled.occluded(shadow[b], true, &shadowSteps);
+                    continue;
+                }
+                singleBlocked[b] = 0;
+                for(int k = 0; k < RayPacket::maxSize; ++k)
+                {
+                    if(!(shadow[b].active >> k & 1)) continue;
+                    if(scene.compiled.occluded(shadow[b].ray(k), Interval(shadow[b].tmin[k], shadow[b].tmax[k]), true,
+                                               &shadowSteps))
+                        singleBlocked[b] |= uint64_t(1) << k;
+                }
+            }
+            double shadowSeconds = secondsSince(start);
+
+            int mismatches = 0;
+            if(packets)
+            {
+                for(int b = 0; b < blocks; ++b)
+                {
+                    mismatches += packedHits[b] != singleHits[b] || packedBlocked[b] != singleBlocked[b];
+                    for(int k = 0; k < RayPacket::maxSize; ++k)
+                    {
+                        const HitRecord &a = single[b*RayPacket::maxSize + k], &c = packed[b*RayPacket::maxSize + k];
+                        if(!(singleHits[b] >> k & 1)) continue;
+                        mismatches += a.t != c.t || a.object != c.object || std::memcmp(&a.p, &c.p, sizeof(a.p)) != 0 ||
+                                      std::memcmp(&a.n, &c.n, sizeof(a.n)) != 0;
+                    }
+                }
+                ok = ok && mismatches == 0;
+            }
+            int units = packets ? blocks : res*res;
+            std::cout<<names[s]<<"\t"<<(packets ? "packets" : "single")<<"\t"<<res*res/closestSeconds*1e-6
+                     <<"\t"<<(double)closestSteps/units<<"\t"<<std::max(1, shadowRays)/shadowSeconds*1e-6
+                     <<"\t"<<(double)shadowSteps/(packets ? blocks : std::max(1, shadowRays))<<"\t"<<mismatches<<std::endl;
+        }
+        for(auto obj:scene.objects) delete obj;
+        delete scene.camera;
+    }
+    if(!ok) std::cout<<"packet mismatch"<<std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+static double rmse(const HDRImage &a, const HDRImage &b)
+{
+    double sum = 0.0;
+    for(size_t k = 0; k < a.pixels.size(); ++k)
+    {
+        glm::vec3 d = a.pixels[k] - b.pixels[k];
+        sum += glm::dot(d, d)/3.0;
+    }
+    return std::sqrt(sum/a.pixels.size());
+}
+
+//Renders the Cornell box once in a single batch and once progressively in
+//passes of the same total sample count, and prints the throughput of both.
+//Then renders progressively on another thread until a deadline while this
+//thread takes tonemapped snapshots, printing the passes done and the RMSE of
+//each snapshot against the batch image.
+//Usage: progressive_benchmark [spp per pass] [passes] [seconds]
+int main(int argc, char **argv) {
+    int w = 128, h = 96;
+    int samples = argc > 1 ? std::atoi(argv[1]) : 4;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 16;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 2.0;
+    ThreadPool pool;
+
+    Scene scene;
+    makeCornellBox(scene);
+    scene.pathSettings.iterative = true;
+    scene.pathSettings.nextEventEstimation = true;
+    scene.buildBVH();
+
+    RenderSettings settings;
+    settings.numberOfSamples = samples*passes;
+    HDRImage batch(w, h);
+    auto start = std::chrono::steady_clock::now();
+    render(scene, batch, settings, pool);
+    double batchSeconds = secondsSince(start);
+
+    settings.numberOfSamples = samples;
+    ProgressiveRenderer progressive(scene, w, h, settings, pool);
+    start = std::chrono::steady_clock::now();
+    progressive.renderPasses(passes);
+    double progressiveSeconds = secondsSince(start);
+    HDRImage image(w, h);
+    progressive.snapshot(image);
+    double paths = (double)w*h*samples*passes;
+    std::cout<<"renderer\tMpaths/s\trmse to batch"<<std::endl;
+    std::cout<<"batch\t"<<paths/batchSeconds*1e-6<<"\t0"<<std::endl;
+    std::cout<<"progressive\t"<<paths/progressiveSeconds*1e-6<<"\t"<<rmse(image, batch)<<std::endl;
+
+    //Live preview, as an interactive viewer would show it
+    ProgressiveRenderer live(scene, w, h, settings, pool);
+    SDL_Surface *preview = SDL_CreateRGBSurface(0, w, h, 32, 0, 0, 0, 0);
+    start = std::chrono::steady_clock::now();
+    std::thread worker([&]() {
+        live.renderUntil(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                     std::chrono::duration<double>(seconds)));
+    });
+    std::cout<<"seconds\tpasses\trmse to batch"<<std::endl;
+    for(int k = 1; k <= 8; ++k)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds/8));
+        live.snapshot(image);
+        live.snapshot(preview);
+        std::cout<<secondsSince(start)<<"\t"<<live.passes()<<"\t"<<rmse(image, batch)<<std::endl;
+    }
+    worker.join();
+    SDL_FreeSurface(preview);
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+}
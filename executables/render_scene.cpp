@@ -0,0 +1,14 @@
+#include "scene_render.hpp"
+
+#include <cstdlib>
+
+//Renders a scene file with the image size and settings it gives
+//Usage: render_scene <scene file> [output png] [samples]
+int main(int argc, char **argv) {
+    if(argc < 2)
+    {
+        std::cout<<"usage: render_scene <scene file> [output png] [samples]"<<std::endl;
+        return 1;
+    }
+    return renderSceneFile(argv[1], argc > 2 ? argv[2] : "render_scene.png", argc > 3 ? std::atoi(argv[3]) : 0);
+}
@@ -0,0 +1,64 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+static double rmse(const HDRImage &a, const HDRImage &b)
+{
+    double sum = 0.0;
+    for(size_t k = 0; k < a.pixels.size(); ++k)
+    {
+        glm::vec3 d = a.pixels[k] - b.pixels[k];
+        sum += glm::dot(d, d)/3.0;
+    }
+    return std::sqrt(sum/a.pixels.size());
+}
+
+//Renders a converged reference of the Cornell box, then prints the RMSE of
+//each sampler against it for 1, 2, 4, ... samples per pixel.
+//Usage: sampler_benchmark [reference spp] [max spp]
+int main(int argc, char **argv) {
+    int w = 64, h = 48;
+    int referenceSamples = argc > 1 ? std::atoi(argv[1]) : 2048;
+    int maxSamples = argc > 2 ? std::atoi(argv[2]) : 64;
+
+    Scene scene;
+    makeCornellBox(scene);
+    scene.buildBVH();
+    ThreadPool pool;
+
+    RenderSettings settings;
+    settings.numberOfBounces = 5;
+    settings.pixelJitter = true;
+    settings.samplerType = Sampler::Sobol;
+    settings.numberOfSamples = referenceSamples;
+    settings.seed = 12345;
+    HDRImage reference(w, h);
+    auto start = std::chrono::steady_clock::now();
+    render(scene, reference, settings, pool);
+    std::cout<<"Reference: "<<referenceSamples<<" spp in "<<secondsSince(start)<<" s"<<std::endl;
+
+    const char *names[3] = {"independent", "sobol", "blue noise"};
+    std::cout<<"spp";
+    for(int t = 0; t < 3; ++t) std::cout<<"\t"<<names[t];
+    std::cout<<std::endl;
+    settings.seed = 1;
+    for(int spp = 1; spp <= maxSamples; spp *= 2)
+    {
+        std::cout<<spp;
+        for(int t = 0; t < 3; ++t)
+        {
+            settings.samplerType = (Sampler::Type)t;
+            settings.numberOfSamples = spp;
+            HDRImage image(w, h);
+            render(scene, image, settings, pool);
+            std::cout<<"\t"<<rmse(image, reference);
+        }
+        std::cout<<std::endl;
+    }
+    delete scene.camera;
+}
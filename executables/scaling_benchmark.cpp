@@ -0,0 +1,43 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+//Renders the Cornell box with 1, 2, 4, ... threads up to the core count and
+//prints the speedup and parallel efficiency of the tile renderer.
+//Usage: scaling_benchmark [samples per pixel] [max threads]
+int main(int argc, char **argv) {
+    int w = 320, h = 240;
+    int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    RenderSettings settings;
+    settings.numberOfSamples = argc > 1 ? std::atoi(argv[1]) : 16;
+    settings.numberOfBounces = 5;
+    if(argc > 2) maxThreads = std::atoi(argv[2]);
+
+    Scene scene;
+    makeCornellBox(scene);
+    scene.buildBVH();
+
+    std::vector<int> counts;
+    for(int t = 1; t < maxThreads; t *= 2) counts.push_back(t);
+    counts.push_back(maxThreads);
+
+    double base = 0.0;
+    for(int threads: counts)
+    {
+        HDRImage image(w, h);
+        ThreadPool pool(threads);
+        auto start = std::chrono::steady_clock::now();
+        render(scene, image, settings, pool);
+        double seconds = secondsSince(start);
+        if(threads == 1) base = seconds;
+        double speedup = base/seconds;
+        std::cout<<threads<<" threads: "<<seconds<<" s, "
+                 <<(double)w*h*settings.numberOfSamples/seconds/1e6<<" Msamples/s, speedup "
+                 <<speedup<<", efficiency "<<100.0*speedup/threads<<"%"<<std::endl;
+    }
+    delete scene.camera;
+}
@@ -0,0 +1,124 @@
+#include "../src/scene.hpp"
+#include "../src/render.hpp"
+#include "../src/scene_cache.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Writes makeRandomScene with n primitives and a few lights as a scene file,
+//then opens it through a scene cache three times: cold (load, build and
+//write the cache), warm (map the cache) and warm without the checksum.
+//Renders the built and the mapped scene with next event estimation, then
+//checks that a cache with corrupted arrays, one with a corrupted header and a
+//touched scene file are all rebuilt.
+//Usage: scene_cache_benchmark [primitives]
+//Exits with 1 if a mapped render differs or a bad cache is used.
+static int differingPixels(const HDRImage &a, const HDRImage &b)
+{
+    int differing = 0;
+    for(size_t k = 0; k < a.pixels.size(); ++k) differing += std::memcmp(&a.pixels[k], &b.pixels[k], sizeof(color)) != 0;
+    return differing;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::string path = "scene_cache_benchmark.scene", cachePath = path + ".cache";
+    {
+        Scene generated;
+        makeRandomScene(generated, n);
+        float extent = 2.0f*std::cbrt((float)n)*0.15f;
+        glm::vec3 top = glm::vec3(0.0f, 1.2f*extent, -2.0f*extent);
+        generated.objects.push_back(new Object(new Rectangle(top - glm::vec3(0.3f*extent, 0.0f, 0.3f*extent),
+                                                             top + glm::vec3(0.3f*extent, 0.0f, 0.3f*extent)),
+                                               new EmissiveRectangle(glm::vec3(4.0f))));
+        generated.objects.push_back(new Object(new Sphere(top + glm::vec3(extent, 0.0f, 0.0f), 0.1f*extent),
+                                               new Emissive(glm::vec3(8.0f))));
+        generated.lights.push_back(PointLight(glm::vec3(0.0f, extent, 0.0f), glm::vec3(extent*extent)));
+        bool written = writeSceneFile(generated, path);
+        for(auto obj:generated.objects) delete obj;
+        delete generated.camera;
+        if(!written)
+        {
+            std::cout<<"cannot write "<<path<<std::endl;
+            return 1;
+        }
+    }
+    std::remove(cachePath.c_str());
+
+    bool ok = true;
+    int w = 96, h = 72;
+    RenderSettings settings;
+    settings.numberOfSamples = 2;
+    std::cout<<"open\tseconds\tmapped\tdiffering pixels"<<std::endl;
+    Scene built;
+    SceneCache builtCache;
+    auto start = std::chrono::steady_clock::now();
+    bool opened = builtCache.open(path, cachePath, built);
+    double coldSeconds = secondsSince(start);
+    if(!opened || builtCache.mapped || builtCache.error.compare(0, 8, "no cache") != 0)
+    {
+        std::cout<<"cold open: "<<builtCache.error<<std::endl;
+        return 1;
+    }
+    //Without next event estimation every hit samples every rectangle, far too slow here
+    built.pathSettings.nextEventEstimation = true;
+    HDRImage reference(w, h);
+    render(built, reference, settings);
+    std::cout<<"cold\t"<<coldSeconds<<"\t"<<builtCache.mapped<<std::endl;
+
+    for(int verify = 1; verify >= 0; --verify)
+    {
+        Scene scene;
+        SceneCache cache;
+        cache.verify = verify;
+        start = std::chrono::steady_clock::now();
+        opened = cache.open(path, cachePath, scene);
+        double seconds = secondsSince(start);
+        scene.pathSettings.nextEventEstimation = true;
+        HDRImage image(w, h);
+        render(scene, image, settings);
+        int differing = differingPixels(image, reference);
+        std::cout<<(verify ? "warm" : "warm, no checksum")<<"\t"<<seconds<<"\t"<<cache.mapped<<"\t"<<differing<<std::endl;
+        ok = ok && opened && cache.mapped && differing == 0;
+    }
+
+    //Flip one byte in the middle of the arrays, then one among the render
+    //settings in the header, then touch the scene file
+    const char *tests[] = {"corrupt", "corrupt header", "stale"};
+    for(int test = 0; test < 3; ++test)
+    {
+        if(test < 2)
+        {
+            FILE *file = std::fopen(cachePath.c_str(), "r+b");
+            std::fseek(file, 0, SEEK_END);
+            long middle = test == 0 ? std::ftell(file)/2 : 100;
+            std::fseek(file, middle, SEEK_SET);
+            int c = std::fgetc(file);
+            std::fseek(file, middle, SEEK_SET);
+            std::fputc(c ^ 0x10, file);
+            std::fclose(file);
+        }
+        else
+        {
+            FILE *file = std::fopen(path.c_str(), "ab");
+            std::fputs("# touched\n", file);
+            std::fclose(file);
+        }
+        Scene scene;
+        SceneCache cache;
+        opened = cache.open(path, cachePath, scene);
+        scene.pathSettings.nextEventEstimation = true;
+        HDRImage image(w, h);
+        render(scene, image, settings);
+        int differing = differingPixels(image, reference);
+        std::cout<<tests[test]<<"\t-\t"<<cache.mapped<<"\t"<<differing<<" ("<<cache.error<<")"<<std::endl;
+        ok = ok && opened && !cache.mapped && differing == 0;
+    }
+    std::remove(path.c_str());
+    std::remove(cachePath.c_str());
+    if(!ok) std::cout<<"scene cache check failed"<<std::endl;
+    return ok ? 0 : 1;
+}
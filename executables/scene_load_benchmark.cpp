@@ -0,0 +1,70 @@
+#include "../src/scene.hpp"
+#include "../src/scene_file.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Writes makeRandomScene with n primitives as a scene file, loads it back
+//and prints the file size, load time and primitives loaded per second, with
+//the BVH build time for comparison.
+//Usage: scene_load_benchmark [primitives]
+//Exits with 1 if a loaded object differs from the generated one.
+static bool sameObject(const Object *a, const Object *b)
+{
+    if(std::memcmp(a->transform.m, b->transform.m, sizeof(a->transform.m)) != 0 ||
+       a->transform.identity != b->transform.identity || typeid(*a->mat) != typeid(*b->mat) ||
+       std::memcmp(&a->mat->albedo, &b->mat->albedo, sizeof(color)) != 0)
+        return false;
+    if(Sphere *s = dynamic_cast<Sphere*>(a->shape))
+    {
+        Sphere *t = dynamic_cast<Sphere*>(b->shape);
+        return t && std::memcmp(&s->c, &t->c, sizeof(s->c)) == 0 && s->r == t->r;
+    }
+    if(Box *s = dynamic_cast<Box*>(a->shape))
+    {
+        Box *t = dynamic_cast<Box*>(b->shape);
+        return t && std::memcmp(&s->low, &t->low, sizeof(s->low)) == 0 && std::memcmp(&s->hi, &t->hi, sizeof(s->hi)) == 0;
+    }
+    Rectangle *s = dynamic_cast<Rectangle*>(a->shape), *t = dynamic_cast<Rectangle*>(b->shape);
+    return s && t && std::memcmp(&s->low, &t->low, sizeof(s->low)) == 0 && std::memcmp(&s->hi, &t->hi, sizeof(s->hi)) == 0;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::string path = "scene_load_benchmark.scene";
+    Scene generated;
+    makeRandomScene(generated, n);
+    if(!writeSceneFile(generated, path))
+    {
+        std::cout<<"cannot write "<<path<<std::endl;
+        return 1;
+    }
+    FILE *file = std::fopen(path.c_str(), "rb");
+    std::fseek(file, 0, SEEK_END);
+    long bytes = std::ftell(file);
+    std::fclose(file);
+
+    Scene loaded;
+    SceneFile sceneFile;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = sceneFile.load(path, loaded);
+    double loadSeconds = secondsSince(start);
+    if(!ok) std::cout<<sceneFile.error<<std::endl;
+    start = std::chrono::steady_clock::now();
+    loaded.buildBVH();
+    double buildSeconds = secondsSince(start);
+
+    int mismatches = ok ? std::abs((int)loaded.objects.size() - n) : n;
+    for(size_t k = 0; ok && k < loaded.objects.size() && k < generated.objects.size(); ++k)
+        mismatches += !sameObject(generated.objects[k], loaded.objects[k]);
+    std::cout<<"primitives\tMB\tload s\tMB/s\tMprimitives/s\tbvh build s\tmismatches"<<std::endl;
+    std::cout<<n<<"\t"<<bytes*1e-6<<"\t"<<loadSeconds<<"\t"<<bytes*1e-6/loadSeconds<<"\t"<<n*1e-6/loadSeconds
+             <<"\t"<<buildSeconds<<"\t"<<mismatches<<std::endl;
+    std::remove(path.c_str());
+    for(auto obj:generated.objects) delete obj;
+    delete generated.camera;
+    return mismatches == 0 ? 0 : 1;
+}
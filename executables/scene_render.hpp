@@ -0,0 +1,40 @@
+#ifndef SCENE_RENDER_HPP
+#define SCENE_RENDER_HPP
+
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "../src/scene_file.hpp"
+
+#include <SDL2/SDL.h>
+#include <iostream>
+#include <string>
+
+//Rendering of scene files, shared by render_scene and the example executables
+
+//Renders the scene file at path with the image size and settings it gives and
+//saves the image as a PNG at output. samples > 0 replaces the file's sample
+//count, open shows the saved image. Returns the exit status.
+inline int renderSceneFile(const std::string &path, const std::string &output, int samples = 0, bool open = false)
+{
+    Scene scene;
+    SceneFile file;
+    if(!file.load(path, scene))
+    {
+        std::cout<<path<<": "<<file.error<<std::endl;
+        return 1;
+    }
+    if(samples > 0) file.settings.numberOfSamples = samples;
+    scene.buildBVH();
+
+    HDRImage image(file.width, file.height);
+    render(scene, image, file.settings);
+    SDL_Surface *out = SDL_CreateRGBSurface(0, image.w, image.h, 32, 0, 0, 0, 0);
+    tonemap(image, out, 1, 2.2f);
+    IMG_SavePNG(out, output.data());
+    SDL_FreeSurface(out);
+    if(open) openImage(output.data());
+    return 0;
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include "../src/scene.hpp"
+#include "../src/simd.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Checks every supported kernel level against the scalar kernels on random
+//and axis aligned rays, then times one ray against blocks of 8 primitives
+//and camera rays through a random scene with each level.
+//Usage: simd_benchmark [primitives] [rays]
+//Exits with 1 if a kernel disagrees with the scalar code.
+int main(int argc, char **argv) {
+    int n = argc > 1 ? std::atoi(argv[1]) : 4096;
+    int rayCount = argc > 2 ? std::atoi(argv[2]) : 20000;
+    n = (n + 7)/8*8;
+
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f), size(0.02f, 0.3f);
+    std::vector<float> soa[10];
+    for(int k = 0; k < 10; ++k) soa[k].resize(n);
+    for(int i = 0; i < n; ++i)
+    {
+        glm::vec3 c = glm::vec3(unit(gen), unit(gen), unit(gen));
+        glm::vec3 e = glm::vec3(size(gen), size(gen), size(gen));
+        //Snapping some primitives to a grid puts axis aligned rays on their faces
+        if(i % 4 == 0) c = glm::round(c*4.0f)/4.0f;
+        soa[0][i] = c.x; soa[1][i] = c.y; soa[2][i] = c.z; soa[3][i] = e.x;
+        soa[4][i] = c.x - e.x; soa[5][i] = c.y - e.y; soa[6][i] = c.z - e.z;
+        soa[7][i] = c.x + e.x; soa[8][i] = c.y + e.y; soa[9][i] = c.z + e.z;
+    }
+    std::vector<Ray> rays;
+    for(int i = 0; i < rayCount; ++i)
+    {
+        glm::vec3 o = glm::vec3(unit(gen), unit(gen), unit(gen))*1.5f;
+        glm::vec3 d = glm::normalize(glm::vec3(unit(gen), unit(gen), unit(gen)));
+        if(i % 8 == 0) o = glm::round(o*4.0f)/4.0f;
+        if(i % 16 == 0) d[i/16 % 3] = 0.0f;
+        if(i % 32 == 0) d = glm::vec3(0.0f, 0.0f, -1.0f);
+        rays.push_back(Ray(o, d));
+    }
+    Interval t_range = Interval(0.001f, 10.0f);
+
+    PrimitiveKernels::Level levels[3] = {PrimitiveKernels::Scalar, PrimitiveKernels::SSE, PrimitiveKernels::AVX2};
+    std::vector<unsigned> reference;
+    std::vector<float> referenceT;
+    bool ok = true;
+    volatile unsigned sink = 0;     //keeps the timed loops from being optimized away
+    std::cout<<"kernels\tmismatches\tsphere Mtests/s\tbox Mtests/s"<<std::endl;
+    for(int l = 0; l < 3; ++l)
+    {
+        if(!selectPrimitiveKernels(levels[l])) continue;
+        const PrimitiveKernels &kernels = primitiveKernels();
+        //Every kind of query on every block, compared bit for bit with the scalar kernels
+        int mismatches = 0, result = 0;
+        float t[8];
+        for(int r = 0; r < rayCount; ++r)
+        {
+            for(int i = 0; i < n; i += 8)
+            {
+                SphereBlock spheres = {&soa[0][i], &soa[1][i], &soa[2][i], &soa[3][i]};
+                BoxBlock boxes = {&soa[4][i], &soa[5][i], &soa[6][i], &soa[7][i], &soa[8][i], &soa[9][i]};
+                int count = 1 + (r + i/8) % 8;
+                unsigned masks[4];
+                float ts[16];
+                masks[0] = kernels.spheres(rays[r], spheres, count, t_range, t);
+                std::memcpy(ts, t, sizeof(t));
+                masks[1] = kernels.spheresOccluded(rays[r], spheres, count, t_range);
+                masks[2] = kernels.boxes(rays[r], boxes, count, t_range, t);
+                std::memcpy(ts + 8, t, sizeof(t));
+                masks[3] = kernels.boxesOccluded(rays[r], boxes, count, t_range);
+                for(int k = 0; k < 8; ++k)
+                {
+                    if(!(masks[0] & (1u << k))) ts[k] = 0.0f;
+                    if(!(masks[2] & (1u << k))) ts[8 + k] = 0.0f;
+                }
+                if(l == 0)
+                {
+                    reference.insert(reference.end(), masks, masks + 4);
+                    referenceT.insert(referenceT.end(), ts, ts + 16);
+                    continue;
+                }
+                mismatches += std::memcmp(masks, &reference[4*result], sizeof(masks)) != 0 ||
+                              std::memcmp(ts, &referenceT[16*result], sizeof(ts)) != 0;
+                ++result;
+            }
+        }
+        ok = ok && mismatches == 0;
+
+        double rates[2];
+        for(int shape = 0; shape < 2; ++shape)
+        {
+            unsigned hits = 0;
+            auto start = std::chrono::steady_clock::now();
+            for(auto const &ray:rays)
+            {
+                for(int i = 0; i < n; i += 8)
+                {
+                    if(shape == 0)
+                    {
+                        SphereBlock spheres = {&soa[0][i], &soa[1][i], &soa[2][i], &soa[3][i]};
+                        hits += kernels.spheres(ray, spheres, 8, t_range, t);
+                    }
+                    else
+                    {
+                        BoxBlock boxes = {&soa[4][i], &soa[5][i], &soa[6][i], &soa[7][i], &soa[8][i], &soa[9][i]};
+                        hits += kernels.boxes(ray, boxes, 8, t_range, t);
+                    }
+                }
+            }
+            rates[shape] = (double)rayCount*n/secondsSince(start)*1e-6;
+            sink += hits;
+        }
+        std::cout<<kernels.name<<"\t"<<mismatches<<"\t"<<rates[0]<<"\t"<<rates[1]<<std::endl;
+    }
+
+    //Whole scene, with the default leaves and with leaves of up to 8 primitives
+    Scene scene;
+    makeRandomScene(scene, 20000);
+    int res = 256;
+    std::cout<<"kernels\tleaves\tMrays/s"<<std::endl;
+    for(int wide = 0; wide < 2; ++wide)
+    {
+        BVHBuildOptions options;
+        if(wide)
+        {
+            options.maxLeafSize = 8;
+            options.traversalCost = 4.0f;
+        }
+        scene.buildBVH(options);
+        for(int l = 0; l < 3; ++l)
+        {
+            if(!selectPrimitiveKernels(levels[l])) continue;
+            auto start = std::chrono::steady_clock::now();
+            int hits = 0;
+            for (int j = 0; j < res; j++) {
+                for (int i = 0; i < res; i++) {
+                    float x = 2*(i+0.5)/res - 1;
+                    float y = 1 - 2*(j+0.5)/res;
+                    hits += scene.traceRay(scene.camera->make_ray(x, y)).second > 0;
+                }
+            }
+            std::cout<<primitiveKernels().name<<"\t"<<(wide ? "up to 8" : "default")<<"\t"
+                     <<res*res/secondsSince(start)*1e-6<<std::endl;
+        }
+    }
+    delete scene.camera;
+    if(!ok) std::cout<<"kernel mismatch"<<std::endl;
+    return ok ? 0 : 1;
+}
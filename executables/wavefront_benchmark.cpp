@@ -0,0 +1,60 @@
+#include "../src/scene.hpp"
+#include "../src/image.hpp"
+#include "../src/render.hpp"
+#include "bench_scenes.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+//Renders the Cornell box, a random scene and the many lights scene with the
+//iterative integrator pixel by pixel and as a wavefront, with and without
+//next event estimation. Prints paths per second for both and the number of
+//pixels that differ, which should be 0.
+//Usage: wavefront_benchmark [spp] [paths in flight]
+//Exits with 1 if the images differ.
+int main(int argc, char **argv) {
+    int w = 128, h = 96;
+    int samples = argc > 1 ? std::atoi(argv[1]) : 16;
+    int paths = argc > 2 ? std::atoi(argv[2]) : 1024;
+    const char *names[3] = {"cornell", "random", "many lights"};
+    ThreadPool pool(1);
+    bool ok = true;
+    std::cout<<"scene\tnee\tpixel Mpaths/s\twavefront Mpaths/s\tdiffering pixels"<<std::endl;
+    for(int s = 0; s < 3; ++s)
+    {
+        Scene scene;
+        if(s == 0) makeCornellBox(scene);
+        else if(s == 1) makeRandomScene(scene, 2000);
+        else makeManyLightsScene(scene, 64);
+        scene.pathSettings.iterative = true;
+        scene.buildBVH();
+        for(int nee = 0; nee < 2; ++nee)
+        {
+            scene.pathSettings.nextEventEstimation = nee;
+            RenderSettings settings;
+            settings.numberOfSamples = samples;
+            settings.wavefrontPaths = paths;
+            double rates[2];
+            HDRImage images[2] = {HDRImage(w, h), HDRImage(w, h)};
+            for(int wavefront = 0; wavefront < 2; ++wavefront)
+            {
+                settings.wavefront = wavefront;
+                auto start = std::chrono::steady_clock::now();
+                render(scene, images[wavefront], settings, pool);
+                rates[wavefront] = (double)w*h*samples/secondsSince(start)*1e-6;
+            }
+            int differing = 0;
+            for(size_t k = 0; k < images[0].pixels.size(); ++k)
+            {
+                differing += std::memcmp(&images[0].pixels[k], &images[1].pixels[k], sizeof(color)) != 0;
+            }
+            ok = ok && differing == 0;
+            std::cout<<names[s]<<"\t"<<nee<<"\t"<<rates[0]<<"\t"<<rates[1]<<"\t"<<differing<<std::endl;
+        }
+        for(auto obj:scene.objects) delete obj;
+        delete scene.camera;
+    }
+    if(!ok) std::cout<<"image mismatch"<<std::endl;
+    return ok ? 0 : 1;
+}
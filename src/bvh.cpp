@@ -0,0 +1,368 @@
+#include "scene.hpp"
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+//AABB functions
+bool AABB::hit(const Ray &ray, const glm::vec3 &invD, float tmin, float tmax, float &tEntry) const
+{
+    for(int a = 0; a < 3; ++a)
+    {
+        float t0 = (lo[a] - ray.o[a]) * invD[a];
+        float t1 = (hi[a] - ray.o[a]) * invD[a];
+        if(t0 > t1) std::swap(t0, t1);
+        //NaN (ray parallel to and on a slab plane) leaves the interval untouched
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+        if(tmin > tmax) return false;
+    }
+    tEntry = tmin;
+    return true;
+}
+
+//BVH functions
+void BVH::build(const std::vector<AABB> &bounds, const std::vector<float> &primitiveCosts)
+{
+    auto start = std::chrono::steady_clock::now();
+    nodes.clear();
+    indices.clear();
+    unbounded.clear();
+    primitiveCount = (int)bounds.size();
+    costs = primitiveCosts;
+    if(costs.size() != bounds.size()) costs.assign(bounds.size(), 1.0f);
+
+    std::vector<glm::vec3> centroids(bounds.size());
+    for(int i = 0; i < (int)bounds.size(); ++i)
+    {
+        if(bounds[i].isFinite())
+        {
+            indices.push_back(i);
+            centroids[i] = bounds[i].centroid();
+        }
+        else unbounded.push_back(i);
+    }
+    if(!indices.empty())
+    {
+        int parallelDepth = options.parallelDepth;
+        if(parallelDepth < 0)
+        {
+            //Enough levels to hand every core a few subtrees
+            int threads = std::max(1, (int)std::thread::hardware_concurrency());
+            parallelDepth = 0;
+            while((1 << parallelDepth) < 2*threads) parallelDepth++;
+            if(threads == 1) parallelDepth = 0;
+        }
+        std::vector<Node> built;
+        built.reserve(2*indices.size()/std::max(1, options.maxLeafSize) + 1);
+        buildNode(built, bounds, centroids, 0, (int)indices.size(), 0, parallelDepth);
+        nodes = std::move(built);
+    }
+    buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+float BVH::primitiveCost(int first, int count) const
+{
+    float cost = 0.0f;
+    for(int i = first; i < first + count; ++i) cost += costs[indices[i]];
+    return cost;
+}
+
+void BVH::replaceSubtree(int node, int first, const BVH &sub, const int *prims)
+{
+    //Node k of sub goes to base + k - 1, its root to node
+    int base = (int)nodes.size();
+    auto place = [&](int k) { return k == 0 ? node : base + k - 1; };
+    for(int k = 0; k < (int)sub.nodes.size(); ++k)
+    {
+        Node n = sub.nodes[k];
+        if(n.isLeaf()) n.first += first;
+        else { n.left = place(n.left); n.right = place(n.right); }
+        if(k == 0) nodes[node] = n;
+        else nodes.push_back(n);
+    }
+    for(int k = 0; k < (int)sub.indices.size(); ++k) indices[first + k] = prims[sub.indices[k]];
+}
+
+//Appends the subtree over indices[first, first+count) to out and returns its root.
+//Above parallelDepth the left subtree is built on another thread into its own
+//node array and spliced in afterwards, the index ranges never overlap.
+int BVH::buildNode(std::vector<Node> &out, const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+                   int first, int count, int depth, int parallelDepth)
+{
+    int id = (int)out.size();
+    out.push_back(Node());
+
+    AABB box, centroidBox;
+    for(int i = first; i < first + count; ++i)
+    {
+        box.expand(bounds[indices[i]]);
+        centroidBox.expand(centroids[indices[i]]);
+    }
+    out[id].bounds = box;
+
+    int mid = -1;
+    if(count > 1 && depth < maxDepth)
+    {
+        if(options.splitMethod == BVHBuildOptions::SAH) mid = splitSAH(bounds, centroids, box, centroidBox, first, count);
+        else if(count > options.maxLeafSize) mid = splitMedian(centroids, centroidBox, first, count);
+    }
+    if(mid < 0)
+    {
+        out[id].first = first;
+        out[id].count = count;
+        return id;
+    }
+
+    int left, right;
+    if(depth < parallelDepth && count >= options.parallelMinPrimitives)
+    {
+        std::vector<Node> leftNodes;
+        std::future<int> leftTask = std::async(std::launch::async, [&]() {
+            return buildNode(leftNodes, bounds, centroids, first, mid - first, depth + 1, parallelDepth);
+        });
+        std::vector<Node> rightNodes;
+        buildNode(rightNodes, bounds, centroids, mid, first + count - mid, depth + 1, parallelDepth);
+        leftTask.get();
+
+        left = (int)out.size();
+        right = left + (int)leftNodes.size();
+        for(Node &n: leftNodes)
+        {
+            if(!n.isLeaf()) { n.left += left; n.right += left; }
+            out.push_back(n);
+        }
+        for(Node &n: rightNodes)
+        {
+            if(!n.isLeaf()) { n.left += right; n.right += right; }
+            out.push_back(n);
+        }
+    }
+    else
+    {
+        left = buildNode(out, bounds, centroids, first, mid - first, depth + 1, parallelDepth);
+        right = buildNode(out, bounds, centroids, mid, first + count - mid, depth + 1, parallelDepth);
+    }
+    out[id].left = left;
+    out[id].right = right;
+    return id;
+}
+
+//Median split along the axis with the largest centroid extent
+int BVH::splitMedian(const std::vector<glm::vec3> &centroids, const AABB &centroidBox, int first, int count)
+{
+    glm::vec3 extent = centroidBox.hi - centroidBox.lo;
+    int axis = 0;
+    if(extent.y > extent.x) axis = 1;
+    if(extent.z > extent[axis]) axis = 2;
+    int mid = first + count/2;
+    std::nth_element(indices.begin() + first, indices.begin() + mid, indices.begin() + first + count,
+        [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+    return mid;
+}
+
+//Binned surface area heuristic. Returns the partition point, or -1 when a
+//leaf is cheaper and small enough.
+int BVH::splitSAH(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids, const AABB &box,
+                  const AABB &centroidBox, int first, int count)
+{
+    struct Bin {
+        AABB bounds;
+        float cost = 0.0f;
+    };
+    int binCount = std::max(2, options.binCount);
+    std::vector<Bin> bins(binCount);
+    std::vector<float> rightArea(binCount), rightCost(binCount);
+
+    float leafCost = primitiveCost(first, count);
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1, bestBin = -1;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        float lo = centroidBox.lo[axis], extent = centroidBox.hi[axis] - lo;
+        if(extent <= 0.0f) continue;
+        for(Bin &b: bins) b = Bin();
+        float scale = binCount / extent;
+        for(int i = first; i < first + count; ++i)
+        {
+            int prim = indices[i];
+            int b = std::min(binCount - 1, (int)((centroids[prim][axis] - lo) * scale));
+            bins[b].bounds.expand(bounds[prim]);
+            bins[b].cost += costs[prim];
+        }
+        //Sweep from the right, then from the left evaluating every plane
+        AABB acc;
+        float accCost = 0.0f;
+        for(int b = binCount - 1; b > 0; --b)
+        {
+            acc.expand(bins[b].bounds);
+            accCost += bins[b].cost;
+            rightArea[b] = acc.surfaceArea();
+            rightCost[b] = accCost;
+        }
+        acc = AABB();
+        accCost = 0.0f;
+        for(int b = 0; b < binCount - 1; ++b)
+        {
+            acc.expand(bins[b].bounds);
+            accCost += bins[b].cost;
+            float cost = acc.surfaceArea()*accCost + rightArea[b + 1]*rightCost[b + 1];
+            if(accCost > 0.0f && rightCost[b + 1] > 0.0f && cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    float area = box.surfaceArea();
+    if(bestAxis >= 0 && area > 0.0f) bestCost = options.traversalCost + bestCost/area;
+    if(bestAxis < 0 || bestCost >= leafCost)
+    {
+        if(count <= options.maxLeafSize) return -1;
+        //Too many primitives for a leaf, fall back to the median
+        if(bestAxis < 0) return first + count/2;
+    }
+
+    float lo = centroidBox.lo[bestAxis], scale = binCount / (centroidBox.hi[bestAxis] - lo);
+    int *mid = std::partition(indices.data() + first, indices.data() + first + count, [&](int prim) {
+        return std::min(binCount - 1, (int)((centroids[prim][bestAxis] - lo) * scale)) <= bestBin;
+    });
+    return (int)(mid - indices.data());
+}
+
+BVHStats BVH::stats() const
+{
+    BVHStats s;
+    s.buildMilliseconds = buildMilliseconds;
+    if(nodes.empty()) return s;
+    float rootArea = nodes[0].bounds.surfaceArea();
+    std::vector<std::pair<int,int> > stack(1, std::make_pair(0, 0));
+    while(!stack.empty())
+    {
+        int id = stack.back().first, depth = stack.back().second;
+        stack.pop_back();
+        const Node &node = nodes[id];
+        float weight = rootArea > 0.0f ? node.bounds.surfaceArea()/rootArea : 1.0f;
+        s.nodeCount++;
+        s.maxDepth = std::max(s.maxDepth, depth);
+        if(node.isLeaf())
+        {
+            s.leafCount++;
+            if((int)s.leafSizeHistogram.size() <= node.count) s.leafSizeHistogram.resize(node.count + 1, 0);
+            s.leafSizeHistogram[node.count]++;
+            s.sahCost += weight*primitiveCost(node.first, node.count);
+        }
+        else
+        {
+            s.sahCost += weight*options.traversalCost;
+            stack.push_back(std::make_pair(node.left, depth + 1));
+            stack.push_back(std::make_pair(node.right, depth + 1));
+        }
+    }
+    return s;
+}
+
+void BVHStats::print() const
+{
+    std::cout<<"BVH: "<<nodeCount<<" nodes, "<<leafCount<<" leaves, depth "<<maxDepth
+             <<", SAH cost "<<sahCost<<", built in "<<buildMilliseconds<<" ms"<<std::endl;
+    std::cout<<"Leaf sizes:";
+    for(int k = 1; k < (int)leafSizeHistogram.size(); ++k)
+    {
+        if(leafSizeHistogram[k]) std::cout<<" "<<k<<":"<<leafSizeHistogram[k];
+    }
+    std::cout<<std::endl;
+}
+
+//MBVH functions
+void MBVH::build(const BVH &bvh)
+{
+    nodes.clear();
+    source.clear();
+    if(bvh.nodes.empty()) return;
+    if(bvh.nodes[0].isLeaf())
+    {
+        //A single leaf still gets a node so traversal always starts at one
+        Node root;
+        const AABB &b = bvh.nodes[0].bounds;
+        root.lox[0] = b.lo.x; root.loy[0] = b.lo.y; root.loz[0] = b.lo.z;
+        root.hix[0] = b.hi.x; root.hiy[0] = b.hi.y; root.hiz[0] = b.hi.z;
+        root.child[0] = leafChild(0);
+        root.count = 1;
+        nodes.push_back(root);
+        source.push_back(0);
+        return;
+    }
+    nodes.reserve(bvh.nodes.size()/2);
+    source.reserve(bvh.nodes.size()/2);
+    collapse(bvh, 0);
+}
+
+//Pulls grandchildren up until the node has four children, always opening the
+//inner child with the largest surface area
+int MBVH::collapse(const BVH &bvh, int bvhNode)
+{
+    int children[4] = {bvh.nodes[bvhNode].left, bvh.nodes[bvhNode].right, -1, -1};
+    int count = 2;
+    while(count < 4)
+    {
+        int open = -1;
+        for(int i = 0; i < count; ++i)
+        {
+            const BVH::Node &child = bvh.nodes[children[i]];
+            if(!child.isLeaf() && (open < 0 || child.bounds.surfaceArea() > bvh.nodes[children[open]].bounds.surfaceArea()))
+                open = i;
+        }
+        if(open < 0) break;
+        int opened = children[open];
+        children[open] = bvh.nodes[opened].left;
+        children[count++] = bvh.nodes[opened].right;
+    }
+
+    int index = nodes.size();
+    nodes.push_back(Node());
+    source.push_back(bvhNode);
+    for(int i = 0; i < 4; ++i)
+    {
+        //Unused slots get empty bounds, count keeps them out of the traversal
+        AABB b = i < count ? bvh.nodes[children[i]].bounds : AABB(glm::vec3(0.0f), glm::vec3(0.0f));
+        int child = i >= count ? leafChild(0) : bvh.nodes[children[i]].isLeaf() ? leafChild(children[i]) : collapse(bvh, children[i]);
+        Node &node = nodes[index];
+        node.lox[i] = b.lo.x; node.loy[i] = b.lo.y; node.loz[i] = b.lo.z;
+        node.hix[i] = b.hi.x; node.hiy[i] = b.hi.y; node.hiz[i] = b.hi.z;
+        node.child[i] = child;
+    }
+    nodes[index].count = count;
+    return index;
+}
+
+//Scene functions
+void Scene::buildBVH(BVHBuildOptions options)
+{
+    std::vector<AABB> bounds(objects.size());
+    std::vector<float> costs(objects.size());
+    for(int i = 0; i < (int)objects.size(); ++i)
+    {
+        bounds[i] = objects[i]->worldBounds();
+        costs[i] = objects[i]->shape->intersectionCost();
+    }
+    bvh.options = options;
+    bvh.build(bounds, costs);
+    compiled.build(*this);
+    buildEmitters();
+    refit = BVHRefit();
+}
+
+bool Scene::hasBVH() const
+{
+    return !bvh.empty() && bvh.primitiveCount == (int)objects.size();
+}
+
+bool Scene::hasCompiledScene() const
+{
+    //A compiled scene loaded from a cache stands in for the objects
+    if(objects.empty()) return !compiled.empty() && !compiled.bvh.empty();
+    return hasBVH() && compiled.objectCount == (int)objects.size();
+}
@@ -35,6 +35,12 @@ Ray Camera::make_ray(float x, float y) const {
     // return Ray(glm::vec3(0,0,0), glm::vec3(x, y, -1));
 }
 
+Ray Camera::make_ray(int i, int j, int w, int h, glm::vec2 jitter) const {
+    float x = 2*(i+jitter.x)/w - 1;
+    float y = 1 - 2*(j+jitter.y)/h;
+    return make_ray(x, y);
+}
+
 glm::vec3 Camera::getLocation()
 {
     return center;
@@ -0,0 +1,728 @@
+#include "scene.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <unordered_map>
+
+//The intersection routines below repeat the arithmetic of the Shape::hit and
+//Shape::occluded overrides in objects.cpp operation for operation, so that
+//the compiled scene returns bit-identical hits.
+
+static inline bool sphereHit(const Ray &ray, const glm::vec3 &c, float r, Interval t_range, float &t)
+{
+    float qa = glm::dot(ray.d, ray.d);
+    float qb = glm::dot(2.0f * ray.d, ray.o - c);
+    float qc = glm::dot(ray.o - c, ray.o - c) - r * r;
+    float discriminant = qb * qb - 4 * qa * qc;
+    if (discriminant < 0)
+        return false;
+    float t1 = (-qb - sqrt(discriminant)) / (2 * qa);
+    float t2 = (-qb + sqrt(discriminant)) / (2 * qa);
+    if(t1>t2) std::swap(t1, t2);
+    if(t_range.contains(t1) && t1>0) { t = t1; return true; }
+    if(t_range.contains(t2) && t2>0) { t = t2; return true; }
+    return false;
+}
+
+static inline bool sphereOccluded(const Ray &ray, const glm::vec3 &c, float r, Interval t_range)
+{
+    glm::vec3 oc = ray.o - c;
+    float qa = glm::dot(ray.d, ray.d);
+    float qb = 2.0f * glm::dot(ray.d, oc);
+    float qc = glm::dot(oc, oc) - r * r;
+    float discriminant = qb * qb - 4 * qa * qc;
+    if (discriminant < 0)
+        return false;
+    float root = sqrt(discriminant);
+    float t1 = (-qb - root) / (2 * qa);
+    float t2 = (-qb + root) / (2 * qa);
+    return (t_range.contains(t1) && t1 > 0) || (t_range.contains(t2) && t2 > 0);
+}
+
+static inline bool boxHit(const Ray &ray, const glm::vec3 &low, const glm::vec3 &hi, Interval t_range, float &t, glm::vec3 &n)
+{
+    float tminx = ((low.x - ray.o.x) / ray.d.x);
+    float tmaxx = ((hi.x - ray.o.x) / ray.d.x);
+    float tminy = ((low.y - ray.o.y) / ray.d.y);
+    float tmaxy = ((hi.y - ray.o.y) / ray.d.y);
+    float tminz = ((low.z - ray.o.z) / ray.d.z);
+    float tmaxz = ((hi.z - ray.o.z) / ray.d.z);
+    float tmin = std::max(std::min(tminx, tmaxx), std::max(std::min(tminy, tmaxy), std::min(tminz, tmaxz)));
+    float tmax = std::min(std::max(tminx, tmaxx), std::min(std::max(tminy, tmaxy), std::max(tminz, tmaxz)));
+    if(tmax < 0 || tmin > tmax || tmin < 0 || !t_range.contains(tmin)) return false;
+    t = tmin;
+    n = glm::vec3(0.0);
+    if(tmin == std::min(tminx, tmaxx)) {
+        if(tminx==tmin) n.x = -1;
+        else n.x = 1;
+    } else if(tmin == std::min(tminy, tmaxy)) {
+        if (tminy==tmin) n.y = -1;
+        else n.y = 1;
+    } else {
+        if(tminz==tmin) n.z = -1;
+        else n.z = 1;
+    }
+    if(glm::dot(n, ray.d) > 0) n = -n;
+    return true;
+}
+
+static inline bool boxOccluded(const Ray &ray, const glm::vec3 &low, const glm::vec3 &hi, Interval t_range)
+{
+    glm::vec3 t0 = (low - ray.o) / ray.d;
+    glm::vec3 t1 = (hi - ray.o) / ray.d;
+    glm::vec3 tnear = glm::min(t0, t1), tfar = glm::max(t0, t1);
+    float tmin = std::max(tnear.x, std::max(tnear.y, tnear.z));
+    float tmax = std::min(tfar.x, std::min(tfar.y, tfar.z));
+    return tmax >= 0 && tmin <= tmax && tmin >= 0 && t_range.contains(tmin);
+}
+
+static inline bool planeHit(const Ray &ray, const glm::vec3 &point, const glm::vec3 &normal, Interval t_range, float &t)
+{
+    float dnr = glm::dot(normal, ray.d);
+    if(dnr == 0)
+        return false;
+    t = glm::dot(normal, point - ray.o) / dnr;
+    return t >= 0 && t_range.contains(t);
+}
+
+static inline bool rectangleHit(const Ray &ray, float minx, float maxx, float minz, float maxz, float y, Interval t_range, float &t)
+{
+    if(ray.d.y == 0) return false;
+    t = (y - ray.o.y) / ray.d.y;
+    glm::vec3 p = ray.at(t);
+    if(p.x < minx || p.x > maxx || p.z < minz || p.z > maxz) return false;
+    return t_range.contains(t);
+}
+
+//Closest hit so far. The point and normal stay in object space until the
+//traversal is over, tied distances go to the later object like in the scan.
+struct CompiledScene::Closest {
+    float t = std::numeric_limits<float>::max();
+    int object = -1;
+    int transform = -1;
+    bool world = false;     //p and n came from Object::hit and are already in world space
+    glm::vec3 p, n;
+    bool accept(float tHit, int obj) const {
+        return object < 0 || tHit < t || (tHit == t && obj > object);
+    }
+};
+
+//End of the run of primitives of the given type that goes to the kernels. A
+//single primitive is cheaper to test inline.
+static inline int kernelEnd(const CompiledScene::Range &range, int type)
+{
+    return range.first[type] + (range.plain[type] > 1 ? range.plain[type] : 0);
+}
+
+//Compiled scene functions
+void CompiledScene::build(const Scene &scene)
+{
+    *this = CompiledScene();
+    bvh = scene.bvh;
+    if(bvh.options.width == 4) mbvh.build(bvh);
+    objectCount = scene.objects.size();
+
+    transformOf.assign(objectCount, -1);
+    std::unordered_map<const Material*, int> materialIds;
+    materialIndex.assign(objectCount, -1);
+    for(int i = 0; i < objectCount; ++i)
+    {
+        const Object *obj = scene.objects[i];
+        auto inserted = materialIds.insert(std::make_pair(obj->mat, (int)materials.size()));
+        if(inserted.second) materials.push_back(obj->mat);
+        materialIndex[i] = inserted.first->second;
+        if(!obj->transform.identity)
+        {
+            ObjectTransform xf;
+            xf.toWorld = obj->transform;
+            xf.toObject = obj->inverse;
+            xf.normalToWorld = obj->normalTransform;
+            transformOf[i] = transforms.size();
+            transforms.push_back(xf);
+        }
+        if(obj->shape->isRectangle)
+        {
+            const Rectangle *rect = static_cast<const Rectangle*>(obj->shape);
+            RectangleSource source;
+            source.low = rect->low;
+            source.hi = rect->hi;
+            source.object = i;
+            rectangleSources.push_back(source);
+        }
+    }
+
+    unbounded = append(scene, bvh.unbounded.data(), bvh.unbounded.size());
+    leaves.assign(bvh.nodes.size(), Range());
+    for(int node = 0; node < (int)bvh.nodes.size(); ++node)
+    {
+        const BVH::Node &n = bvh.nodes[node];
+        if(n.isLeaf()) leaves[node] = append(scene, bvh.indices.data() + n.first, n.count);
+    }
+    pad(true);
+}
+
+CompiledScene::Range CompiledScene::recompile(const Scene &scene, const int *prims, int count)
+{
+    pad(false);
+    Range range = append(scene, prims, count);
+    pad(true);
+    return range;
+}
+
+void CompiledScene::pad(bool padded)
+{
+    for(auto block: {&spheres.cx, &spheres.cy, &spheres.cz, &spheres.r})
+        block->resize(spheres.object.size() + (padded ? 8 : 0), 0.0f);
+    for(auto block: {&boxes.lox, &boxes.loy, &boxes.loz, &boxes.hix, &boxes.hiy, &boxes.hiz})
+        block->resize(boxes.object.size() + (padded ? 8 : 0), 0.0f);
+}
+
+//Appends the primitives to their blocks and returns where they went. The
+//untransformed ones go first so the SIMD kernels can take them in a row.
+CompiledScene::Range CompiledScene::append(const Scene &scene, const int *prims, int count)
+{
+    Range range;
+    for(int type = 0; type < TypeCount; ++type)
+    {
+        range.first[type] = type == SphereType ? spheres.object.size() : type == BoxType ? boxes.object.size() :
+                             type == PlaneType ? planes.px.size() : type == RectangleType ? rectangles.y.size() : others.size();
+    }
+    for(int k = 0; k < 2*count; ++k)
+    {
+        if(k == count) std::copy(range.count, range.count + TypeCount, range.plain);
+        int i = prims[k % count];
+        if((transformOf[i] >= 0) != (k >= count)) continue;
+        const Object *obj = scene.objects[i];
+        int xf = transformOf[i];
+        if(const Sphere *sphere = dynamic_cast<const Sphere*>(obj->shape))
+        {
+            spheres.cx.push_back(sphere->c.x);
+            spheres.cy.push_back(sphere->c.y);
+            spheres.cz.push_back(sphere->c.z);
+            spheres.r.push_back(sphere->r);
+            spheres.object.push_back(i);
+            spheres.transform.push_back(xf);
+            range.count[SphereType]++;
+        }
+        else if(const Box *box = dynamic_cast<const Box*>(obj->shape))
+        {
+            boxes.lox.push_back(box->low.x);
+            boxes.loy.push_back(box->low.y);
+            boxes.loz.push_back(box->low.z);
+            boxes.hix.push_back(box->hi.x);
+            boxes.hiy.push_back(box->hi.y);
+            boxes.hiz.push_back(box->hi.z);
+            boxes.object.push_back(i);
+            boxes.transform.push_back(xf);
+            range.count[BoxType]++;
+        }
+        else if(const Plane *plane = dynamic_cast<const Plane*>(obj->shape))
+        {
+            const glm::vec3 &n = plane->normal;
+            planes.px.push_back(plane->point.x);
+            planes.py.push_back(plane->point.y);
+            planes.pz.push_back(plane->point.z);
+            planes.nx.push_back(n.x);
+            planes.ny.push_back(n.y);
+            planes.nz.push_back(n.z);
+            planes.object.push_back(i);
+            planes.transform.push_back(xf);
+            range.count[PlaneType]++;
+        }
+        else if(const Rectangle *rect = dynamic_cast<const Rectangle*>(obj->shape))
+        {
+            rectangles.minx.push_back(std::min(rect->low.x, rect->hi.x));
+            rectangles.maxx.push_back(std::max(rect->low.x, rect->hi.x));
+            rectangles.minz.push_back(std::min(rect->low.z, rect->hi.z));
+            rectangles.maxz.push_back(std::max(rect->low.z, rect->hi.z));
+            rectangles.y.push_back(rect->low.y);
+            rectangles.object.push_back(i);
+            rectangles.transform.push_back(xf);
+            range.count[RectangleType]++;
+        }
+        else
+        {
+            others.push_back(obj);
+            otherIndex.push_back(i);
+            range.count[OtherType]++;
+        }
+    }
+    return range;
+}
+
+void CompiledScene::intersectRange(const Range &range, const Ray &ray, float tmin, float &tmax, Closest &best) const
+{
+    //Rays are only moved into object space for transformed primitives
+    Ray local = ray;
+    auto toObject = [&](int xf) -> const Ray& {
+        if(xf < 0) return ray;
+        local.o = transforms[xf].toObject.point(ray.o);
+        local.d = transforms[xf].toObject.vector(ray.d);
+        return local;
+    };
+    const PrimitiveKernels &kernels = primitiveKernels();
+    float t, ts[8];
+    //Runs of untransformed spheres and boxes go through the kernels 8 at a
+    //time, a hit lane is only kept if it still beats the closest hit when its
+    //turn comes
+    int plainEnd = kernelEnd(range, SphereType);
+    for(int first = range.first[SphereType]; first < plainEnd; first += 8)
+    {
+        SphereBlock block = {&spheres.cx[first], &spheres.cy[first], &spheres.cz[first], &spheres.r[first]};
+        unsigned mask = kernels.spheres(ray, block, std::min(8, plainEnd - first), Interval(tmin, tmax), ts);
+        for(int k = 0; mask; ++k, mask >>= 1)
+        {
+            int i = first + k;
+            if(!(mask & 1) || !best.accept(ts[k], spheres.object[i])) continue;
+            best.t = tmax = ts[k];
+            best.object = spheres.object[i];
+            best.transform = -1;
+            best.world = false;
+            best.p = ray.at(ts[k]);
+            best.n = glm::normalize(best.p - glm::vec3(spheres.cx[i], spheres.cy[i], spheres.cz[i]));
+        }
+    }
+    for(int i = plainEnd; i < range.first[SphereType] + range.count[SphereType]; ++i)
+    {
+        const Ray &r = toObject(spheres.transform[i]);
+        glm::vec3 c = glm::vec3(spheres.cx[i], spheres.cy[i], spheres.cz[i]);
+        if(sphereHit(r, c, spheres.r[i], Interval(tmin, tmax), t) && best.accept(t, spheres.object[i]))
+        {
+            best.t = tmax = t;
+            best.object = spheres.object[i];
+            best.transform = spheres.transform[i];
+            best.world = false;
+            best.p = r.at(t);
+            best.n = glm::normalize(best.p - c);
+        }
+    }
+    glm::vec3 n;
+    plainEnd = kernelEnd(range, BoxType);
+    for(int first = range.first[BoxType]; first < plainEnd; first += 8)
+    {
+        BoxBlock block = {&boxes.lox[first], &boxes.loy[first], &boxes.loz[first],
+                          &boxes.hix[first], &boxes.hiy[first], &boxes.hiz[first]};
+        unsigned mask = kernels.boxes(ray, block, std::min(8, plainEnd - first), Interval(tmin, tmax), ts);
+        for(int k = 0; mask; ++k, mask >>= 1)
+        {
+            int i = first + k;
+            if(!(mask & 1) || !best.accept(ts[k], boxes.object[i])) continue;
+            //The scalar test repeats the same arithmetic and also finds the face
+            glm::vec3 lo = glm::vec3(boxes.lox[i], boxes.loy[i], boxes.loz[i]);
+            glm::vec3 hi = glm::vec3(boxes.hix[i], boxes.hiy[i], boxes.hiz[i]);
+            boxHit(ray, lo, hi, Interval(tmin, ts[k]), t, n);
+            best.t = tmax = ts[k];
+            best.object = boxes.object[i];
+            best.transform = -1;
+            best.world = false;
+            best.p = ray.at(ts[k]);
+            best.n = n;
+        }
+    }
+    for(int i = plainEnd; i < range.first[BoxType] + range.count[BoxType]; ++i)
+    {
+        const Ray &r = toObject(boxes.transform[i]);
+        glm::vec3 lo = glm::vec3(boxes.lox[i], boxes.loy[i], boxes.loz[i]);
+        glm::vec3 hi = glm::vec3(boxes.hix[i], boxes.hiy[i], boxes.hiz[i]);
+        if(boxHit(r, lo, hi, Interval(tmin, tmax), t, n) && best.accept(t, boxes.object[i]))
+        {
+            best.t = tmax = t;
+            best.object = boxes.object[i];
+            best.transform = boxes.transform[i];
+            best.world = false;
+            best.p = r.at(t);
+            best.n = n;
+        }
+    }
+    for(int i = range.first[PlaneType]; i < range.first[PlaneType] + range.count[PlaneType]; ++i)
+    {
+        const Ray &r = toObject(planes.transform[i]);
+        glm::vec3 point = glm::vec3(planes.px[i], planes.py[i], planes.pz[i]);
+        glm::vec3 normal = glm::vec3(planes.nx[i], planes.ny[i], planes.nz[i]);
+        if(planeHit(r, point, normal, Interval(tmin, tmax), t) && best.accept(t, planes.object[i]))
+        {
+            best.t = tmax = t;
+            best.object = planes.object[i];
+            best.transform = planes.transform[i];
+            best.world = false;
+            best.p = r.at(t);
+            best.n = glm::normalize(normal);
+        }
+    }
+    for(int i = range.first[RectangleType]; i < range.first[RectangleType] + range.count[RectangleType]; ++i)
+    {
+        const Ray &r = toObject(rectangles.transform[i]);
+        if(rectangleHit(r, rectangles.minx[i], rectangles.maxx[i], rectangles.minz[i], rectangles.maxz[i], rectangles.y[i],
+                        Interval(tmin, tmax), t) && best.accept(t, rectangles.object[i]))
+        {
+            best.t = tmax = t;
+            best.object = rectangles.object[i];
+            best.transform = rectangles.transform[i];
+            best.world = false;
+            best.p = r.at(t);
+            best.n = glm::vec3(0.0f, -1.0f, 0.0f);
+            if(r.d.y < 0) best.n = -best.n;
+        }
+    }
+    HitRecord rec = HitRecord();
+    for(int i = range.first[OtherType]; i < range.first[OtherType] + range.count[OtherType]; ++i)
+    {
+        if(others[i]->hit(ray, Interval(tmin, tmax), rec) && best.accept(rec.t, otherIndex[i]))
+        {
+            best.t = tmax = rec.t;
+            best.object = otherIndex[i];
+            best.world = true;
+            best.p = rec.p;
+            best.n = rec.n;
+        }
+    }
+}
+
+bool CompiledScene::intersect(const Ray &ray, Interval t_range, HitRecord &rec, long *steps) const
+{
+    Closest best;
+    float tmax = t_range.max;
+    intersectRange(unbounded, ray, t_range.min, tmax, best);
+    auto visitLeaf = [&](int node, float &tmax) {
+        intersectRange(leaves[node], ray, t_range.min, tmax, best);
+        return false;
+    };
+    if(!mbvh.empty()) mbvh.traverseLeaves(ray, Interval(t_range.min, tmax), visitLeaf, steps);
+    else bvh.traverseLeaves(ray, Interval(t_range.min, tmax), visitLeaf, steps);
+    if(best.object < 0) return false;
+    finish(best, rec);
+    return true;
+}
+
+//Fills rec from the closest hit, moving it to world space if needed
+void CompiledScene::finish(const Closest &best, HitRecord &rec) const
+{
+    rec.t = best.t;
+    rec.p = best.p;
+    rec.n = best.n;
+    if(!best.world && best.transform >= 0)
+    {
+        const ObjectTransform &xf = transforms[best.transform];
+        rec.p = xf.toWorld.point(rec.p);
+        rec.n = glm::normalize(xf.normalToWorld.vector(rec.n));
+    }
+    rec.mat = materials[materialIndex[best.object]];
+    rec.object = best.object;
+}
+
+bool CompiledScene::occludedRange(const Range &range, const Ray &ray, Interval t_range, bool skipRectangles) const
+{
+    Ray local = ray;
+    auto toObject = [&](int xf) -> const Ray& {
+        if(xf < 0) return ray;
+        local.o = transforms[xf].toObject.point(ray.o);
+        local.d = transforms[xf].toObject.vector(ray.d);
+        return local;
+    };
+    const PrimitiveKernels &kernels = primitiveKernels();
+    float t;
+    int plainEnd = kernelEnd(range, SphereType);
+    for(int first = range.first[SphereType]; first < plainEnd; first += 8)
+    {
+        SphereBlock block = {&spheres.cx[first], &spheres.cy[first], &spheres.cz[first], &spheres.r[first]};
+        if(kernels.spheresOccluded(ray, block, std::min(8, plainEnd - first), t_range)) return true;
+    }
+    for(int i = plainEnd; i < range.first[SphereType] + range.count[SphereType]; ++i)
+    {
+        glm::vec3 c = glm::vec3(spheres.cx[i], spheres.cy[i], spheres.cz[i]);
+        if(sphereOccluded(toObject(spheres.transform[i]), c, spheres.r[i], t_range)) return true;
+    }
+    plainEnd = kernelEnd(range, BoxType);
+    for(int first = range.first[BoxType]; first < plainEnd; first += 8)
+    {
+        BoxBlock block = {&boxes.lox[first], &boxes.loy[first], &boxes.loz[first],
+                          &boxes.hix[first], &boxes.hiy[first], &boxes.hiz[first]};
+        if(kernels.boxesOccluded(ray, block, std::min(8, plainEnd - first), t_range)) return true;
+    }
+    for(int i = plainEnd; i < range.first[BoxType] + range.count[BoxType]; ++i)
+    {
+        glm::vec3 lo = glm::vec3(boxes.lox[i], boxes.loy[i], boxes.loz[i]);
+        glm::vec3 hi = glm::vec3(boxes.hix[i], boxes.hiy[i], boxes.hiz[i]);
+        if(boxOccluded(toObject(boxes.transform[i]), lo, hi, t_range)) return true;
+    }
+    for(int i = range.first[PlaneType]; i < range.first[PlaneType] + range.count[PlaneType]; ++i)
+    {
+        glm::vec3 point = glm::vec3(planes.px[i], planes.py[i], planes.pz[i]);
+        glm::vec3 normal = glm::vec3(planes.nx[i], planes.ny[i], planes.nz[i]);
+        if(planeHit(toObject(planes.transform[i]), point, normal, t_range, t)) return true;
+    }
+    if(!skipRectangles)
+    {
+        for(int i = range.first[RectangleType]; i < range.first[RectangleType] + range.count[RectangleType]; ++i)
+        {
+            if(rectangleHit(toObject(rectangles.transform[i]), rectangles.minx[i], rectangles.maxx[i],
+                            rectangles.minz[i], rectangles.maxz[i], rectangles.y[i], t_range, t)) return true;
+        }
+    }
+    for(int i = range.first[OtherType]; i < range.first[OtherType] + range.count[OtherType]; ++i)
+    {
+        if(skipRectangles && others[i]->shape->isRectangle) continue;
+        if(others[i]->occluded(ray, t_range)) return true;
+    }
+    return false;
+}
+
+bool CompiledScene::occluded(const Ray &ray, Interval t_range, bool skipRectangles, long *steps) const
+{
+    if(occludedRange(unbounded, ray, t_range, skipRectangles)) return true;
+    bool blocked = false;
+    auto visitLeaf = [&](int node, float &tmax) {
+        blocked = occludedRange(leaves[node], ray, t_range, skipRectangles);
+        return blocked;
+    };
+    if(!mbvh.empty()) mbvh.traverseLeaves(ray, t_range, visitLeaf, steps);
+    else bvh.traverseLeaves(ray, t_range, visitLeaf, steps);
+    return blocked;
+}
+
+//Ray packet functions
+void RayPacket::set(int i, const Ray &ray, Interval t_range)
+{
+    glm::vec3 invD = 1.0f/ray.d;
+    ox[i] = ray.o.x; oy[i] = ray.o.y; oz[i] = ray.o.z;
+    dx[i] = ray.d.x; dy[i] = ray.d.y; dz[i] = ray.d.z;
+    idx[i] = invD.x; idy[i] = invD.y; idz[i] = invD.z;
+    tmin[i] = t_range.min;
+    tmax[i] = t_range.max;
+    active |= uint64_t(1) << i;
+}
+
+//Interval bounds on the origins and inverse directions of the rays of a
+//packet. An axis whose inverse directions are not all finite and of one sign
+//is left out of the culling.
+struct PacketFrustum {
+    float olo[3], ohi[3], ilo[3], ihi[3];
+    bool usable[3];
+    float tmin, tmax;
+};
+
+static PacketFrustum packetFrustum(const RayPacket &packet, uint64_t mask)
+{
+    PacketFrustum f;
+    const float *o[3] = {packet.ox, packet.oy, packet.oz}, *inv[3] = {packet.idx, packet.idy, packet.idz};
+    float inf = std::numeric_limits<float>::infinity();
+    f.tmin = inf;
+    f.tmax = -inf;
+    for(int a = 0; a < 3; ++a)
+    {
+        f.olo[a] = f.ilo[a] = inf;
+        f.ohi[a] = f.ihi[a] = -inf;
+    }
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(!(mask & (uint64_t(1) << i))) continue;
+        for(int a = 0; a < 3; ++a)
+        {
+            f.olo[a] = std::min(f.olo[a], o[a][i]);
+            f.ohi[a] = std::max(f.ohi[a], o[a][i]);
+            f.ilo[a] = std::min(f.ilo[a], inv[a][i]);
+            f.ihi[a] = std::max(f.ihi[a], inv[a][i]);
+        }
+        f.tmin = std::min(f.tmin, packet.tmin[i]);
+        f.tmax = std::max(f.tmax, packet.tmax[i]);
+    }
+    for(int a = 0; a < 3; ++a)
+    {
+        f.usable[a] = std::isfinite(f.ilo[a]) && std::isfinite(f.ihi[a]) && (f.ilo[a] > 0 || f.ihi[a] < 0);
+    }
+    return f;
+}
+
+//True if no ray of the frustum can enter the box. Rounding is monotonic, so
+//the corner products bound every ray's slab distances exactly as computed.
+static bool frustumMisses(const PacketFrustum &f, const float *lo, const float *hi)
+{
+    float entry = f.tmin, exit = f.tmax;
+    for(int a = 0; a < 3; ++a)
+    {
+        if(!f.usable[a]) continue;
+        float products[8] = {(lo[a] - f.ohi[a])*f.ilo[a], (lo[a] - f.ohi[a])*f.ihi[a],
+                             (lo[a] - f.olo[a])*f.ilo[a], (lo[a] - f.olo[a])*f.ihi[a],
+                             (hi[a] - f.ohi[a])*f.ilo[a], (hi[a] - f.ohi[a])*f.ihi[a],
+                             (hi[a] - f.olo[a])*f.ilo[a], (hi[a] - f.olo[a])*f.ihi[a]};
+        float lowLo = std::min(std::min(products[0], products[1]), std::min(products[2], products[3]));
+        float lowHi = std::max(std::max(products[0], products[1]), std::max(products[2], products[3]));
+        float highLo = std::min(std::min(products[4], products[5]), std::min(products[6], products[7]));
+        float highHi = std::max(std::max(products[4], products[5]), std::max(products[6], products[7]));
+        //Positive directions enter through lo and leave through hi, negative ones the other way
+        entry = std::max(entry, f.ilo[a] > 0 ? lowLo : highLo);
+        exit = std::min(exit, f.ilo[a] > 0 ? highHi : lowHi);
+    }
+    return entry > exit;
+}
+
+//Rays of mask that enter the box within their own [tmin, tmax], the slab test
+//of AABB::hit for four rays at a time. nearest gets the smallest entry.
+static uint64_t packetHits(const RayPacket &packet, const float *tmax, uint64_t mask,
+                           const float *lo, const float *hi, float &nearest)
+{
+    uint64_t hits = 0;
+    nearest = std::numeric_limits<float>::infinity();
+    const float *o[3] = {packet.ox, packet.oy, packet.oz}, *inv[3] = {packet.idx, packet.idy, packet.idz};
+    for(int first = 0; first < RayPacket::maxSize; first += 4)
+    {
+        unsigned lanes = (mask >> first) & 15;
+        if(!lanes) continue;
+        float entry[4];
+#ifdef __SSE2__
+        __m128 tNear = _mm_loadu_ps(packet.tmin + first), tFar = _mm_loadu_ps(tmax + first);
+        for(int a = 0; a < 3; ++a)
+        {
+            __m128 origin = _mm_loadu_ps(o[a] + first), inverse = _mm_loadu_ps(inv[a] + first);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[a]), origin), inverse);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[a]), origin), inverse);
+            tNear = _mm_max_ps(_mm_min_ps(t1, t0), tNear);
+            tFar = _mm_min_ps(_mm_max_ps(t0, t1), tFar);
+        }
+        _mm_storeu_ps(entry, tNear);
+        unsigned in = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & lanes;
+#else
+        unsigned in = 0;
+        for(int k = 0; k < 4; ++k)
+        {
+            if(!(lanes & (1u << k))) continue;
+            AABB box(glm::vec3(lo[0], lo[1], lo[2]), glm::vec3(hi[0], hi[1], hi[2]));
+            glm::vec3 invD = glm::vec3(inv[0][first + k], inv[1][first + k], inv[2][first + k]);
+            if(box.hit(packet.ray(first + k), invD, packet.tmin[first + k], tmax[first + k], entry[k])) in |= 1u << k;
+        }
+#endif
+        for(int k = 0; k < 4; ++k)
+        {
+            if(in & (1u << k)) nearest = std::min(nearest, entry[k]);
+        }
+        hits |= uint64_t(in) << first;
+    }
+    return hits;
+}
+
+//Walks the MBVH with a packet, calling visitLeaf(node, rays) for every leaf
+//reached by some rays. tmax holds each ray's current range end, the visitor
+//may shrink it and returns the rays that are done. Subtrees reached by only
+//a few rays are walked by each ray alone, where the packet would mostly test
+//empty lanes.
+template<typename F>
+static void traversePacket(const MBVH &mbvh, const RayPacket &packet, const float *tmax, uint64_t mask,
+                           F &&visitLeaf, long *steps)
+{
+    const size_t minPacketRays = 8;
+    PacketFrustum frustum = packetFrustum(packet, mask);
+    uint64_t done = 0;
+    int stack[3*BVH::maxDepth + 2];
+    uint64_t rays[3*BVH::maxDepth + 2];
+    int top = 0;
+    stack[top] = 0;
+    rays[top++] = mask;
+    while(top > 0)
+    {
+        --top;
+        int index = stack[top];
+        uint64_t live = rays[top] & ~done;
+        if(!live) continue;
+        if(!MBVH::isLeaf(index) && std::bitset<RayPacket::maxSize>(live).count() < minPacketRays)
+        {
+            for(int i = 0; i < RayPacket::maxSize; ++i)
+            {
+                uint64_t ray = uint64_t(1) << i;
+                if(!(live & ray)) continue;
+                mbvh.traverseLeaves(packet.ray(i), Interval(packet.tmin[i], tmax[i]), [&](int node, float &t) {
+                    done |= visitLeaf(node, ray);
+                    t = tmax[i];
+                    return (done & ray) != 0;
+                }, steps, index);
+            }
+            if(done == mask) return;
+            continue;
+        }
+        if(steps) ++*steps;
+        if(MBVH::isLeaf(index))
+        {
+            done |= visitLeaf(MBVH::leafNode(index), live);
+            if(done == mask) return;
+            continue;
+        }
+        const MBVH::Node &node = mbvh.nodes[index];
+        float entry[4];
+        uint64_t childRays[4];
+        int order[4], hits = 0;
+        for(int i = 0; i < node.count; ++i)
+        {
+            float lo[3] = {node.lox[i], node.loy[i], node.loz[i]}, hi[3] = {node.hix[i], node.hiy[i], node.hiz[i]};
+            if(frustumMisses(frustum, lo, hi)) continue;
+            childRays[i] = packetHits(packet, tmax, live, lo, hi, entry[i]);
+            if(!childRays[i]) continue;
+            //Sorted by the nearest entry, farthest first so the nearest is popped next
+            int k = hits++;
+            for(; k > 0 && entry[order[k - 1]] < entry[i]; --k) order[k] = order[k - 1];
+            order[k] = i;
+        }
+        for(int k = 0; k < hits; ++k)
+        {
+            stack[top] = node.child[order[k]];
+            rays[top++] = childRays[order[k]];
+        }
+    }
+}
+
+uint64_t CompiledScene::intersect(const RayPacket &packet, HitRecord *recs, long *steps) const
+{
+    uint64_t hits = 0;
+    if(mbvh.empty())
+    {
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(!(packet.active & (uint64_t(1) << i))) continue;
+            if(intersect(packet.ray(i), Interval(packet.tmin[i], packet.tmax[i]), recs[i], steps)) hits |= uint64_t(1) << i;
+        }
+        return hits;
+    }
+    Closest best[RayPacket::maxSize];
+    float tmax[RayPacket::maxSize];
+    std::copy(packet.tmax, packet.tmax + RayPacket::maxSize, tmax);
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(packet.active & (uint64_t(1) << i)) intersectRange(unbounded, packet.ray(i), packet.tmin[i], tmax[i], best[i]);
+    }
+    traversePacket(mbvh, packet, tmax, packet.active, [&](int node, uint64_t rays) {
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(rays & (uint64_t(1) << i)) intersectRange(leaves[node], packet.ray(i), packet.tmin[i], tmax[i], best[i]);
+        }
+        return uint64_t(0);
+    }, steps);
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(!(packet.active & (uint64_t(1) << i)) || best[i].object < 0) continue;
+        finish(best[i], recs[i]);
+        hits |= uint64_t(1) << i;
+    }
+    return hits;
+}
+
+uint64_t CompiledScene::occluded(const RayPacket &packet, bool skipRectangles, long *steps) const
+{
+    uint64_t blocked = 0;
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(!(packet.active & (uint64_t(1) << i))) continue;
+        bool hit = mbvh.empty() ? occluded(packet.ray(i), Interval(packet.tmin[i], packet.tmax[i]), skipRectangles, steps)
+                                : occludedRange(unbounded, packet.ray(i), Interval(packet.tmin[i], packet.tmax[i]), skipRectangles);
+        if(hit) blocked |= uint64_t(1) << i;
+    }
+    if(mbvh.empty() || blocked == packet.active) return blocked;
+    traversePacket(mbvh, packet, packet.tmax, packet.active & ~blocked, [&](int node, uint64_t rays) {
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(!(rays & (uint64_t(1) << i))) continue;
+            if(occludedRange(leaves[node], packet.ray(i), Interval(packet.tmin[i], packet.tmax[i]), skipRectangles))
+                blocked |= uint64_t(1) << i;
+        }
+        return blocked;
+    }, steps);
+    return blocked;
+}
@@ -0,0 +1,493 @@
+#include "distributed.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <deque>
+
+//Connection functions
+static bool sendAll(int fd, const char *data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if(sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+//Waits for each part of the data until deadline, if there is one
+static bool receiveAll(int fd, char *data, size_t size, const std::chrono::steady_clock::time_point *deadline)
+{
+    while(size > 0)
+    {
+        if(deadline)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+            pollfd p = {fd, POLLIN, 0};
+            if(left.count() <= 0 || poll(&p, 1, (int)left.count()) <= 0) return false;
+        }
+        ssize_t got = ::recv(fd, data, size, 0);
+        if(got <= 0) return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool Connection::send(uint32_t type, const std::string &payload) const
+{
+    uint32_t header[2] = {htonl(type), htonl((uint32_t)payload.size())};
+    return fd >= 0 && sendAll(fd, reinterpret_cast<const char*>(header), sizeof(header)) &&
+           sendAll(fd, payload.data(), payload.size());
+}
+
+bool Connection::receive(uint32_t &type, std::string &payload, double timeout) const
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    const std::chrono::steady_clock::time_point *until = timeout >= 0.0 ? &deadline : nullptr;
+    uint32_t header[2];
+    if(fd < 0 || !receiveAll(fd, reinterpret_cast<char*>(header), sizeof(header), until)) return false;
+    type = ntohl(header[0]);
+    uint32_t size = ntohl(header[1]);
+    if(size > maxPayload) return false;
+    payload.resize(size);
+    return payload.empty() || receiveAll(fd, &payload[0], payload.size(), until);
+}
+
+bool Connection::sendHello() const
+{
+    MessageWriter m;
+    m.put(htonl(magic));
+    m.put(htonl(version));
+    return send(Hello, m.data);
+}
+
+bool Connection::receiveHello(double timeout) const
+{
+    uint32_t type;
+    std::string payload;
+    if(!receive(type, payload, timeout) || type != Hello || payload.size() != 2*sizeof(uint32_t)) return false;
+    MessageReader m(payload);
+    return ntohl(m.get<uint32_t>()) == magic && ntohl(m.get<uint32_t>()) == version;
+}
+
+void Connection::close()
+{
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+}
+
+Connection Connection::connectTo(const std::string &host, int port)
+{
+    addrinfo hints = addrinfo(), *found = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0) return Connection();
+    int fd = -1;
+    for(addrinfo *a = found; a && fd < 0; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if(fd >= 0)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return Connection(fd);
+}
+
+//MessageReader functions
+std::string MessageReader::getString()
+{
+    uint32_t size = get<uint32_t>();
+    if(!ok || offset + size > data.size())
+    {
+        ok = false;
+        return std::string();
+    }
+    std::string s = data.substr(offset, size);
+    offset += size;
+    return s;
+}
+
+//Setup payload: the scene description, the image size, the render and path
+//settings the workers need. Sample counts and first samples come with jobs.
+static std::string setupMessage(const std::string &description, const PathSettings &path, int w, int h,
+                                const RenderSettings &settings)
+{
+    MessageWriter m;
+    m.putString(description);
+    m.put((int32_t)w);
+    m.put((int32_t)h);
+    m.put((int32_t)settings.integrator);
+    m.put((int32_t)settings.numberOfBounces);
+    m.put((uint64_t)settings.seed);
+    m.put((int32_t)settings.samplerType);
+    m.put((uint8_t)settings.pixelJitter);
+    m.put((uint8_t)settings.packets);
+    m.put((uint8_t)settings.wavefront);
+    m.put((int32_t)settings.wavefrontPaths);
+    m.put((uint8_t)path.iterative);
+    m.put((int32_t)path.maxDepth);
+    m.put((int32_t)path.rouletteDepth);
+    m.put((uint8_t)path.reusePrimaryHit);
+    m.put((int32_t)path.primaryStrata);
+    m.put((uint8_t)path.nextEventEstimation);
+    m.put((uint8_t)path.lightTree);
+    return m.data;
+}
+
+static bool readSetup(const std::string &payload, std::string &description, PathSettings &path, int &w, int &h,
+                      RenderSettings &settings)
+{
+    MessageReader m(payload);
+    description = m.getString();
+    w = m.get<int32_t>();
+    h = m.get<int32_t>();
+    settings.integrator = (RenderSettings::Integrator)m.get<int32_t>();
+    settings.numberOfBounces = m.get<int32_t>();
+    settings.seed = m.get<uint64_t>();
+    settings.samplerType = (Sampler::Type)m.get<int32_t>();
+    settings.pixelJitter = m.get<uint8_t>();
+    settings.packets = m.get<uint8_t>();
+    settings.wavefront = m.get<uint8_t>();
+    settings.wavefrontPaths = m.get<int32_t>();
+    path.iterative = m.get<uint8_t>();
+    path.maxDepth = m.get<int32_t>();
+    path.rouletteDepth = m.get<int32_t>();
+    path.reusePrimaryHit = m.get<uint8_t>();
+    path.primaryStrata = m.get<int32_t>();
+    path.nextEventEstimation = m.get<uint8_t>();
+    path.lightTree = m.get<uint8_t>();
+    return m.ok && w > 0 && h > 0;
+}
+
+//A tile and a range of samples
+class Job {
+public:
+    Tile tile;
+    int firstSample = 0, samples = 0;
+    bool done = false;
+    int issues = 0;     //workers it is out with
+    std::chrono::steady_clock::time_point issued;   //last time it went out
+};
+
+//Assign payload: job id, tile, first sample and sample count
+static std::string assignMessage(int id, const Job &job)
+{
+    MessageWriter m;
+    m.put((int32_t)id);
+    m.put((int32_t)job.tile.x0);
+    m.put((int32_t)job.tile.y0);
+    m.put((int32_t)job.tile.x1);
+    m.put((int32_t)job.tile.y1);
+    m.put((int32_t)job.firstSample);
+    m.put((int32_t)job.samples);
+    return m.data;
+}
+
+//Coordinator functions
+Coordinator::Coordinator(int port, const std::string &host)
+{
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    if(!host.empty() && inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+    {
+        addrinfo hints = addrinfo(), *found = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0) return;
+        address.sin_addr = ((sockaddr_in*)found->ai_addr)->sin_addr;
+        freeaddrinfo(found);
+    }
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) return;
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    socklen_t size = sizeof(address);
+    if(bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0 ||
+       getsockname(listenFd, (sockaddr*)&address, &size) != 0)
+    {
+        ::close(listenFd);
+        listenFd = -1;
+        return;
+    }
+    listenPort = ntohs(address.sin_port);
+}
+
+Coordinator::~Coordinator()
+{
+    finish();
+    if(listenFd >= 0) ::close(listenFd);
+}
+
+int Coordinator::acceptWorkers(int count, double timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    while((int)workers.size() < count && listenFd >= 0)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if(left.count() <= 0) break;
+        pollfd p = {listenFd, POLLIN, 0};
+        if(poll(&p, 1, (int)left.count()) <= 0) continue;
+        Connection worker(accept(listenFd, nullptr, nullptr));
+        if(worker.fd < 0) continue;
+        int one = 1;
+        setsockopt(worker.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if(!worker.receiveHello(std::max(0.0, left.count()*1e-3)) || !worker.sendHello())
+        {
+            worker.close();
+            continue;
+        }
+        workers.push_back(worker);
+    }
+    return (int)workers.size();
+}
+
+bool Coordinator::render(const std::string &description, const PathSettings &pathSettings, HDRImage &image,
+                         const RenderSettings &settings, const DistributedSettings &distributed,
+                         DistributedStats &stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string setup = setupMessage(description, pathSettings, image.w, image.h, settings);
+    std::vector<int> busy(workers.size(), -1);     //job out with each worker
+    std::vector<std::chrono::steady_clock::time_point> since(workers.size());
+    for(size_t k = 0; k < workers.size(); ++k)
+    {
+        if(!workers[k].send(Connection::Setup, setup)) workers[k].close();
+    }
+
+    std::vector<Job> jobs;
+    int perJob = distributed.samplesPerJob > 0 ? distributed.samplesPerJob : settings.numberOfSamples;
+    for(const Tile &tile:makeTiles(image.w, image.h, std::max(1, distributed.tileSize)))
+    {
+        for(int first = 0; first < settings.numberOfSamples; first += perJob)
+        {
+            Job job;
+            job.tile = tile;
+            job.firstSample = settings.firstSample + first;
+            job.samples = std::min(perJob, settings.numberOfSamples - first);
+            jobs.push_back(job);
+        }
+    }
+    stats.jobs = (int)jobs.size();
+    std::deque<int> pending;
+    for(int j = 0; j < (int)jobs.size(); ++j) pending.push_back(j);
+    int remaining = (int)jobs.size(), finishedJobs = 0;
+    double jobSeconds = 0.0;    //summed over finished jobs
+    AccumulationBuffer accumulation(image.w, image.h);
+    HDRImage staging(image.w, image.h);
+
+    auto lose = [&](size_t k) {
+        workers[k].close();
+        stats.lostWorkers++;
+        if(busy[k] >= 0)
+        {
+            Job &job = jobs[busy[k]];
+            if(--job.issues == 0 && !job.done) pending.push_front(busy[k]);
+        }
+        busy[k] = -1;
+    };
+    while(remaining > 0)
+    {
+        //Drop workers that have not answered for too long, their jobs go
+        //back to the others
+        auto now = std::chrono::steady_clock::now();
+        for(size_t k = 0; k < workers.size(); ++k)
+        {
+            std::chrono::duration<double> out = now - since[k];
+            if(workers[k].fd >= 0 && busy[k] >= 0 && out.count() > distributed.jobTimeout) lose(k);
+        }
+
+        //Hand out pending jobs, then copies of jobs that are overdue. A job
+        //goes out again every time the limit passes since its last copy,
+        //until one of them comes back.
+        for(size_t k = 0; k < workers.size(); ++k)
+        {
+            if(workers[k].fd < 0 || busy[k] >= 0) continue;
+            int j = -1;
+            if(!pending.empty())
+            {
+                j = pending.front();
+                pending.pop_front();
+            }
+            else if(finishedJobs > 0)
+            {
+                double limit = std::max(distributed.minReissueSeconds,
+                                        (double)distributed.slowFactor*jobSeconds/finishedJobs);
+                for(int c = 0; c < (int)jobs.size() && j < 0; ++c)
+                {
+                    std::chrono::duration<double> out = now - jobs[c].issued;
+                    if(!jobs[c].done && jobs[c].issues > 0 && out.count() > limit) j = c;
+                }
+                if(j >= 0) stats.reissued++;
+            }
+            if(j < 0) continue;
+            jobs[j].issues++;
+            jobs[j].issued = now;
+            busy[k] = j;
+            since[k] = now;
+            if(!workers[k].send(Connection::Assign, assignMessage(j, jobs[j]))) lose(k);
+        }
+
+        std::vector<pollfd> polls;
+        std::vector<size_t> polled;
+        for(size_t k = 0; k < workers.size(); ++k)
+        {
+            if(workers[k].fd < 0) continue;
+            pollfd p = {workers[k].fd, POLLIN, 0};
+            polls.push_back(p);
+            polled.push_back(k);
+        }
+        if(polls.empty()) break;
+        if(poll(polls.data(), polls.size(), 50) <= 0) continue;
+        for(size_t p = 0; p < polls.size(); ++p)
+        {
+            if(!polls[p].revents) continue;
+            size_t k = polled[p];
+            uint32_t type;
+            std::string payload;
+            if(!workers[k].receive(type, payload, distributed.messageTimeout) || type != Connection::Result || busy[k] < 0)
+            {
+                lose(k);
+                continue;
+            }
+            MessageReader m(payload);
+            int j = m.get<int32_t>(), samples = m.get<int32_t>();
+            if(!m.ok || j != busy[k])
+            {
+                lose(k);
+                continue;
+            }
+            Job &job = jobs[j];
+            job.issues--;
+            busy[k] = -1;
+            if(job.done)
+            {
+                stats.duplicates++;
+                continue;
+            }
+            const Tile &t = job.tile;
+            for(int y = t.y0; y < t.y1; ++y)
+            {
+                for(int x = t.x0; x < t.x1; ++x)
+                {
+                    float r = m.get<float>(), g = m.get<float>(), b = m.get<float>();
+                    staging.pixel(x, y) = color(r, g, b);
+                }
+            }
+            if(!m.ok || samples != job.samples)
+            {
+                if(job.issues == 0) pending.push_front(j);
+                lose(k);
+                continue;
+            }
+            accumulation.add(staging, t.x0, t.y0, t.x1, t.y1, samples);
+            job.done = true;
+            remaining--;
+            finishedJobs++;
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - since[k];
+            jobSeconds += took.count();
+        }
+    }
+    accumulation.resolve(image);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.seconds = elapsed.count();
+    return remaining == 0;
+}
+
+void Coordinator::finish()
+{
+    for(auto &worker:workers)
+    {
+        worker.send(Connection::Done, std::string());
+        worker.close();
+    }
+    workers.clear();
+}
+
+//Worker functions
+int runWorker(const std::string &host, int port, const SceneLoader &loader, double delay)
+{
+    Connection connection = Connection::connectTo(host, port);
+    if(connection.fd < 0 || !connection.sendHello() || !connection.receiveHello(10.0))
+    {
+        connection.close();
+        return 1;
+    }
+    Scene scene;
+    RenderSettings settings;
+    std::unique_ptr<HDRImage> image;
+    uint32_t type;
+    std::string payload;
+    int status = 1;
+    while(connection.receive(type, payload))
+    {
+        if(type == Connection::Done)
+        {
+            status = 0;
+            break;
+        }
+        if(type == Connection::Setup)
+        {
+            std::string description;
+            int w, h;
+            if(!readSetup(payload, description, scene.pathSettings, w, h, settings) || !loader(description, scene)) break;
+            //Scenes mapped from a cache come built
+            if(!scene.hasCompiledScene()) scene.buildBVH();
+            image.reset(new HDRImage(w, h));
+            continue;
+        }
+        if(type != Connection::Assign || !image) break;
+        MessageReader m(payload);
+        int id = m.get<int32_t>();
+        Tile tile;
+        tile.x0 = m.get<int32_t>();
+        tile.y0 = m.get<int32_t>();
+        tile.x1 = m.get<int32_t>();
+        tile.y1 = m.get<int32_t>();
+        settings.firstSample = m.get<int32_t>();
+        settings.numberOfSamples = m.get<int32_t>();
+        if(!m.ok || tile.x0 < 0 || tile.y0 < 0 || tile.x1 > image->w || tile.y1 > image->h) break;
+        renderTile(scene, *image, tile, settings);
+        if(delay > 0.0) std::this_thread::sleep_for(std::chrono::duration<double>(delay));
+
+        MessageWriter result;
+        result.put((int32_t)id);
+        result.put((int32_t)settings.numberOfSamples);
+        for(int y = tile.y0; y < tile.y1; ++y)
+        {
+            for(int x = tile.x0; x < tile.x1; ++x)
+            {
+                color c = image->pixel(x, y);
+                result.put(c.x);
+                result.put(c.y);
+                result.put(c.z);
+            }
+        }
+        if(!connection.send(Connection::Result, result.data)) break;
+    }
+    connection.close();
+    for(auto obj:scene.objects) delete obj;
+    delete scene.camera;
+    return status;
+}
@@ -0,0 +1,115 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "render.hpp"
+
+#include <cstring>
+#include <functional>
+#include <string>
+
+//Coordinator and worker processes rendering one image over TCP sockets
+//(POSIX). The image is split into jobs, a tile and a range of samples each.
+//Workers render a job with renderTile from the job's first sample on and send
+//back the tile's pixels with the sample count, the coordinator merges them
+//weighted by samples. A job whose worker takes much longer than jobs have
+//been taking is issued again to an idle worker, the first result wins.
+//Workers open with a hello carrying a magic number and the protocol version.
+//The coordinator drops connections that do not, and listens on the loopback
+//interface unless it is given an address. There is no authentication, only
+//listen on networks whose hosts are trusted.
+
+//Builds the scene a description names, returns false if it cannot
+typedef std::function<bool(const std::string &description, Scene &scene)> SceneLoader;
+
+//Length prefixed messages over a connected socket, blocking
+class Connection {
+public:
+    enum Type { Setup = 1, Assign, Result, Done, Hello };
+    static const uint32_t magic = 0x52544450;   //"RTDP"
+    static const uint32_t version = 1;
+    static const uint32_t maxPayload = 64u << 20;   //longer messages are refused
+    int fd = -1;
+    explicit Connection(int fd = -1): fd(fd) {}
+    bool send(uint32_t type, const std::string &payload) const;
+    //Fails if the whole message has not arrived within timeout seconds,
+    //a negative timeout waits for as long as it takes
+    bool receive(uint32_t &type, std::string &payload, double timeout = -1.0) const;
+    bool sendHello() const;
+    bool receiveHello(double timeout) const;
+    void close();
+    static Connection connectTo(const std::string &host, int port);
+};
+
+//Appends and reads back plain values and strings of a message payload
+class MessageWriter {
+public:
+    std::string data;
+    template<typename T>
+    void put(const T &value) { data.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+    void putString(const std::string &s) { put((uint32_t)s.size()); data += s; }
+};
+
+class MessageReader {
+public:
+    const std::string &data;
+    size_t offset = 0;
+    bool ok = true;
+    explicit MessageReader(const std::string &data): data(data) {}
+    template<typename T>
+    T get() {
+        T value = T();
+        if(offset + sizeof(T) > data.size()) { ok = false; return value; }
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
+    }
+    std::string getString();
+};
+
+class DistributedSettings {
+public:
+    int tileSize = 32;
+    int samplesPerJob = 0;      //0 renders all of a tile's samples in one job
+    float slowFactor = 3.0f;    //a job out this many times the mean job time is issued again
+    double minReissueSeconds = 0.5;
+    double workerTimeout = 10.0;    //for all workers to connect
+    double messageTimeout = 5.0;    //for the rest of a result once it starts arriving
+    double jobTimeout = 300.0;      //a worker with a job out this long is dropped
+};
+
+class DistributedStats {
+public:
+    int jobs = 0, reissued = 0, duplicates = 0, lostWorkers = 0;
+    double seconds = 0.0;
+};
+
+class Coordinator {
+public:
+    //Listens on port of the IPv4 address host, 0 picks a free one. An empty
+    //host is the loopback interface, "0.0.0.0" every interface.
+    explicit Coordinator(int port = 0, const std::string &host = std::string());
+    ~Coordinator();
+    int port() const { return listenPort; }
+    bool listening() const { return listenFd >= 0; }
+    //Accepts connections until there are count workers or the timeout passes.
+    //Connections that do not say hello within the timeout are closed.
+    int acceptWorkers(int count, double timeout);
+    //Renders the scene every worker loads from description with the given
+    //path settings. Workers that stop answering are dropped, their jobs go
+    //to the others. Returns false if every worker was lost before the end.
+    bool render(const std::string &description, const PathSettings &pathSettings, HDRImage &image,
+                const RenderSettings &settings, const DistributedSettings &distributed, DistributedStats &stats);
+    //Tells every worker to exit
+    void finish();
+
+private:
+    int listenFd = -1, listenPort = 0;
+    std::vector<Connection> workers;
+};
+
+//Connects to a coordinator and renders the jobs it sends until it is done.
+//delay is added to every job, to test the handling of slow workers.
+//Returns 0 on a clean finish.
+int runWorker(const std::string &host, int port, const SceneLoader &loader, double delay = 0.0);
+
+#endif
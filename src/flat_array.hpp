@@ -0,0 +1,92 @@
+#ifndef FLAT_ARRAY_HPP
+#define FLAT_ARRAY_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//Array of plain values that either owns its elements, like the vector it
+//wraps, or views elements stored elsewhere, such as a mapped scene cache
+//(see SceneCache). Views are used in place: element access never copies,
+//only changing the size of a view first copies it into owned storage.
+//Copies of a view own their elements.
+template<typename T>
+class FlatArray {
+public:
+    FlatArray() {}
+    FlatArray(const FlatArray &other): owned(other.ptr, other.ptr + other.n) { sync(); }
+    FlatArray(FlatArray &&other) { take(other); }
+    FlatArray &operator=(const FlatArray &other) {
+        if(this != &other)
+        {
+            owned.assign(other.ptr, other.ptr + other.n);
+            sync();
+        }
+        return *this;
+    }
+    FlatArray &operator=(FlatArray &&other) {
+        if(this != &other) take(other);
+        return *this;
+    }
+    FlatArray &operator=(std::vector<T> &&elements) {
+        owned = std::move(elements);
+        sync();
+        return *this;
+    }
+
+    //Views count elements at data, which must stay valid while viewed
+    void view(T *data, size_t count) {
+        owned = std::vector<T>();
+        ptr = data;
+        n = count;
+        viewing = true;
+    }
+    bool isView() const { return viewing; }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    T *data() { return ptr; }
+    const T *data() const { return ptr; }
+    T *begin() { return ptr; }
+    T *end() { return ptr + n; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + n; }
+    T &operator[](size_t i) { return ptr[i]; }
+    const T &operator[](size_t i) const { return ptr[i]; }
+    T &back() { return ptr[n - 1]; }
+    const T &back() const { return ptr[n - 1]; }
+
+    void clear() { owned.clear(); sync(); }
+    void reserve(size_t count) { own(); owned.reserve(count); sync(); }
+    void resize(size_t count, const T &value = T()) { own(); owned.resize(count, value); sync(); }
+    void assign(size_t count, const T &value) { owned.assign(count, value); sync(); }
+    template<typename It>
+    void assign(It first, It last) { owned.assign(first, last); sync(); }
+    void push_back(const T &value) { own(); owned.push_back(value); sync(); }
+
+private:
+    std::vector<T> owned;
+    T *ptr = nullptr;
+    size_t n = 0;
+    bool viewing = false;
+
+    void sync() {
+        ptr = owned.data();
+        n = owned.size();
+        viewing = false;
+    }
+    void own() {
+        if(viewing) owned.assign(ptr, ptr + n);
+        sync();
+    }
+    void take(FlatArray &other) {
+        owned = std::move(other.owned);
+        ptr = other.viewing ? other.ptr : owned.data();
+        n = other.n;
+        viewing = other.viewing;
+        other.owned.clear();
+        other.sync();
+    }
+};
+
+#endif
@@ -15,6 +15,31 @@ void tonemap(const HDRImage &hdri, SDL_Surface* ldri,
     }
 }
 
+void AccumulationBuffer::add(const HDRImage &image, int x0, int y0, int x1, int y1, int weight)
+{
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++) {
+            int k = i + j*w;
+            color c = image.pixel(i, j);
+            sum[3*k] += (double)c.r*weight;
+            sum[3*k + 1] += (double)c.g*weight;
+            sum[3*k + 2] += (double)c.b*weight;
+            count[k] += weight;
+        }
+    }
+}
+
+void AccumulationBuffer::resolve(HDRImage &image) const
+{
+    for (int k = 0; k < w*h; k++) {
+        if(count[k] == 0) {
+            image.pixels[k] = color(0.0f);
+            continue;
+        }
+        image.pixels[k] = color(sum[3*k]/count[k], sum[3*k + 1]/count[k], sum[3*k + 2]/count[k]);
+    }
+}
+
 void openImage(const char* filename) {
     #if defined(_WIN32) || defined(_WIN64)
         std::string command = "start " + std::string(filename);
@@ -27,6 +27,27 @@ public:
     }
 };
 
+//Running sum of pixel estimates in double precision, for renders that add
+//passes over time. Every pixel keeps its own count so that a pass may cover
+//only part of the image.
+class AccumulationBuffer {
+public:
+    int w, h;
+    std::vector<double> sum;        //three per pixel
+    std::vector<int> count;         //weight of the estimates added per pixel
+    AccumulationBuffer(int w, int h):
+        w(w),
+        h(h),
+        sum(3*w*h, 0.0),
+        count(w*h, 0) {
+    }
+    //Adds the pixels [x0, x1) x [y0, y1) of image as one more estimate each,
+    //counting weight times, the number of samples it averages for example
+    void add(const HDRImage &image, int x0, int y0, int x1, int y1, int weight = 1);
+    //Weighted mean of the estimates, black where there are none yet
+    void resolve(HDRImage &image) const;
+};
+
 void tonemap(const HDRImage &hdri, SDL_Surface* ldri,
              float exposure=1, float gamma=2.2);
 
@@ -0,0 +1,481 @@
+#include "scene.hpp"
+
+#include <algorithm>
+
+static float luminance(const color &c)
+{
+    return 0.2126f*c.x + 0.7152f*c.y + 0.0722f*c.z;
+}
+
+static float powerHeuristic(float pdfA, float pdfB)
+{
+    float a = pdfA*pdfA, b = pdfB*pdfB;
+    return (a + b > 0.0f) ? a/(a + b) : 0.0f;
+}
+
+//cos and sin of max(0, a - b) from the cos and sin of a and b
+static float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if(cosA > cosB) return 1.0f;
+    return cosA*cosB + sinA*sinB;
+}
+static float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+    if(cosA > cosB) return 0.0f;
+    return sinA*cosB - cosA*sinB;
+}
+static float sinFromCos(float c)
+{
+    return std::sqrt(std::max(0.0f, 1.0f - c*c));
+}
+
+//Light bounds functions
+float LightBounds::importance(const glm::vec3 &p, const glm::vec3 &n) const
+{
+    glm::vec3 pc = bounds.centroid();
+    glm::vec3 w = p - pc;
+    float dist2 = glm::dot(w, w);
+    float r = 0.5f*glm::length(bounds.hi - bounds.lo);
+    //Close to or inside the bounds the squared distance is clamped to a
+    //quarter of r*r, so the importance scales with the scene. Clamping to all
+    //of r*r starves nearby lights in large clusters.
+    float d2 = std::max(std::max(dist2, 0.25f*r*r), 1e-8f);
+    w = dist2 > 0.0f ? w/std::sqrt(dist2) : axis;
+
+    //Smallest angle between a possible normal and the direction towards p,
+    //widened by the angle the bounds subtend from p
+    float cosTheta_w = glm::dot(axis, w);
+    if(twoSided) cosTheta_w = std::abs(cosTheta_w);
+    float sinTheta_w = sinFromCos(cosTheta_w);
+    float cosTheta_b = (dist2 > r*r) ? std::sqrt(1.0f - r*r/dist2) : -1.0f;
+    float sinTheta_b = sinFromCos(cosTheta_b);
+    float sinTheta_o = sinFromCos(cosTheta_o);
+    float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    float cosTheta_p = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if(cosTheta_p <= cosTheta_e) return 0.0f;
+
+    float result = power*cosTheta_p/d2;
+    if(n != glm::vec3(0.0f))
+    {
+        //Receivers only take light from above their surface
+        float cosTheta_i = -glm::dot(w, n);
+        float cosThetap_i = cosSubClamped(sinFromCos(cosTheta_i), cosTheta_i, sinTheta_b, cosTheta_b);
+        result *= std::max(0.0f, cosThetap_i);
+    }
+    return result;
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b)
+{
+    if(!(a.power > 0.0f)) return b;
+    if(!(b.power > 0.0f)) return a;
+    LightBounds m;
+    m.bounds = a.bounds;
+    m.bounds.expand(b.bounds);
+    m.power = a.power + b.power;
+    m.cosTheta_e = std::min(a.cosTheta_e, b.cosTheta_e);
+    m.twoSided = a.twoSided || b.twoSided;
+
+    //Smallest cone holding both normal cones
+    float theta_a = std::acos(glm::clamp(a.cosTheta_o, -1.0f, 1.0f));
+    float theta_b = std::acos(glm::clamp(b.cosTheta_o, -1.0f, 1.0f));
+    float theta_d = std::acos(glm::clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+    float pi = glm::pi<float>();
+    if(std::min(theta_d + theta_b, pi) <= theta_a) { m.axis = a.axis; m.cosTheta_o = a.cosTheta_o; return m; }
+    if(std::min(theta_d + theta_a, pi) <= theta_b) { m.axis = b.axis; m.cosTheta_o = b.cosTheta_o; return m; }
+    float theta_o = 0.5f*(theta_a + theta_d + theta_b);
+    glm::vec3 k = glm::cross(a.axis, b.axis);
+    float kLength = glm::length(k);
+    if(theta_o >= pi || !(kLength > 0.0f))
+    {
+        m.axis = a.axis;
+        m.cosTheta_o = -1.0f;
+        return m;
+    }
+    //Rotate a.axis towards b.axis by theta_o - theta_a
+    k /= kLength;
+    float theta_r = theta_o - theta_a;
+    m.axis = glm::normalize(a.axis*std::cos(theta_r) + glm::cross(k, a.axis)*std::sin(theta_r) +
+                            k*glm::dot(k, a.axis)*(1.0f - std::cos(theta_r)));
+    m.cosTheta_o = std::cos(theta_o);
+    return m;
+}
+
+//Solid angle measure of the directions a cluster emits in, from the cone
+//bounds, used to weigh splits when building the light BVH
+static float orientationMeasure(const LightBounds &b)
+{
+    float pi = glm::pi<float>();
+    float theta_o = std::acos(glm::clamp(b.cosTheta_o, -1.0f, 1.0f));
+    float theta_e = std::acos(glm::clamp(b.cosTheta_e, -1.0f, 1.0f));
+    float theta_w = std::min(theta_o + theta_e, pi);
+    float sinTheta_o = std::sin(theta_o);
+    return 2.0f*pi*(1.0f - b.cosTheta_o) +
+           0.5f*pi*(2.0f*theta_w*sinTheta_o - std::cos(theta_o - 2.0f*theta_w) - 2.0f*theta_o*sinTheta_o + b.cosTheta_o);
+}
+
+static float clusterCost(const LightBounds &b)
+{
+    return b.power*orientationMeasure(b)*std::max(b.bounds.surfaceArea(), 1e-6f);
+}
+
+//Light BVH functions
+void LightBVH::build(const std::vector<LightBounds> &lights)
+{
+    nodes.clear();
+    leafOf.assign(lights.size(), -1);
+    if(lights.empty()) return;
+    std::vector<int> order(lights.size());
+    for(int i = 0; i < (int)order.size(); ++i) order[i] = i;
+    nodes.reserve(2*lights.size() - 1);
+    buildNode(lights, order, 0, order.size(), -1);
+}
+
+int LightBVH::buildNode(const std::vector<LightBounds> &lights, std::vector<int> &order, int first, int count, int parent)
+{
+    int index = nodes.size();
+    nodes.push_back(Node());
+    nodes[index].parent = parent;
+    if(count == 1)
+    {
+        nodes[index].bounds = lights[order[first]];
+        nodes[index].light = order[first];
+        leafOf[order[first]] = index;
+        return index;
+    }
+
+    AABB centroidBox;
+    for(int i = first; i < first + count; ++i) centroidBox.expand(lights[order[i]].bounds.centroid());
+
+    //Binned split along each axis minimizing power x orientation x area,
+    //with the box aspect ratio penalizing splits across thin axes
+    const int binCount = 12;
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1, bestBin = 0;
+    glm::vec3 extent = centroidBox.hi - centroidBox.lo;
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        if(!(extent[axis] > 0.0f)) continue;
+        LightBounds bins[binCount];
+        for(int i = first; i < first + count; ++i)
+        {
+            const LightBounds &b = lights[order[i]];
+            int bin = std::min(binCount - 1, (int)(binCount*(b.bounds.centroid()[axis] - centroidBox.lo[axis])/extent[axis]));
+            bins[bin] = LightBounds::merge(bins[bin], b);
+        }
+        for(int split = 0; split < binCount - 1; ++split)
+        {
+            LightBounds below, above;
+            for(int i = 0; i <= split; ++i) below = LightBounds::merge(below, bins[i]);
+            for(int i = split + 1; i < binCount; ++i) above = LightBounds::merge(above, bins[i]);
+            if(!(below.power > 0.0f) || !(above.power > 0.0f)) continue;
+            float cost = (clusterCost(below) + clusterCost(above))*maxExtent/extent[axis];
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = split;
+            }
+        }
+    }
+
+    int mid = first + count/2;
+    if(bestAxis >= 0)
+    {
+        auto it = std::partition(order.begin() + first, order.begin() + first + count, [&](int l) {
+            float c = lights[l].bounds.centroid()[bestAxis];
+            int bin = std::min(binCount - 1, (int)(binCount*(c - centroidBox.lo[bestAxis])/extent[bestAxis]));
+            return bin <= bestBin;
+        });
+        mid = it - order.begin();
+        if(mid == first || mid == first + count) mid = first + count/2;
+    }
+    int left = buildNode(lights, order, first, mid - first, index);
+    int right = buildNode(lights, order, mid, first + count - mid, index);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    nodes[index].bounds = LightBounds::merge(nodes[left].bounds, nodes[right].bounds);
+    return index;
+}
+
+int LightBVH::sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const
+{
+    pmf = 0.0f;
+    if(nodes.empty() || !(nodes[0].bounds.importance(p, n) > 0.0f)) return -1;
+    int node = 0;
+    float prob = 1.0f;
+    while(nodes[node].light < 0)
+    {
+        const Node &cur = nodes[node];
+        float il = nodes[cur.left].bounds.importance(p, n);
+        float ir = nodes[cur.right].bounds.importance(p, n);
+        if(!(il + ir > 0.0f)) return -1;
+        float pl = il/(il + ir);
+        //Reuse u for the next level after remapping it to [0, 1)
+        if(u < pl)
+        {
+            node = cur.left;
+            u = std::min(u/pl, 0.99999994f);
+            prob *= pl;
+        }
+        else
+        {
+            node = cur.right;
+            u = std::min((u - pl)/(1.0f - pl), 0.99999994f);
+            prob *= 1.0f - pl;
+        }
+    }
+    pmf = prob;
+    return nodes[node].light;
+}
+
+float LightBVH::pmf(int light, const glm::vec3 &p, const glm::vec3 &n) const
+{
+    if(nodes.empty() || !(nodes[0].bounds.importance(p, n) > 0.0f)) return 0.0f;
+    float prob = 1.0f;
+    int node = leafOf[light];
+    while(nodes[node].parent >= 0)
+    {
+        const Node &parent = nodes[nodes[node].parent];
+        float il = nodes[parent.left].bounds.importance(p, n);
+        float ir = nodes[parent.right].bounds.importance(p, n);
+        if(!(il + ir > 0.0f)) return 0.0f;
+        prob *= (parent.left == node ? il : ir)/(il + ir);
+        node = nodes[node].parent;
+    }
+    return prob;
+}
+
+//Emitter functions
+bool Emitter::sample(const glm::vec3 &p, glm::vec2 u, glm::vec3 &q, float &pdf) const
+{
+    if(type == PointSource)
+    {
+        q = center;
+        pdf = 1.0f;
+        return true;
+    }
+    if(type == SphereLight)
+    {
+        //Uniform over the cone of directions subtended by the sphere
+        glm::vec3 w = center - p;
+        float d2 = glm::dot(w, w), r2 = radius*radius;
+        if(d2 <= r2) return false;
+        float sin2 = r2/d2;
+        float cosMax = std::sqrt(1.0f - sin2);
+        float oneMinusCosMax = sin2/(1.0f + cosMax);    //1 - cosMax without the cancellation for far lights
+        float cosTheta = 1.0f - u.x*oneMinusCosMax;
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta*cosTheta));
+        float phi = 2.0f*glm::pi<float>()*u.y;
+        glm::vec3 dir = toWorldSpace(glm::vec3(sinTheta*std::cos(phi), sinTheta*std::sin(phi), cosTheta),
+                                     w/std::sqrt(d2));
+        //Nearest intersection along dir, clamped for directions grazing the silhouette
+        float b = glm::dot(dir, w);
+        float t = b - std::sqrt(std::max(0.0f, b*b - (d2 - r2)));
+        q = p + t*dir;
+        pdf = 1.0f/(2.0f*glm::pi<float>()*oneMinusCosMax);
+        return true;
+    }
+    q = corner + u.x*edge0 + u.y*edge1;
+    pdf = this->pdf(p, q);
+    return pdf > 0.0f;
+}
+
+float Emitter::pdf(const glm::vec3 &p, const glm::vec3 &q) const
+{
+    if(type == PointSource) return 0.0f;
+    if(type == SphereLight)
+    {
+        glm::vec3 w = center - p;
+        float d2 = glm::dot(w, w), r2 = radius*radius;
+        if(d2 <= r2) return 0.0f;
+        float sin2 = r2/d2;
+        return (1.0f + std::sqrt(1.0f - sin2))/(2.0f*glm::pi<float>()*sin2);
+    }
+    //Area density converted to solid angle, rectangles emit from both sides
+    glm::vec3 l = q - p;
+    float d2 = glm::dot(l, l);
+    float cosLight = std::abs(glm::dot(normal, l))/std::sqrt(d2);
+    if(!(cosLight > 1e-6f)) return 0.0f;
+    return d2/(cosLight*area);
+}
+
+LightBounds Emitter::lightBounds() const
+{
+    //Spheres and point lights emit in every direction, rectangles along
+    //their normal on both sides
+    LightBounds b;
+    b.power = power;
+    if(type == RectangleLight)
+    {
+        b.bounds.expand(corner);
+        b.bounds.expand(corner + edge0);
+        b.bounds.expand(corner + edge1);
+        b.bounds.expand(corner + edge0 + edge1);
+        b.axis = normal;
+        b.cosTheta_o = 1.0f;
+        b.twoSided = true;
+    }
+    else
+    {
+        b.bounds.expand(center - glm::vec3(radius));
+        b.bounds.expand(center + glm::vec3(radius));
+    }
+    return b;
+}
+
+//Scene light sampling functions
+void Scene::buildEmitters()
+{
+    emitters.clear();
+    emitterCdf.clear();
+    emitterOf.assign(objects.size(), -1);
+    for(int i = 0; i < (int)objects.size(); ++i)
+    {
+        const Object *obj = objects[i];
+        if(!obj->mat) continue;
+        HitRecord rec = HitRecord();
+        rec.p = obj->shape->center;
+        rec.mat = obj->mat;
+        rec.object = i;
+        color Le = obj->mat->emission(rec, glm::vec3(0.0f, 1.0f, 0.0f));
+        if(Le == glm::vec3(0.0f)) continue;
+
+        Emitter e;
+        e.object = i;
+        e.Le = Le;
+        const AffineTransform &M = obj->transform;
+        if(const Sphere *sphere = dynamic_cast<const Sphere*>(obj->shape))
+        {
+            //Cone sampling needs a round sphere, scaled ones are only found by BSDF sampling
+            glm::vec3 a = M.m[0], b = M.m[1], c = M.m[2];
+            float s = glm::length(a), eps = 1e-4f*s;
+            if(std::abs(glm::length(b) - s) > eps || std::abs(glm::length(c) - s) > eps ||
+               std::abs(glm::dot(a, b)) > eps*s || std::abs(glm::dot(b, c)) > eps*s || std::abs(glm::dot(a, c)) > eps*s)
+                continue;
+            e.type = Emitter::SphereLight;
+            e.center = M.point(sphere->c);
+            e.radius = sphere->r*s;
+            e.area = 4.0f*glm::pi<float>()*e.radius*e.radius;
+            e.power = std::max(0.0f, luminance(Le))*e.area*glm::pi<float>();
+        }
+        else if(obj->shape->isRectangle)
+        {
+            //An affine transform keeps the rectangle a parallelogram, so area sampling stays uniform
+            const Rectangle *rect = static_cast<const Rectangle*>(obj->shape);
+            glm::vec3 lo = glm::vec3(std::min(rect->low.x, rect->hi.x), rect->low.y, std::min(rect->low.z, rect->hi.z));
+            e.type = Emitter::RectangleLight;
+            e.corner = M.point(lo);
+            e.edge0 = M.vector(glm::vec3(std::abs(rect->hi.x - rect->low.x), 0.0f, 0.0f));
+            e.edge1 = M.vector(glm::vec3(0.0f, 0.0f, std::abs(rect->hi.z - rect->low.z)));
+            e.normal = glm::cross(e.edge0, e.edge1);
+            e.area = glm::length(e.normal);
+            if(!(e.area > 0.0f)) continue;
+            e.normal /= e.area;
+            e.power = 2.0f*std::max(0.0f, luminance(Le))*e.area*glm::pi<float>();
+        }
+        else continue;
+        emitterOf[i] = emitters.size();
+        emitters.push_back(e);
+    }
+    for(auto const &light:lights)
+    {
+        Emitter e;
+        e.type = Emitter::PointSource;
+        e.center = light.location;
+        e.Le = light.intensity;
+        e.power = 4.0f*glm::pi<float>()*std::max(0.0f, luminance(light.intensity));
+        emitters.push_back(e);
+    }
+
+    std::vector<LightBounds> bounds(emitters.size());
+    for(int i = 0; i < (int)emitters.size(); ++i) bounds[i] = emitters[i].lightBounds();
+    lightBVH.build(bounds);
+
+    //Pick emitters by power, or uniformly if none reports any
+    float total = 0.0f;
+    for(auto const &e:emitters) total += e.power;
+    for(auto const &e:emitters)
+    {
+        float prev = emitterCdf.empty() ? 0.0f : emitterCdf.back();
+        emitterCdf.push_back(prev + (total > 0.0f ? e.power/total : 1.0f/emitters.size()));
+    }
+    if(!emitterCdf.empty()) emitterCdf.back() = 1.0f;
+}
+
+int Scene::pickEmitter(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const
+{
+    if(emitters.empty()) return -1;
+    if(pathSettings.lightTree) return lightBVH.sample(p, n, u, pmf);
+    int e = std::upper_bound(emitterCdf.begin(), emitterCdf.end(), u) - emitterCdf.begin();
+    e = std::min(e, (int)emitters.size() - 1);
+    pmf = emitterPmf(e, p, n);
+    return e;
+}
+
+float Scene::emitterPmf(int emitter, const glm::vec3 &p, const glm::vec3 &n) const
+{
+    if(pathSettings.lightTree) return lightBVH.pmf(emitter, p, n);
+    return emitterCdf[emitter] - (emitter > 0 ? emitterCdf[emitter - 1] : 0.0f);
+}
+
+bool Scene::visible(glm::vec3 p, glm::vec3 q) const
+{
+    //The direction is left unnormalized so that t in [0, 1] spans the segment.
+    //Both ends are cut short by the same absolute offset as inShadow uses, so
+    //neither p's surface nor the emitter at q blocks it, at any distance.
+    float length = glm::length(q - p);
+    float offset = 0.001f/length;
+    if(!(offset < 0.5f)) return true;
+    return !occluded(Ray(p, q - p), Interval(offset, 1.0f - offset));
+}
+
+color Scene::sampleDirectLight(const HitRecord &rec, glm::vec3 v, Sampler &sampler) const
+{
+    color Ld = glm::vec3(0.0f);
+    glm::vec3 p, q;
+    if(!sampleLightConnection(rec, v, sampler, Ld, p, q) || !visible(p, q)) return glm::vec3(0.0f);
+    return Ld;
+}
+
+bool Scene::sampleLightConnection(const HitRecord &rec, glm::vec3 v, Sampler &sampler, color &Ld,
+                                  glm::vec3 &p, glm::vec3 &q) const
+{
+    if(!pathSettings.nextEventEstimation || emitters.empty()) return false;
+    //Draw the dimensions up front so that every vertex uses the same number
+    float uLight = sampler.get1D();
+    glm::vec2 uPoint = sampler.get2D();
+    if(rec.mat->isSpecular() || rec.mat->emission(rec, v) != glm::vec3(0.0f)) return false;
+
+    float pmf = 0.0f, pdf = 0.0f;
+    int e = pickEmitter(rec.p, rec.n, uLight, pmf);
+    if(e < 0 || emitters[e].object == rec.object || !(pmf > 0.0f)) return false;
+    if(!emitters[e].sample(rec.p, uPoint, q, pdf)) return false;
+    glm::vec3 l = glm::normalize(q - rec.p);
+    float cos_theta_i = glm::dot(rec.n, l);
+    if(cos_theta_i <= 0.0f) return false;
+    p = rec.p + 0.001f*rec.n;
+    if(emitters[e].isDelta())
+    {
+        //Point lights cannot be hit by BSDF samples, no MIS
+        float r_square = glm::dot(q - rec.p, q - rec.p);
+        Ld = emitters[e].Le*rec.mat->brdf(rec, l, v)*cos_theta_i/(r_square*pmf);
+        return true;
+    }
+
+    float lightPdf = pmf*pdf;
+    float weight = powerHeuristic(lightPdf, rec.mat->pdf(rec, l, v));
+    Ld = emitters[e].Le*rec.mat->brdf(rec, l, v)*cos_theta_i*(weight/lightPdf);
+    return true;
+}
+
+float Scene::emissionWeight(const PathVertex &from, const HitRecord &rec) const
+{
+    if(!pathSettings.nextEventEstimation || from.bsdfPdf <= 0.0f) return 1.0f;
+    if(rec.object < 0 || rec.object >= (int)emitterOf.size() || emitterOf[rec.object] < 0) return 1.0f;
+    int e = emitterOf[rec.object];
+    float lightPdf = emitterPmf(e, from.p, from.n)*emitters[e].pdf(from.p, rec.p);
+    return powerHeuristic(from.bsdfPdf, lightPdf);
+}
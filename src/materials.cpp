@@ -6,12 +6,16 @@ color Lambertian::brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const
     // std::cout << "albedo: " << to_string(albedo) << std::endl;
     return (albedo/glm::pi<float>());
 }
-bool Lambertian::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const
+bool Lambertian::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const
 {
     kr = glm::vec3(0.0f);
-    r = sampleCosineHemisphere(rec.n);
+    r = sampleCosineHemisphere(rec.n, sampler);
     return false;
 }
+float Lambertian::pdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const
+{
+    return cosineHemispherePDF(rec.n, l);
+}
 
 color Metallic::brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const
 {
@@ -23,7 +27,7 @@ color Metallic::brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const
     return (albedo * cos_theta) / glm::pi<float>();
 }
 
-bool Metallic::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const
+bool Metallic::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const
 {
     // std::cout<<"called"<<std::endl;
     float cos_theta = glm::dot(rec.n, glm::normalize(v));
@@ -40,7 +44,7 @@ bool Metallic::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color
     // std::cout<<"successful ref "<<to_string(r)<<std::endl;
     return true;
 }
-bool Emissive::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const
+bool Emissive::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const
 {
     kr = glm::vec3(0.0f);
     return false;
@@ -50,12 +54,6 @@ color Emissive::emission(const HitRecord &rec, glm::vec3 v) const
     return emittedRadiance;
 }
 
-float randf() {
-    static thread_local std::mt19937 gen(std::random_device{}());
-    static thread_local std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    return dist(gen);
-}
-
 float GGX_PDF(const glm::vec3& n, const glm::vec3& h, glm::vec3& v, float alpha) {
     float NdotH = glm::max(glm::dot(n, h), 0.0f);
     float D = (alpha * alpha) / 
@@ -64,7 +62,7 @@ float GGX_PDF(const glm::vec3& n, const glm::vec3& h, glm::vec3& v, float alpha)
     return D * NdotH / (4.0f * glm::dot(h, v));
 }
 
-glm::vec3 sampleGGXVNDF(const glm::vec3& n, const glm::vec3& v, float roughness) {
+glm::vec3 sampleGGXVNDF(const glm::vec3& n, const glm::vec3& v, float roughness, Sampler &sampler) {
     float alpha = roughness * roughness;
 
     // Transform view direction to hemisphere space (aligned with z-axis)
@@ -73,8 +71,9 @@ glm::vec3 sampleGGXVNDF(const glm::vec3& n, const glm::vec3& v, float roughness)
     glm::vec3 tangentY = glm::cross(n, tangentX);
 
     // Random numbers
-    float xi1 = randf();  // Uniform [0, 1)
-    float xi2 = randf();
+    glm::vec2 xi = sampler.get2D();  // Uniform [0, 1)^2
+    float xi1 = xi.x;
+    float xi2 = xi.y;
 
     // GGX sampling
     float theta = std::atan(alpha * std::sqrt(xi1) / std::sqrt(1.0f - xi1));
@@ -90,7 +89,7 @@ glm::vec3 sampleGGXVNDF(const glm::vec3& n, const glm::vec3& v, float roughness)
     );
     return h;
 }
-bool TorrenceSparrow::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const
+bool TorrenceSparrow::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const
 {
     // std::cout<<"called"<<std::endl;
     float cos_theta = glm::dot(rec.n, glm::normalize(v));
@@ -99,7 +98,7 @@ bool TorrenceSparrow::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r
     glm::vec3 d = glm::normalize(-1.0f * v);
     r = glm::normalize(d - 2.0f * glm::dot(rec.n, d) * rec.n);
 
-    glm::vec3 h = sampleGGXVNDF(rec.n, v, roughness);
+    glm::vec3 h = sampleGGXVNDF(rec.n, v, roughness, sampler);
     float pdf = GGX_PDF(rec.n, h, v, roughness);
     r = glm::reflect(d,h)/pdf;
     std::cout<<to_string(r)<<std::endl;
@@ -116,7 +115,6 @@ bool TorrenceSparrow::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r
 
 color TorrenceSparrow::brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const
 {
-    glm::vec3 n = rec.n;
     glm::vec3 h = glm::normalize(glm::normalize(l) + glm::normalize(v)); // Halfway vector
 
     //Obtain the ggx function
@@ -150,7 +148,7 @@ color EmissiveRectangle::emission(const HitRecord &rec, glm::vec3 v) const
 {   
     return emittedRadiance;
 }
-bool EmissiveRectangle::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const
+bool EmissiveRectangle::reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const
 {
     kr = glm::vec3(0.0f);
     return false;
@@ -0,0 +1,600 @@
+#include "mesh.hpp"
+#include "tokens.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+//TriangleMesh functions
+TriangleMesh::WatertightRay::WatertightRay(const Ray &ray): o(ray.o)
+{
+    glm::vec3 a = glm::abs(ray.d);
+    kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    //Keeps the winding, and with it the sign of the edge functions
+    if(ray.d[kz] < 0.0f) std::swap(kx, ky);
+    sx = ray.d[kx]/ray.d[kz];
+    sy = ray.d[ky]/ray.d[kz];
+    sz = 1.0f/ray.d[kz];
+}
+
+bool TriangleMesh::intersect(const WatertightRay &ray, int tri, float tmin, float tmax, float &t, float &b1, float &b2) const
+{
+    const glm::vec3 A = positions[indices[3*tri]] - ray.o;
+    const glm::vec3 B = positions[indices[3*tri + 1]] - ray.o;
+    const glm::vec3 C = positions[indices[3*tri + 2]] - ray.o;
+    //Vertices in the sheared space where the ray is the z axis
+    float ax = A[ray.kx] - ray.sx*A[ray.kz], ay = A[ray.ky] - ray.sy*A[ray.kz];
+    float bx = B[ray.kx] - ray.sx*B[ray.kz], by = B[ray.ky] - ray.sy*B[ray.kz];
+    float cx = C[ray.kx] - ray.sx*C[ray.kz], cy = C[ray.ky] - ray.sy*C[ray.kz];
+    //Edge functions, each depends only on the two vertices of its edge
+    float u = cx*by - cy*bx;
+    float v = ax*cy - ay*cx;
+    float w = bx*ay - by*ax;
+    if(u == 0.0f || v == 0.0f || w == 0.0f)
+    {
+        //On an edge in single precision, decide it in double
+        u = (float)((double)cx*by - (double)cy*bx);
+        v = (float)((double)ax*cy - (double)ay*cx);
+        w = (float)((double)bx*ay - (double)by*ax);
+    }
+    if((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return false;
+    float det = u + v + w;
+    if(det == 0.0f) return false;
+    float az = ray.sz*A[ray.kz], bz = ray.sz*B[ray.kz], cz = ray.sz*C[ray.kz];
+    float inverse = 1.0f/det;
+    t = (u*az + v*bz + w*cz)*inverse;
+    if(!(t >= tmin && t <= tmax)) return false;
+    b1 = v*inverse;
+    b2 = w*inverse;
+    return true;
+}
+
+bool TriangleMesh::hit(const Ray &ray, Interval t_range, HitRecord &rec) const
+{
+    WatertightRay sheared(ray);
+    int best = -1;
+    float bestT = 0.0f, bestB1 = 0.0f, bestB2 = 0.0f;
+    traverse(ray, t_range, [&](int tri, float &tmax) {
+        float t, b1, b2;
+        if(intersect(sheared, tri, t_range.min, tmax, t, b1, b2))
+        {
+            tmax = t;
+            best = tri;
+            bestT = t;
+            bestB1 = b1;
+            bestB2 = b2;
+        }
+        return false;
+    });
+    if(best < 0) return false;
+    const int *corner = &indices[3*best];
+    const glm::vec3 &v0 = positions[corner[0]], &v1 = positions[corner[1]], &v2 = positions[corner[2]];
+    float b0 = 1.0f - bestB1 - bestB2;
+    rec.t = bestT;
+    rec.p = b0*v0 + bestB1*v1 + bestB2*v2;
+    glm::vec3 geometric = glm::cross(v1 - v0, v2 - v0);
+    if(glm::dot(geometric, ray.d) > 0.0f) geometric = -geometric;
+    glm::vec3 n = geometric;
+    if(!normalIndices.empty())
+    {
+        const int *normal = &normalIndices[3*best];
+        if(normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0)
+        {
+            glm::vec3 interpolated = b0*normals[normal[0]] + bestB1*normals[normal[1]] + bestB2*normals[normal[2]];
+            if(glm::dot(interpolated, interpolated) > 0.0f)
+            {
+                //The same side as the geometric normal the ray sees
+                n = glm::dot(interpolated, geometric) < 0.0f ? -interpolated : interpolated;
+            }
+        }
+    }
+    rec.n = glm::normalize(n);
+    return true;
+}
+
+bool TriangleMesh::occluded(const Ray &ray, Interval t_range) const
+{
+    WatertightRay sheared(ray);
+    bool found = false;
+    traverse(ray, t_range, [&](int tri, float &tmax) {
+        float t, b1, b2;
+        found = intersect(sheared, tri, t_range.min, tmax, t, b1, b2);
+        return found;
+    });
+    return found;
+}
+
+float TriangleMesh::intersectionCost() const
+{
+    //Roughly the nodes visited on the way down the mesh BVH
+    return 2.0f + std::log2((float)std::max<size_t>(1, triangleCount()));
+}
+
+void TriangleMesh::build()
+{
+    box = AABB();
+    for(const glm::vec3 &p: positions) box.expand(p);
+    center = box.centroid();
+    glm::vec3 extentPad = 1e-7f*(box.hi - box.lo);
+    std::vector<AABB> triangleBounds(triangleCount());
+    for(size_t tri = 0; tri < triangleBounds.size(); ++tri)
+    {
+        AABB b;
+        for(int k = 0; k < 3; ++k) b.expand(positions[indices[3*tri + k]]);
+        //Pad slightly so rounding in the slab test never culls an edge hit
+        glm::vec3 pad = 1e-6f*(glm::abs(b.lo) + glm::abs(b.hi)) + extentPad;
+        b.lo -= pad;
+        b.hi += pad;
+        triangleBounds[tri] = b;
+    }
+    bvh.build(triangleBounds);
+    //The costs only guide the build, every triangle costs the same
+    bvh.costs = std::vector<float>();
+    mbvh = MBVH();
+    if(bvh.options.width == 4) mbvh.build(bvh);
+}
+
+size_t TriangleMesh::memoryBytes() const
+{
+    return positions.capacity()*sizeof(glm::vec3) + normals.capacity()*sizeof(glm::vec3) +
+           indices.capacity()*sizeof(int) + normalIndices.capacity()*sizeof(int) +
+           bvh.nodes.size()*sizeof(BVH::Node) + (bvh.indices.size() + bvh.unbounded.size())*sizeof(int) +
+           mbvh.nodes.size()*sizeof(MBVH::Node);
+}
+
+void TriangleMesh::addTriangle(const int *corners, const int *normalCorners)
+{
+    bool withNormals = normalCorners[0] >= 0 || normalCorners[1] >= 0 || normalCorners[2] >= 0;
+    if(withNormals || !normalIndices.empty())
+    {
+        //Triangles read before the first normal get none
+        normalIndices.resize(indices.size(), -1);
+        normalIndices.insert(normalIndices.end(), normalCorners, normalCorners + 3);
+    }
+    indices.insert(indices.end(), corners, corners + 3);
+}
+
+bool TriangleMesh::load(const std::string &path, std::string &error)
+{
+    size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    for(char &c: extension) c = (char)std::tolower((unsigned char)c);
+    bool ok;
+    if(extension == "obj") ok = loadOBJ(path, error);
+    else if(extension == "ply") ok = loadPLY(path, error);
+    else
+    {
+        error = path + ": not an .obj or .ply file";
+        return false;
+    }
+    if(ok) build();
+    return ok;
+}
+
+//Sizes of the buffers before a load, to undo a failed one
+class MeshSizes {
+public:
+    size_t positions, normals, indices, normalIndices;
+    MeshSizes(const TriangleMesh &mesh):
+        positions(mesh.positions.size()),
+        normals(mesh.normals.size()),
+        indices(mesh.indices.size()),
+        normalIndices(mesh.normalIndices.size()) {
+    }
+    //Checks the indices added since, or restores the sizes if ok is false
+    bool finish(TriangleMesh &mesh, bool ok, std::string &error) const {
+        for(size_t k = indices; ok && k < mesh.indices.size(); ++k)
+        {
+            if(mesh.indices[k] < 0 || mesh.indices[k] >= (int)mesh.positions.size())
+            {
+                error = "vertex index out of range";
+                ok = false;
+            }
+        }
+        for(size_t k = normalIndices; ok && k < mesh.normalIndices.size(); ++k)
+        {
+            if(mesh.normalIndices[k] < -1 || mesh.normalIndices[k] >= (int)mesh.normals.size())
+            {
+                error = "normal index out of range";
+                ok = false;
+            }
+        }
+        if(ok) return true;
+        mesh.positions.resize(positions);
+        mesh.normals.resize(normals);
+        mesh.indices.resize(indices);
+        mesh.normalIndices.resize(normalIndices);
+        return false;
+    }
+};
+
+//OBJ indices count from 1, negative ones from the end
+static bool objIndex(const char *b, const char *e, size_t count, int &index)
+{
+    int value;
+    if(!Tokens::parseInteger(b, e, value) || value == 0) return false;
+    index = value > 0 ? value - 1 : (int)count + value;
+    return true;
+}
+
+bool TriangleMesh::loadOBJ(const std::string &path, std::string &error)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if(!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    MeshSizes before(*this);
+    long line = 0;
+    const char *message = nullptr;
+    std::vector<int> face, faceNormals;
+    LineReader::Status status = LineReader::read(file, [&](char *begin, char *end) {
+        line++;
+        Tokens tokens(begin, end);
+        if(!tokens.next()) return true;
+        if(tokens.is("v") || tokens.is("vn"))
+        {
+            //Anything after x y z, such as w or a vertex color, is ignored
+            bool vertex = tokens.is("v");
+            glm::vec3 p;
+            if(!tokens.vec3(p))
+            {
+                message = "bad vertex";
+                return false;
+            }
+            (vertex ? positions : normals).push_back(p);
+        }
+        else if(tokens.is("f"))
+        {
+            //Corners are v, v/vt, v//vn or v/vt/vn, polygons become fans
+            face.clear();
+            faceNormals.clear();
+            while(tokens.next())
+            {
+                const char *slash = static_cast<const char*>(std::memchr(tokens.b, '/', tokens.e - tokens.b));
+                const char *positionEnd = slash ? slash : tokens.e;
+                int position, normal = -1;
+                bool ok = objIndex(tokens.b, positionEnd, positions.size() - before.positions, position);
+                const char *second = slash ? static_cast<const char*>(std::memchr(slash + 1, '/', tokens.e - slash - 1)) : nullptr;
+                if(ok && second && second + 1 < tokens.e) ok = objIndex(second + 1, tokens.e, normals.size() - before.normals, normal);
+                if(!ok)
+                {
+                    message = "bad face";
+                    return false;
+                }
+                face.push_back((int)before.positions + position);
+                faceNormals.push_back(normal < 0 ? -1 : (int)before.normals + normal);
+            }
+            if(face.size() < 3)
+            {
+                message = "face with less than three vertices";
+                return false;
+            }
+            for(size_t k = 1; k + 1 < face.size(); ++k)
+            {
+                int corners[3] = {face[0], face[k], face[k + 1]};
+                int normalCorners[3] = {faceNormals[0], faceNormals[k], faceNormals[k + 1]};
+                addTriangle(corners, normalCorners);
+            }
+        }
+        //Texture coordinates, groups, materials, lines and points are skipped
+        return true;
+    });
+    bool ok = status == LineReader::Done;
+    if(status == LineReader::Stopped) error = path + ": line " + std::to_string(line) + ": " + message;
+    else if(status == LineReader::LineTooLong) error = path + ": line " + std::to_string(line + 1) + ": line too long";
+    else if(status == LineReader::ReadError) error = "cannot read " + path;
+    std::fclose(file);
+    if(!before.finish(*this, ok, error))
+    {
+        if(ok) error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+//Binary file read through a buffer of fixed size
+class ByteReader {
+public:
+    static const size_t chunk = 1 << 20;
+    ByteReader(FILE *file): file(file), buffer(chunk) {}
+    //Makes the next n <= chunk bytes available to take()
+    bool need(size_t n) {
+        if(filled - pos >= n) return true;
+        if(n > chunk) return false;
+        std::memmove(buffer.data(), buffer.data() + pos, filled - pos);
+        filled -= pos;
+        pos = 0;
+        while(filled < n)
+        {
+            size_t got = std::fread(buffer.data() + filled, 1, chunk - filled, file);
+            if(got == 0) return false;
+            filled += got;
+        }
+        return true;
+    }
+    const char *take(size_t n) {
+        const char *p = buffer.data() + pos;
+        pos += n;
+        return p;
+    }
+    //The next line without its newline, for the text header
+    bool line(std::vector<char> &out) {
+        out.clear();
+        while(true)
+        {
+            if(!need(1)) return false;
+            char c = *take(1);
+            if(c == '\n') break;
+            out.push_back(c);
+            if(out.size() > 4096) return false;
+        }
+        out.push_back('\0');    //writable byte after the line for Tokens
+        return true;
+    }
+
+private:
+    FILE *file;
+    std::vector<char> buffer;
+    size_t pos = 0, filled = 0;
+};
+
+class PLYProperty {
+public:
+    enum Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, None };
+    std::string name;
+    Type type = None;
+    Type countType = None;  //of a list, None for a scalar
+    static int size(Type t) {
+        static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8, 0};
+        return sizes[t];
+    }
+    static Type parseType(const Tokens &tokens) {
+        static const char *names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                                         {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+        for(int t = 0; t < None; ++t)
+        {
+            if(tokens.is(names[t][0]) || tokens.is(names[t][1])) return (Type)t;
+        }
+        return None;
+    }
+    static double value(const char *p, Type t, bool swap) {
+        unsigned char bytes[8];
+        int n = size(t);
+        for(int k = 0; k < n; ++k) bytes[k] = (unsigned char)p[swap ? n - 1 - k : k];
+        switch(t)
+        {
+            case Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+            case UInt8: return bytes[0];
+            case Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+            case UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+            case Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+            case UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+            case Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+            case Float64: { double v; std::memcpy(&v, bytes, 8); return v; }
+            default: return 0.0;
+        }
+    }
+};
+
+class PLYElement {
+public:
+    std::string name;
+    long count = 0;
+    std::vector<PLYProperty> properties;
+    int find(const char *property) const {
+        for(size_t k = 0; k < properties.size(); ++k)
+        {
+            if(properties[k].name == property) return (int)k;
+        }
+        return -1;
+    }
+};
+
+bool TriangleMesh::loadPLY(const std::string &path, std::string &error)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if(!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    MeshSizes before(*this);
+    //Bounds the element counts of the header when reserving
+    std::fseek(file, 0, SEEK_END);
+    long fileBytes = std::max(0L, std::ftell(file));
+    std::rewind(file);
+    ByteReader reader(file);
+    std::vector<char> text;
+    std::vector<PLYElement> elements;
+    bool ok = reader.line(text) && std::strncmp(text.data(), "ply", 3) == 0;
+    bool swap = false, formatSeen = false;
+    const char *message = ok ? nullptr : "not a PLY file";
+    const uint16_t one = 1;
+    bool littleEndian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+    while(ok)
+    {
+        if(!reader.line(text))
+        {
+            ok = false;
+            message = "bad header";
+            break;
+        }
+        Tokens tokens(text.data(), text.data() + text.size() - 1);
+        if(!tokens.next() || tokens.is("comment") || tokens.is("obj_info")) continue;
+        if(tokens.is("end_header")) break;
+        if(tokens.is("format"))
+        {
+            ok = tokens.next();
+            if(ok && (tokens.is("binary_little_endian") || tokens.is("binary_big_endian"))) swap = tokens.is("binary_little_endian") != littleEndian;
+            else if(ok && tokens.is("ascii")) message = "ascii PLY is not supported, only binary";
+            else message = "unknown format";
+            ok = message == nullptr;
+            formatSeen = true;
+        }
+        else if(tokens.is("element"))
+        {
+            PLYElement element;
+            int count = 0;
+            ok = tokens.next();
+            if(ok)
+            {
+                element.name.assign(tokens.b, tokens.e - tokens.b);
+                ok = tokens.integer(count) && count >= 0;
+            }
+            element.count = count;
+            elements.push_back(element);
+            if(!ok) message = "bad element";
+        }
+        else if(tokens.is("property") && !elements.empty())
+        {
+            PLYProperty property;
+            ok = tokens.next();
+            if(ok && tokens.is("list"))
+            {
+                ok = tokens.next() && (property.countType = PLYProperty::parseType(tokens)) != PLYProperty::None &&
+                     property.countType != PLYProperty::Float32 && property.countType != PLYProperty::Float64 && tokens.next();
+            }
+            ok = ok && (property.type = PLYProperty::parseType(tokens)) != PLYProperty::None && tokens.next();
+            if(ok) property.name.assign(tokens.b, tokens.e - tokens.b);
+            elements.back().properties.push_back(property);
+            if(!ok) message = "bad property";
+        }
+        else
+        {
+            ok = false;
+            message = "bad header";
+        }
+    }
+    if(ok && !formatSeen)
+    {
+        ok = false;
+        message = "missing format";
+    }
+
+    std::vector<int> face;
+    for(size_t e = 0; ok && e < elements.size(); ++e)
+    {
+        const PLYElement &element = elements[e];
+        bool vertices = element.name == "vertex", faces = element.name == "face";
+        int coordinate[6] = {element.find("x"), element.find("y"), element.find("z"),
+                             element.find("nx"), element.find("ny"), element.find("nz")};
+        int faceIndices = std::max(element.find("vertex_indices"), element.find("vertex_index"));
+        if(vertices && (coordinate[0] < 0 || coordinate[1] < 0 || coordinate[2] < 0))
+        {
+            ok = false;
+            message = "vertex without x y z";
+            break;
+        }
+        if(faces && (faceIndices < 0 || element.properties[faceIndices].countType == PLYProperty::None))
+        {
+            ok = false;
+            message = "face without a vertex_indices list";
+            break;
+        }
+        bool withNormals = vertices && coordinate[3] >= 0 && coordinate[4] >= 0 && coordinate[5] >= 0;
+        //Fixed size records are read whole, others property by property
+        int recordSize = 0;
+        std::vector<int> offsets;
+        for(const PLYProperty &property: element.properties)
+        {
+            offsets.push_back(recordSize);
+            if(property.countType != PLYProperty::None) recordSize = -1;
+            if(recordSize >= 0) recordSize += PLYProperty::size(property.type);
+        }
+        if(vertices)
+        {
+            //No more records than the file can hold, whatever the header says
+            size_t count = std::min<long>(element.count, fileBytes/std::max(1, recordSize));
+            positions.reserve(positions.size() + count);
+            if(withNormals) normals.reserve(normals.size() + count);
+        }
+        double values[6];
+        for(long item = 0; ok && item < element.count; ++item)
+        {
+            if(recordSize >= 0)
+            {
+                if(!(ok = reader.need(recordSize))) break;
+                const char *record = reader.take(recordSize);
+                if(vertices)
+                {
+                    for(int k = 0; k < (withNormals ? 6 : 3); ++k)
+                    {
+                        values[k] = PLYProperty::value(record + offsets[coordinate[k]], element.properties[coordinate[k]].type, swap);
+                    }
+                }
+            }
+            else
+            {
+                face.clear();
+                for(size_t k = 0; ok && k < element.properties.size(); ++k)
+                {
+                    const PLYProperty &property = element.properties[k];
+                    int size = PLYProperty::size(property.type);
+                    long count = 1;
+                    if(property.countType != PLYProperty::None)
+                    {
+                        if(!(ok = reader.need(PLYProperty::size(property.countType)))) break;
+                        count = (long)PLYProperty::value(reader.take(PLYProperty::size(property.countType)), property.countType, swap);
+                    }
+                    if(!(ok = count >= 0 && reader.need(count*size))) break;
+                    const char *p = reader.take(count*size);
+                    for(long c = 0; (int)k == faceIndices && c < count; ++c)
+                    {
+                        face.push_back((int)PLYProperty::value(p + c*size, property.type, swap));
+                    }
+                    for(int c = 0; vertices && c < 6; ++c)
+                    {
+                        if(coordinate[c] == (int)k) values[c] = PLYProperty::value(p, property.type, swap);
+                    }
+                }
+                if(!ok) break;
+            }
+            if(vertices)
+            {
+                positions.push_back(glm::vec3((float)values[0], (float)values[1], (float)values[2]));
+                if(withNormals) normals.push_back(glm::vec3((float)values[3], (float)values[4], (float)values[5]));
+            }
+            else if(faces)
+            {
+                if(face.size() < 3)
+                {
+                    ok = false;
+                    message = "face with less than three vertices";
+                    break;
+                }
+                for(size_t k = 1; k + 1 < face.size(); ++k)
+                {
+                    int corners[3] = {(int)before.positions + face[0], (int)before.positions + face[k], (int)before.positions + face[k + 1]};
+                    int normalCorners[3] = {-1, -1, -1};
+                    //Normals are per vertex, stored in the same order as the vertices
+                    if(normals.size() - before.normals == positions.size() - before.positions)
+                    {
+                        for(int c = 0; c < 3; ++c) normalCorners[c] = corners[c] - (int)before.positions + (int)before.normals;
+                    }
+                    addTriangle(corners, normalCorners);
+                }
+            }
+        }
+        if(!ok && !message) message = "file ends early";
+    }
+    std::fclose(file);
+    if(!ok)
+    {
+        error = path + ": " + message;
+        before.finish(*this, false, error);
+        return false;
+    }
+    if(!before.finish(*this, true, error))
+    {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
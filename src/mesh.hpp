@@ -0,0 +1,75 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "scene.hpp"
+
+#include <string>
+
+//Indexed triangles: the triangles share one vertex and one normal buffer and
+//refer to them by index, with a BVH of their own over the triangles. The
+//BVH is traversed in object space, so a mesh is a single primitive of the
+//scene and many objects may reference the same mesh.
+class TriangleMesh: public Shape {
+public:
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;     //may be empty, the geometric normal is used then
+    std::vector<int> indices;           //three positions per triangle, counter-clockwise
+    std::vector<int> normalIndices;     //three normals per triangle, or empty. -1 for none
+    BVH bvh;
+    MBVH mbvh;                          //built too if bvh.options.width is 4, traversed instead
+
+    //Ray prepared for the watertight test of Woop, Benthin and Wald,
+    //"Watertight Ray/Triangle Intersection" (JCGT 2013): the axes are
+    //permuted so that kz is the largest direction component, and the shear
+    //(sx, sy, sz) maps the direction to the unit z axis. Edges shared by
+    //two triangles are then evaluated bit for bit the same for both, a ray
+    //cannot pass between them.
+    struct WatertightRay {
+        glm::vec3 o;
+        int kx, ky, kz;
+        float sx, sy, sz;
+        WatertightRay(const Ray &ray);
+    };
+
+    TriangleMesh() {
+        //Larger leaves: a third fewer nodes than a traversal cost of 1, at
+        //the same speed
+        bvh.options.traversalCost = 2.0f;
+    }
+    size_t triangleCount() const { return indices.size()/3; }
+    //Builds the BVH and the bounds, after the buffers are filled
+    void build();
+    //Reads an OBJ or binary PLY file, by its extension, and builds the mesh
+    bool load(const std::string &path, std::string &error);
+    //Streaming readers: the file goes through a buffer of fixed size and only
+    //the vertices, normals and triangles are kept. They append to the buffers.
+    bool loadOBJ(const std::string &path, std::string &error);
+    bool loadPLY(const std::string &path, std::string &error);
+    //Bytes of the buffers and the BVH
+    size_t memoryBytes() const;
+
+    //Hit of triangle tri within [tmin, tmax], with its barycentric
+    //coordinates: the hit point is b0*v0 + b1*v1 + b2*v2, b0 = 1-b1-b2
+    bool intersect(const WatertightRay &ray, int tri, float tmin, float tmax, float &t, float &b1, float &b2) const;
+    //Calls visit(triangle, tmax) like BVH::traverse
+    template<typename F>
+    void traverse(const Ray &ray, Interval t_range, F &&visit) const;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const override;
+    bool occluded(const Ray &ray, Interval t_range) const override;
+    AABB bounds() const override { return box; }
+    float intersectionCost() const override;
+
+private:
+    AABB box;
+    //Appends a triangle, normalCorners are -1 where it has no normal
+    void addTriangle(const int *corners, const int *normalCorners);
+};
+
+template<typename F>
+void TriangleMesh::traverse(const Ray &ray, Interval t_range, F &&visit) const
+{
+    if(mbvh.empty()) bvh.traverse(ray, t_range, visit);
+    else mbvh.traverse(bvh, ray, t_range, visit);
+}
+
+#endif
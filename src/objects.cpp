@@ -1,42 +1,92 @@
 #include "scene.hpp"
+//Affine transform functions
+AffineTransform::AffineTransform(const glm::mat4 &M)
+{
+    for(int i = 0; i < 4; ++i) m[i] = glm::vec3(M[i]);
+    identity = (M == glm::mat4(1.0f));
+}
+
+glm::mat4 AffineTransform::toMat4() const
+{
+    return glm::mat4(glm::vec4(m[0], 0.0f), glm::vec4(m[1], 0.0f), glm::vec4(m[2], 0.0f), glm::vec4(m[3], 1.0f));
+}
+
 //Object functions
 void Object::setTransform(glm::mat4 M)
 {
     glm::mat4 N = glm::translate(glm::mat4(1.0f), shape->center);
-    transform = N * M * glm::inverse(N);
-    normalTransform = glm::inverseTranspose(transform);
-    inverse = glm::inverse(transform);
+    glm::mat4 T = N * M * glm::inverse(N);
+    transform = AffineTransform(T);
+    normalTransform = AffineTransform(glm::inverseTranspose(T));
+    inverse = AffineTransform(glm::inverse(T));
 }
 
-bool Object::hit(Ray ray, Interval t_range, HitRecord &rec) const
+bool Object::hit(const Ray &ray, Interval t_range, HitRecord &rec) const
 {
-    glm::vec3 new_direction = glm::vec3(inverse * glm::vec4(ray.d, 0.0f));
-    new_direction = glm::normalize(new_direction);
-    Ray transformed_ray = Ray(glm::vec3(inverse * glm::vec4(ray.o, 1.0f)), new_direction);
-    // transformed_ray.debugRay();
-    if(shape->hit(transformed_ray, t_range, rec, transform, inverse, normalTransform))
+    if(transform.identity)
     {
-        rec.p = glm::vec3(transform * glm::vec4(rec.p, 1.0f));
-        rec.n = glm::normalize(glm::vec3(normalTransform * glm::vec4(rec.n, 0.0f)));
+        if(!shape->hit(ray, t_range, rec)) return false;
+        rec.mat=mat;
+        return true;
+    }
+    //The direction is deliberately not renormalized so that t is the same in
+    //object and world space, which keeps t_range and the BVH bounds consistent
+    Ray transformed_ray = Ray(inverse.point(ray.o), inverse.vector(ray.d));
+    if(shape->hit(transformed_ray, t_range, rec))
+    {
+        rec.p = transform.point(rec.p);
+        rec.n = glm::normalize(normalTransform.vector(rec.n));
         rec.mat=mat;
         return true;
     }
     else return false;
 }
 
+bool Object::occluded(const Ray &ray, Interval t_range) const
+{
+    //Same object space ray as hit(), but nothing is transformed back
+    if(transform.identity) return shape->occluded(ray, t_range);
+    return shape->occluded(Ray(inverse.point(ray.o), inverse.vector(ray.d)), t_range);
+}
+
+AABB Object::worldBounds() const
+{
+    AABB local = shape->bounds();
+    if(!local.isFinite()) return local;
+    AABB world;
+    for(int i = 0; i < 8; ++i)
+    {
+        glm::vec3 corner = glm::vec3(i & 1 ? local.hi.x : local.lo.x,
+                                     i & 2 ? local.hi.y : local.lo.y,
+                                     i & 4 ? local.hi.z : local.lo.z);
+        world.expand(transform.point(corner));
+    }
+    //Pad slightly so flat shapes and rounding in the slab test never cull a hit
+    glm::vec3 pad = 1e-4f * (world.hi - world.lo) + glm::vec3(1e-4f);
+    world.lo -= pad;
+    world.hi += pad;
+    return world;
+}
+
 void Object::debugTransform()
 {
-    std::cout<<"Transform: "<<glm::to_string(transform)<<std::endl;
-    std::cout<<"Normal Transform: "<<glm::to_string(normalTransform)<<std::endl;
-    std::cout<<"Inverse: "<<glm::to_string(inverse)<<std::endl;
+    std::cout<<"Transform: "<<glm::to_string(transform.toMat4())<<std::endl;
+    std::cout<<"Normal Transform: "<<glm::to_string(normalTransform.toMat4())<<std::endl;
+    std::cout<<"Inverse: "<<glm::to_string(inverse.toMat4())<<std::endl;
 }
 
 
 //HitRecord functions
-HitRecord::HitRecord(): t(std::numeric_limits<float>::max()), p(glm::vec3(0)), n(glm::vec3(0)), mat(nullptr) {};
+HitRecord::HitRecord(): t(std::numeric_limits<float>::max()), p(glm::vec3(0)), n(glm::vec3(0)), mat(nullptr), object(-1) {};
+
+bool Shape::occluded(const Ray &ray, Interval t_range) const
+{
+    HitRecord rec = HitRecord();
+    return hit(ray, t_range, rec);
+}
 
 //Hit functions
-bool Sphere::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const
+bool Sphere::hit(const Ray &ray, Interval t_range, HitRecord &rec) const
 {
     // std::cout<<to_string(ray.o)<<" "<<to_string(ray.d)<<std::endl;
     glm::vec3 object_space_c = glm::vec3(glm::vec4(this->c, 1.0f));
@@ -66,7 +116,6 @@ bool Sphere::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::m
         rec.p = ray.at(t2);
         rec.n = glm::normalize(rec.p - object_space_c);
         // rec.mat = mat;
-        float cos_theta = glm::dot(rec.n, ray.o - rec.p);
         t_range.max = t2; // Update the t_range to reflect the hit
         // std::cout<<"hit recv"<<std::endl;
         return true;
@@ -74,9 +123,30 @@ bool Sphere::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::m
     else return false;
 }
 
-bool Plane::hit(Ray ray, Interval t_range, HitRecord &rec,glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const 
+bool Sphere::occluded(const Ray &ray, Interval t_range) const
 {
-    glm::vec3 os_point = glm::vec3(itf * glm::vec4(point, 1.0f));
+    glm::vec3 oc = ray.o - c;
+    float qa = glm::dot(ray.d, ray.d);
+    float qb = 2.0f * glm::dot(ray.d, oc);
+    float qc = glm::dot(oc, oc) - r * r;
+    float discriminant = qb * qb - 4 * qa * qc;
+    if (discriminant < 0)
+        return false;
+    float root = sqrt(discriminant);
+    float t1 = (-qb - root) / (2 * qa);
+    float t2 = (-qb + root) / (2 * qa);
+    return (t_range.contains(t1) && t1 > 0) || (t_range.contains(t2) && t2 > 0);
+}
+
+AABB Sphere::bounds() const
+{
+    return AABB(c - glm::vec3(r), c + glm::vec3(r));
+}
+
+bool Plane::hit(const Ray &ray, Interval t_range, HitRecord &rec) const 
+{
+    //point is already in object space
+    glm::vec3 os_point = point;
     float dnr = glm::dot(normal, ray.d);
     if(dnr == 0) 
         return false;
@@ -91,8 +161,16 @@ bool Plane::hit(Ray ray, Interval t_range, HitRecord &rec,glm::mat4 tf, glm::mat
     return true;
 }
 
+bool Plane::occluded(const Ray &ray, Interval t_range) const
+{
+    float dnr = glm::dot(normal, ray.d);
+    if(dnr == 0)
+        return false;
+    float t = glm::dot(normal, point - ray.o) / dnr;
+    return t >= 0 && t_range.contains(t);
+}
 
-bool Box::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const 
+bool Box::hit(const Ray &ray, Interval t_range, HitRecord &rec) const 
 {
     glm::vec3 tlow = glm::vec3(glm::vec4(low, 1.0f));
     glm::vec3 thi = glm::vec3(glm::vec4(hi, 1.0f));
@@ -142,7 +220,22 @@ bool Box::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4
     return true;
 }
 
-bool Rectangle::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const
+bool Box::occluded(const Ray &ray, Interval t_range) const
+{
+    glm::vec3 t0 = (low - ray.o) / ray.d;
+    glm::vec3 t1 = (hi - ray.o) / ray.d;
+    glm::vec3 tnear = glm::min(t0, t1), tfar = glm::max(t0, t1);
+    float tmin = std::max(tnear.x, std::max(tnear.y, tnear.z));
+    float tmax = std::min(tfar.x, std::min(tfar.y, tfar.z));
+    return tmax >= 0 && tmin <= tmax && tmin >= 0 && t_range.contains(tmin);
+}
+
+AABB Box::bounds() const
+{
+    return AABB(glm::min(low, hi), glm::max(low, hi));
+}
+
+bool Rectangle::hit(const Ray &ray, Interval t_range, HitRecord &rec) const
 {
     if(ray.d.y == 0) return false;
     // std::cout << "Here" << std::endl;
@@ -157,4 +250,78 @@ bool Rectangle::hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm
     rec.n = glm::vec3(0.0f, -1.0f, 0.0f);
     if(glm::dot(rec.n, ray.d) > 0) rec.n = -rec.n;
     return true;
-}
\ No newline at end of file
+}
+
+AABB Rectangle::bounds() const
+{
+    //Rectangles are y-aligned and lie in the plane y = low.y
+    return AABB(glm::vec3(std::min(low.x, hi.x), low.y, std::min(low.z, hi.z)),
+                glm::vec3(std::max(low.x, hi.x), low.y, std::max(low.z, hi.z)));
+}
+
+bool Rectangle::occluded(const Ray &ray, Interval t_range) const
+{
+    if(ray.d.y == 0) return false;
+    float t = (low.y - ray.o.y) / ray.d.y;
+    if(!t_range.contains(t)) return false;
+    glm::vec3 p = ray.at(t);
+    return p.x >= std::min(low.x, hi.x) && p.x <= std::max(low.x, hi.x) &&
+           p.z >= std::min(low.z, hi.z) && p.z <= std::max(low.z, hi.z);
+}
+
+//ShapeGroup functions
+void ShapeGroup::add(Shape *shape, const glm::mat4 &M)
+{
+    members.push_back(Object(shape, nullptr));
+    if(M != glm::mat4(1.0f)) members.back().setTransform(M);
+}
+
+void ShapeGroup::build()
+{
+    std::vector<AABB> memberBounds(members.size());
+    std::vector<float> costs(members.size());
+    box = AABB();
+    float total = 0.0f;
+    for(size_t i = 0; i < members.size(); ++i)
+    {
+        memberBounds[i] = members[i].worldBounds();
+        costs[i] = members[i].shape->intersectionCost();
+        box.expand(memberBounds[i]);
+        total += costs[i];
+    }
+    center = box.isFinite() && !box.isEmpty() ? box.centroid() : glm::vec3(0.0f);
+    bvh.build(memberBounds, costs);
+    mbvh = MBVH();
+    if(bvh.options.width == 4) mbvh.build(bvh);
+    //The way down the group's BVH, then about one member
+    int n = std::max(1, (int)members.size());
+    cost = 1.0f + std::log2((float)n) + total/n;
+}
+
+bool ShapeGroup::hit(const Ray &ray, Interval t_range, HitRecord &rec) const
+{
+    bool found = false;
+    auto visit = [&](int member, float &tmax) {
+        if(members[member].hit(ray, Interval(t_range.min, tmax), rec))
+        {
+            tmax = rec.t;
+            found = true;
+        }
+        return false;
+    };
+    if(mbvh.empty()) bvh.traverse(ray, t_range, visit);
+    else mbvh.traverse(bvh, ray, t_range, visit);
+    return found;
+}
+
+bool ShapeGroup::occluded(const Ray &ray, Interval t_range) const
+{
+    bool found = false;
+    auto visit = [&](int member, float &tmax) {
+        found = members[member].occluded(ray, Interval(t_range.min, tmax));
+        return found;
+    };
+    if(mbvh.empty()) bvh.traverse(ray, t_range, visit);
+    else mbvh.traverse(bvh, ray, t_range, visit);
+    return found;
+}
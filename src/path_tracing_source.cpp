@@ -1,22 +1,15 @@
 #include "scene.hpp"
 
 //Probability
-bool probability(float p) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd()); // Mersenne Twister RNG
-    static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-    return dist(gen) < p;
+bool probability(float p, Sampler &sampler) {
+    return sampler.get1D() < p;
 }
 
 // Cosine-weighted sample in local space (+Z is the normal)
-glm::vec3 sampleCosineHemisphereLocal() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-    float u1 = dist(gen);
-    float u2 = dist(gen);
+glm::vec3 sampleCosineHemisphereLocal(Sampler &sampler) {
+    glm::vec2 u = sampler.get2D();
+    float u1 = u.x;
+    float u2 = u.y;
 
     float r = sqrt(u1);
     float theta = 2.0f * glm::pi<float>() * u2;
@@ -42,8 +35,8 @@ glm::vec3 toWorldSpace(const glm::vec3& local, const glm::vec3& normal) {
 }
 
 // Full cosine-weighted sample in world space at a point with a given normal
-glm::vec3 sampleCosineHemisphere(const glm::vec3& normal) {
-    glm::vec3 local = sampleCosineHemisphereLocal();
+glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, Sampler &sampler) {
+    glm::vec3 local = sampleCosineHemisphereLocal(sampler);
     glm::vec3 dir = toWorldSpace(local, normal);
     //Importance sampling, so need to divide by pdf
     dir/=cosineHemispherePDF(normal, dir);
@@ -60,13 +53,55 @@ std::pair<HitRecord,int> Scene::traceRay(Ray ray) const
     HitRecord rec = HitRecord();
     Interval t_range = Interval(0.001f, std::numeric_limits<float>::max());
     int no_of_hits = 0;
-    for(auto const &obj:objects)
+    if(hasCompiledScene())
+    {
+        no_of_hits = compiled.intersect(ray, t_range, rec);
+        return std::make_pair(rec, no_of_hits);
+    }
+    if(hasBVH())
     {
-        if(obj->hit(ray, t_range, rec)) 
+        //Closest hit wins, ties go to the later object like in the linear scan
+        int hit_index = -1;
+        HitRecord tmp = HitRecord();
+        bvh.traverse(ray, t_range, [&](int i, float &tmax) {
+            if(objects[i]->hit(ray, Interval(t_range.min, tmax), tmp) &&
+               (no_of_hits == 0 || tmp.t < rec.t || (tmp.t == rec.t && i > hit_index)))
+            {
+                rec = tmp;
+                rec.object = hit_index = i;
+                tmax = std::min(tmax, rec.t);
+                no_of_hits++;
+            }
+            return false;
+        });
+        return std::make_pair(rec, no_of_hits);
+    }
+    for(int i = 0; i < (int)objects.size(); ++i)
+    {
+        if(objects[i]->hit(ray, t_range, rec)) 
         {
+            rec.object = i;
             t_range.max=std::min(t_range.max, rec.t);
             no_of_hits++;
         }
     }
     return std::make_pair(rec, no_of_hits);
+}
+
+void Scene::traceRays(const RayPacket &packet, std::pair<HitRecord,int> *hits) const
+{
+    if(hasCompiledScene())
+    {
+        HitRecord recs[RayPacket::maxSize];
+        uint64_t hit = compiled.intersect(packet, recs);
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(packet.active & (uint64_t(1) << i)) hits[i] = std::make_pair(recs[i], int((hit >> i) & 1));
+        }
+        return;
+    }
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(packet.active & (uint64_t(1) << i)) hits[i] = traceRay(packet.ray(i));
+    }
 }
\ No newline at end of file
@@ -0,0 +1,464 @@
+#include "render.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+//ThreadPool functions
+ThreadPool::ThreadPool(int threads)
+{
+    if(threads <= 0) threads = std::max(1, (int)std::thread::hardware_concurrency());
+    for(int i = 0; i < threads; ++i) queues.emplace_back(new Queue());
+    for(int i = 0; i < threads; ++i) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto &t: workers) t.join();
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int,int)> &task)
+{
+    if(count <= 0) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &task;
+    remaining = count;
+    //Contiguous blocks per worker keep neighbouring tiles on one core, stealing evens out the rest
+    int n = size();
+    for(int w = 0; w < n; ++w)
+    {
+        std::lock_guard<std::mutex> queueLock(queues[w]->mutex);
+        for(int i = (long long)count*w/n; i < (long long)count*(w + 1)/n; ++i) queues[w]->tasks.push_back(i);
+    }
+    generation++;
+    wake.notify_all();
+    finished.wait(lock, [this]() { return remaining == 0; });
+    job = nullptr;
+}
+
+bool ThreadPool::popTask(int worker, int &task)
+{
+    {
+        Queue &own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    int n = size();
+    for(int k = 1; k < n; ++k)
+    {
+        Queue &victim = *queues[(worker + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+    unsigned seen = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if(stopping) return;
+            seen = generation;
+        }
+        //A task always belongs to the current job, which stays alive until
+        //its last task is counted off
+        int task;
+        while(popTask(worker, task))
+        {
+            const std::function<void(int,int)> *current;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                current = job;
+            }
+            (*current)(task, worker);
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--remaining == 0) finished.notify_all();
+        }
+    }
+}
+
+//Render functions
+std::vector<Tile> makeTiles(int w, int h, int tileSize)
+{
+    std::vector<Tile> tiles;
+    for(int y = 0; y < h; y += tileSize)
+    {
+        for(int x = 0; x < w; x += tileSize)
+        {
+            Tile t;
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = std::min(x + tileSize, w);
+            t.y1 = std::min(y + tileSize, h);
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+color renderPixel(const Scene &scene, int i, int j, int w, int h, const RenderSettings &settings, Sampler &sampler,
+                  uint32_t firstSample)
+{
+    sampler.startPixel(i + j*w, firstSample);
+    if(settings.pixelJitter && settings.integrator == RenderSettings::PathTracing)
+    {
+        return scene.tracePixel(i, j, w, h, settings.numberOfSamples, settings.numberOfBounces, sampler);
+    }
+    float x = 2*(i+0.5)/w - 1;
+    float y = 1 - 2*(j+0.5)/h;
+    Ray ray = scene.camera->make_ray(x, y);
+    if(settings.integrator == RenderSettings::Whitted)
+    {
+        sampler.startNextSample();
+        return scene.getColor(ray, 2, sampler);
+    }
+    return scene.tracePath(ray, settings.numberOfSamples, settings.numberOfBounces, sampler);
+}
+
+//Traces the center rays of 8x8 pixel blocks as one packet, and the shadow
+//rays of their point light radiance as one packet per light
+static void renderPackets(const Scene &scene, HDRImage &image, const Tile &tile, const RenderSettings &settings,
+                          Sampler &sampler)
+{
+    const int side = 8;
+    int w = image.w, h = image.h;
+    for (int y0 = tile.y0; y0 < tile.y1; y0 += side) {
+        for (int x0 = tile.x0; x0 < tile.x1; x0 += side) {
+            RayPacket packet;
+            for (int k = 0; k < RayPacket::maxSize; k++) {
+                int i = x0 + k % side, j = y0 + k / side;
+                if(i >= tile.x1 || j >= tile.y1) continue;
+                float x = 2*(i+0.5)/w - 1;
+                float y = 1 - 2*(j+0.5)/h;
+                packet.set(k, scene.camera->make_ray(x, y), Interval(0.001f, std::numeric_limits<float>::max()));
+            }
+            std::pair<HitRecord,int> hits[RayPacket::maxSize];
+            color direct[RayPacket::maxSize];
+            scene.traceRays(packet, hits);
+            uint64_t lit = 0;
+            for (int k = 0; k < RayPacket::maxSize; k++) {
+                direct[k] = glm::vec3(0.0f);
+                if((packet.active >> k & 1) && hits[k].second) lit |= uint64_t(1) << k;
+            }
+            //With next event estimation point lights are sampled along the path instead
+            if(!scene.pathSettings.nextEventEstimation) scene.radiance(hits, lit, direct);
+            for (int k = 0; k < RayPacket::maxSize; k++) {
+                if(!(packet.active >> k & 1)) continue;
+                int i = x0 + k % side, j = y0 + k / side;
+                sampler.startPixel(i + j*w, settings.firstSample);
+                image.pixel(i, j) = scene.tracePath(packet.ray(k), hits[k], direct[k], settings.numberOfSamples,
+                                                    settings.numberOfBounces, sampler);
+            }
+        }
+    }
+}
+
+void renderTile(const Scene &scene, HDRImage &image, const Tile &tile, const RenderSettings &settings)
+{
+    std::unique_ptr<Sampler> sampler(Sampler::create(settings.samplerType, settings.seed, image.w));
+    if(settings.wavefront && !settings.pixelJitter && settings.integrator == RenderSettings::PathTracing)
+    {
+        renderTileWavefront(scene, image, tile, settings);
+        return;
+    }
+    if(settings.packets && !settings.pixelJitter && settings.integrator == RenderSettings::PathTracing)
+    {
+        renderPackets(scene, image, tile, settings, *sampler);
+        return;
+    }
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            image.pixel(i, j) = renderPixel(scene, i, j, image.w, image.h, settings, *sampler, settings.firstSample);
+        }
+    }
+}
+
+void render(const Scene &scene, HDRImage &image, const RenderSettings &settings, ThreadPool &pool)
+{
+    std::vector<Tile> tiles = makeTiles(image.w, image.h, std::max(1, settings.tileSize));
+    pool.parallelFor((int)tiles.size(), [&](int t, int worker) {
+        renderTile(scene, image, tiles[t], settings);
+    });
+}
+
+void render(const Scene &scene, HDRImage &image, const RenderSettings &settings)
+{
+    ThreadPool pool(settings.threads);
+    render(scene, image, settings, pool);
+}
+
+//ProgressiveRenderer functions
+ProgressiveRenderer::ProgressiveRenderer(const Scene &scene, int w, int h, const RenderSettings &settings,
+                                         ThreadPool &pool):
+    scene(scene),
+    settings(settings),
+    pool(pool),
+    tiles(makeTiles(w, h, std::max(1, settings.tileSize))),
+    pass(w, h),
+    accumulation(w, h)
+{
+}
+
+bool ProgressiveRenderer::renderPass(std::chrono::steady_clock::time_point deadline)
+{
+    RenderSettings passSettings = settings;
+    passSettings.firstSample = settings.firstSample + startedPasses*settings.numberOfSamples;
+    startedPasses++;
+    std::atomic<bool> complete(true);
+    pool.parallelFor((int)tiles.size(), [&](int t, int worker) {
+        if(std::chrono::steady_clock::now() >= deadline)
+        {
+            complete = false;
+            return;
+        }
+        const Tile &tile = tiles[t];
+        renderTile(scene, pass, tile, passSettings);
+        std::lock_guard<std::mutex> lock(mutex);
+        accumulation.add(pass, tile.x0, tile.y0, tile.x1, tile.y1);
+    });
+    if(complete) completedPasses++;
+    return complete;
+}
+
+int ProgressiveRenderer::renderPasses(int count)
+{
+    int done = 0;
+    for(int p = 0; p < count; ++p)
+    {
+        done += renderPass(std::chrono::steady_clock::time_point::max());
+        checkpointIfDue(false);
+    }
+    checkpointIfDue(true);
+    return done;
+}
+
+int ProgressiveRenderer::renderUntil(std::chrono::steady_clock::time_point deadline, int maxPasses)
+{
+    int done = 0;
+    while((maxPasses <= 0 || done < maxPasses) && std::chrono::steady_clock::now() < deadline)
+    {
+        bool complete = renderPass(deadline);
+        checkpointIfDue(false);
+        if(!complete) break;
+        done++;
+    }
+    checkpointIfDue(true);
+    return done;
+}
+
+//Checkpoint file: the magic, a version, then the renderer's size, sampler
+//and pass counters, the per-pixel counts and the double sums. Values are in
+//the byte order of the machine that wrote them.
+static const char checkpointMagic[4] = {'R', 'T', 'C', 'K'};
+static const uint32_t checkpointVersion = 1;
+
+template<typename T>
+static void writeValue(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool readValue(std::istream &in, T &value)
+{
+    return (bool)in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+bool ProgressiveRenderer::saveCheckpoint(const std::string &path) const
+{
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if(!out) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        out.write(checkpointMagic, 4);
+        writeValue(out, checkpointVersion);
+        writeValue(out, (int32_t)accumulation.w);
+        writeValue(out, (int32_t)accumulation.h);
+        writeValue(out, (int32_t)settings.numberOfSamples);
+        writeValue(out, (int32_t)settings.samplerType);
+        writeValue(out, (uint64_t)settings.seed);
+        writeValue(out, (uint32_t)settings.firstSample);
+        writeValue(out, (int32_t)startedPasses);
+        writeValue(out, (int32_t)completedPasses);
+        out.write(reinterpret_cast<const char*>(accumulation.count.data()), accumulation.count.size()*sizeof(int));
+        out.write(reinterpret_cast<const char*>(accumulation.sum.data()), accumulation.sum.size()*sizeof(double));
+        if(!out)
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if(std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool ProgressiveRenderer::resume(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[4];
+    uint32_t version, firstSample;
+    int32_t w, h, samples, samplerType, started, completed;
+    uint64_t seed;
+    if(!in.read(magic, 4) || std::memcmp(magic, checkpointMagic, 4) != 0) return false;
+    if(!readValue(in, version) || version != checkpointVersion) return false;
+    if(!readValue(in, w) || !readValue(in, h) || !readValue(in, samples) || !readValue(in, samplerType) ||
+       !readValue(in, seed) || !readValue(in, firstSample) || !readValue(in, started) || !readValue(in, completed))
+        return false;
+    if(w != accumulation.w || h != accumulation.h || samples != settings.numberOfSamples ||
+       samplerType != (int32_t)settings.samplerType || seed != settings.seed || firstSample != settings.firstSample)
+        return false;
+    AccumulationBuffer loaded(w, h);
+    if(!in.read(reinterpret_cast<char*>(loaded.count.data()), loaded.count.size()*sizeof(int)) ||
+       !in.read(reinterpret_cast<char*>(loaded.sum.data()), loaded.sum.size()*sizeof(double)))
+        return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    accumulation = loaded;
+    startedPasses = started;
+    completedPasses = completed;
+    return true;
+}
+
+void ProgressiveRenderer::setCheckpoint(const std::string &path, double interval)
+{
+    checkpointPath = path;
+    checkpointInterval = interval;
+    lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+void ProgressiveRenderer::checkpointIfDue(bool force)
+{
+    if(checkpointPath.empty()) return;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - lastCheckpoint;
+    if(!force && elapsed.count() < checkpointInterval) return;
+    if(!saveCheckpoint(checkpointPath)) std::cerr<<"could not write checkpoint "<<checkpointPath<<std::endl;
+    lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+void ProgressiveRenderer::snapshot(HDRImage &image) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    accumulation.resolve(image);
+}
+
+void ProgressiveRenderer::snapshot(SDL_Surface *ldri, float exposure, float gamma) const
+{
+    HDRImage image(accumulation.w, accumulation.h);
+    snapshot(image);
+    tonemap(image, ldri, exposure, gamma);
+}
+
+//Adaptive sampling functions
+void PixelEstimate::add(color batchMean)
+{
+    sum += batchMean;
+    batches++;
+    double x = 0.2126*batchMean.x + 0.7152*batchMean.y + 0.0722*batchMean.z;
+    double delta = x - mean;
+    mean += delta/batches;
+    m2 += delta*(x - mean);
+}
+
+float PixelEstimate::relativeError(float floor) const
+{
+    if(batches < 2) return std::numeric_limits<float>::infinity();
+    double variance = m2/(batches - 1);
+    return (float)(std::sqrt(variance/batches)/std::max(std::abs(mean), (double)floor));
+}
+
+AdaptiveStats renderAdaptive(const Scene &scene, HDRImage &image, const RenderSettings &settings,
+                             const AdaptiveSettings &adaptive, ThreadPool &pool)
+{
+    auto start = std::chrono::steady_clock::now();
+    AdaptiveStats stats;
+    int batch = std::max(1, adaptive.batchSamples);
+    int maxBatches = std::max(1, adaptive.maxSamples/batch);
+    RenderSettings batchSettings = settings;
+    batchSettings.numberOfSamples = batch;
+    std::vector<PixelEstimate> estimates(image.w*image.h);
+    std::vector<int> pending;
+    for(int pass = 0; ; ++pass)
+    {
+        //Pixels that need another batch, the noisiest first
+        pending.clear();
+        std::vector<float> error(estimates.size(), 0.0f);
+        for(int p = 0; p < (int)estimates.size(); ++p)
+        {
+            PixelEstimate &e = estimates[p];
+            if(e.done) continue;
+            if(e.batches >= std::max(2, adaptive.minBatches))
+            {
+                error[p] = e.relativeError(adaptive.errorFloor);
+                if(error[p] < adaptive.targetError)
+                {
+                    e.done = true;
+                    stats.converged++;
+                    continue;
+                }
+            }
+            else error[p] = std::numeric_limits<float>::infinity();
+            if(e.batches >= maxBatches) continue;
+            pending.push_back(p);
+        }
+        if(adaptive.sampleBudget > 0)
+        {
+            long left = (adaptive.sampleBudget - stats.samples)/batch;
+            if(left < (long)pending.size())
+            {
+                std::stable_sort(pending.begin(), pending.end(), [&](int a, int b) { return error[a] > error[b]; });
+                pending.resize(std::max(0L, left));
+            }
+        }
+        if(pending.empty()) break;
+        if(adaptive.timeBudget > 0.0 && pass > 0)
+        {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if(elapsed.count() >= adaptive.timeBudget) break;
+        }
+
+        //One batch for every pending pixel, in chunks of a tile's size
+        int chunk = std::max(1, settings.tileSize*settings.tileSize);
+        int chunks = ((int)pending.size() + chunk - 1)/chunk;
+        pool.parallelFor(chunks, [&](int c, int worker) {
+            std::unique_ptr<Sampler> sampler(Sampler::create(settings.samplerType, settings.seed, image.w));
+            int last = std::min((int)pending.size(), (c + 1)*chunk);
+            for(int k = c*chunk; k < last; ++k)
+            {
+                int p = pending[k];
+                PixelEstimate &e = estimates[p];
+                e.add(renderPixel(scene, p % image.w, p / image.w, image.w, image.h, batchSettings, *sampler,
+                                  settings.firstSample + e.batches*batch));
+            }
+        });
+        stats.samples += (long)pending.size()*batch;
+        stats.passes++;
+    }
+    for(int p = 0; p < (int)estimates.size(); ++p) image.pixels[p] = estimates[p].value();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    stats.seconds = elapsed.count();
+    return stats;
+}
@@ -0,0 +1,205 @@
+#ifndef RENDER_HPP
+#define RENDER_HPP
+
+#include "scene.hpp"
+#include "image.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+//Fixed set of worker threads with one task queue each. A worker drains its
+//own queue from the front and steals from the back of the others when empty.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0);   //0 uses every hardware thread
+    ~ThreadPool();
+    int size() const { return (int)workers.size(); }
+    //Runs task(index, worker) for every index in [0, count), blocks until all are done
+    void parallelFor(int count, const std::function<void(int,int)> &task);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    const std::function<void(int,int)> *job = nullptr;
+    int remaining = 0;
+    unsigned generation = 0;
+    bool stopping = false;
+
+    void workerLoop(int worker);
+    bool popTask(int worker, int &task);
+};
+
+class RenderSettings {
+public:
+    enum Integrator { Whitted, PathTracing };
+    Integrator integrator = PathTracing;
+    int numberOfSamples = 100;
+    int numberOfBounces = 5;
+    int tileSize = 16;
+    int threads = 0;    //0 uses every hardware thread
+    uint64_t seed = 0;  //frame seed, the image is a function of it alone
+    Sampler::Type samplerType = Sampler::Independent;
+    bool pixelJitter = false;   //jitter every sample inside its pixel instead of tracing the center
+    uint32_t firstSample = 0;   //sample index pixels start from, for renders continuing earlier ones
+    //Trace primary and point light shadow rays of 8x8 pixel blocks together.
+    //Only a small gain on small scenes such as the Cornell box, and slower
+    //than single rays on large ones, see packet_benchmark
+    bool packets = false;
+    //Render path tracing tiles with renderTileWavefront, which always uses the
+    //iterative estimator of Scene::integratePath
+    bool wavefront = false;
+    int wavefrontPaths = 1024;  //paths in flight per tile in wavefront mode
+};
+
+class Tile {
+public:
+    int x0, y0, x1, y1;    //pixel range [x0, x1) x [y0, y1)
+};
+
+//Budget and stopping rule of renderAdaptive. A pixel stops once the standard
+//error of its mean luminance, relative to that mean, is below targetError.
+class AdaptiveSettings {
+public:
+    float targetError = 0.02f;
+    float errorFloor = 1e-3f;   //luminance under which the error counts as absolute, for dark pixels
+    int batchSamples = 4;       //samples per pixel and pass, the variance is that of the batch means
+    int minBatches = 2;         //before a pixel may stop
+    int maxSamples = 4096;      //per pixel
+    long sampleBudget = 0;      //samples over the whole image, 0 for no limit
+    double timeBudget = 0.0;    //seconds, 0 for no limit
+};
+
+//Running luminance mean and variance of the batch means of one pixel
+class PixelEstimate {
+public:
+    color sum = glm::vec3(0.0f);    //of the batch means
+    int batches = 0;
+    double mean = 0.0, m2 = 0.0;    //Welford accumulators of the luminance
+    bool done = false;
+    void add(color batchMean);
+    color value() const { return batches > 0 ? sum/(float)batches : glm::vec3(0.0f); }
+    float relativeError(float floor) const;
+};
+
+class AdaptiveStats {
+public:
+    long samples = 0;
+    int passes = 0;
+    int converged = 0;      //pixels that reached the target error
+    double seconds = 0.0;
+};
+
+//State of the paths of a wavefront as structure of arrays, one slot per path
+//in flight. Every slot has its own sampler so that a path draws the same
+//numbers as when it is traced alone.
+class PathStates {
+public:
+    struct Vec3s {
+        std::vector<float> x, y, z;
+        void resize(int n) { x.resize(n); y.resize(n); z.resize(n); }
+        glm::vec3 get(int i) const { return glm::vec3(x[i], y[i], z[i]); }
+        void set(int i, glm::vec3 v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+    };
+    Vec3s origin, direction;        //ray of the current segment
+    Vec3s throughput, radiance;
+    Vec3s fromP, fromN;             //PathVertex the current ray left from
+    std::vector<float> fromPdf;
+    std::vector<HitRecord> hit;     //where the current ray ends
+    std::vector<int> item, depth;   //item is pixel*samples + sample within the tile
+    std::vector<std::unique_ptr<Sampler> > samplers;
+    PathStates(int slots, const RenderSettings &settings, int imageWidth);
+    int size() const { return (int)item.size(); }
+};
+
+//Work produced by the shading stage of a wavefront
+class WavefrontQueues {
+public:
+    std::vector<int> extension;     //slots whose next segment is to be traced
+    std::vector<int> finished;      //slots whose path ends once its shadow ray is resolved
+    //Light connections, the contribution is added to the slot's radiance if p sees q
+    std::vector<int> shadowSlot;
+    PathStates::Vec3s shadowP, shadowQ, shadowContribution;
+    void addShadow(int slot, glm::vec3 p, glm::vec3 q, color contribution);
+    void clear();
+};
+
+std::vector<Tile> makeTiles(int w, int h, int tileSize);
+//settings.numberOfSamples samples of pixel (i, j) from sample index firstSample
+//on, which already includes settings.firstSample
+color renderPixel(const Scene &scene, int i, int j, int w, int h, const RenderSettings &settings, Sampler &sampler,
+                  uint32_t firstSample);
+void renderTile(const Scene &scene, HDRImage &image, const Tile &tile, const RenderSettings &settings);
+//Path traces the tile in stages over up to settings.wavefrontPaths paths at
+//once: intersect every ray in flight, shade the hits grouped by material
+//type, resolve the shadow rays, then trace the extension rays. The image is
+//the one renderTile gives with pathSettings.iterative set.
+void renderTileWavefront(const Scene &scene, HDRImage &image, const Tile &tile, const RenderSettings &settings);
+void render(const Scene &scene, HDRImage &image, const RenderSettings &settings, ThreadPool &pool);
+void render(const Scene &scene, HDRImage &image, const RenderSettings &settings);
+//Renders passes of settings.numberOfSamples spp into an accumulation buffer,
+//each pass continuing the sample sequence of the previous one. Snapshots may
+//be taken from another thread while passes run, they see every tile
+//finished so far.
+class ProgressiveRenderer {
+public:
+    ProgressiveRenderer(const Scene &scene, int w, int h, const RenderSettings &settings, ThreadPool &pool);
+    //Returns the number of passes completed
+    int renderPasses(int count);
+    //Renders passes until the deadline, tiles are not started after it so the
+    //last pass may cover part of the image. maxPasses 0 means no limit.
+    int renderUntil(std::chrono::steady_clock::time_point deadline, int maxPasses = 0);
+    void snapshot(HDRImage &image) const;
+    void snapshot(SDL_Surface *ldri, float exposure = 1, float gamma = 2.2) const;
+    int passes() const { return completedPasses; }
+
+    //Writes the accumulation buffer, the per-pixel counts and the sampler
+    //state to path. Samplers are counter based, so their state is the seed,
+    //the sampler type and the next sample index. The file is written next to
+    //path and renamed over it, a killed process leaves the last one whole.
+    bool saveCheckpoint(const std::string &path) const;
+    //Continues from a checkpoint of a renderer of the same size, seed,
+    //sampler and spp per pass. Passes then draw the samples the
+    //uninterrupted render would have, so its image is bit-identical.
+    //Returns false and keeps the current state if the file does not match.
+    bool resume(const std::string &path);
+    //Saves to path after every pass finishing at least interval seconds
+    //after the last save, and when renderPasses or renderUntil returns
+    void setCheckpoint(const std::string &path, double interval);
+
+private:
+    const Scene &scene;
+    RenderSettings settings;
+    ThreadPool &pool;
+    std::vector<Tile> tiles;
+    HDRImage pass;
+    AccumulationBuffer accumulation;
+    mutable std::mutex mutex;
+    int completedPasses = 0, startedPasses = 0;
+    std::string checkpointPath;
+    double checkpointInterval = 0.0;
+    std::chrono::steady_clock::time_point lastCheckpoint;
+    bool renderPass(std::chrono::steady_clock::time_point deadline);
+    void checkpointIfDue(bool force);
+};
+
+//Samples in passes of adaptive.batchSamples per pixel, first every pixel
+//minBatches times, then only the pixels above the target error. When the
+//sample budget cannot cover every such pixel the noisiest go first. The
+//time budget is checked between passes. settings.numberOfSamples is unused.
+AdaptiveStats renderAdaptive(const Scene &scene, HDRImage &image, const RenderSettings &settings,
+                             const AdaptiveSettings &adaptive, ThreadPool &pool);
+
+#endif
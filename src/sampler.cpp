@@ -0,0 +1,162 @@
+#include "sampler.hpp"
+
+#include <cmath>
+#include <vector>
+
+static uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+static float toUnitFloat(uint32_t x)
+{
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+static uint32_t hashCombine(uint32_t seed, uint32_t v)
+{
+    return (uint32_t)Sampler::mix(((uint64_t)seed << 32) | v);
+}
+
+Sampler* Sampler::create(Type type, uint64_t frameSeed, int imageWidth)
+{
+    switch(type)
+    {
+    case Sobol: return new SobolSampler(frameSeed);
+    case BlueNoise: return new BlueNoiseSampler(frameSeed, imageWidth);
+    default: return new IndependentSampler(frameSeed);
+    }
+}
+
+//SobolSampler functions
+uint32_t SobolSampler::sobol(uint32_t index, int dim)
+{
+    //The first dimension is the van der Corput sequence, the direction numbers
+    //of the second satisfy v_k = v_{k-1} ^ (v_{k-1} >> 1)
+    if(dim == 0) return reverseBits(index);
+    uint32_t x = 0;
+    for(uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        if(index & 1) x ^= v;
+    }
+    return x;
+}
+
+uint32_t SobolSampler::nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    //Laine-Karras style hash applied to the reversed bits is an Owen scramble
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits(x);
+}
+
+void SobolSampler::beginSample(uint32_t pixel, uint32_t sampleIndex)
+{
+    pixelSeed = (uint32_t)mix(pixel ^ mix(frameSeed));
+    sample = sampleIndex;
+    dimension = 0;
+}
+
+uint32_t SobolSampler::dimensionSeed() const
+{
+    return hashCombine(pixelSeed, dimension);
+}
+
+float SobolSampler::get1D()
+{
+    uint32_t seed = dimensionSeed();
+    dimension++;
+    uint32_t index = nestedUniformScramble(sample, seed);
+    return toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0)));
+}
+
+glm::vec2 SobolSampler::get2D()
+{
+    uint32_t seed = dimensionSeed();
+    dimension += 2;
+    uint32_t index = nestedUniformScramble(sample, seed);
+    return glm::vec2(toUnitFloat(nestedUniformScramble(sobol(index, 0), hashCombine(seed, 0))),
+                     toUnitFloat(nestedUniformScramble(sobol(index, 1), hashCombine(seed, 1))));
+}
+
+//BlueNoiseSampler functions
+static std::vector<float> buildBlueNoiseMask()
+{
+    //Ranks pixels by repeatedly taking the one with the least Gaussian
+    //energy from the pixels already taken (the void step of void-and-cluster)
+    const int size = 64, n = size*size;
+    const float sigma = 1.5f;
+    std::vector<float> kernel(n), energy(n, 0.0f), rank(n, -1.0f);
+    for(int y = 0; y < size; ++y)
+    {
+        for(int x = 0; x < size; ++x)
+        {
+            int dx = std::min(x, size - x), dy = std::min(y, size - y);
+            kernel[y*size + x] = std::exp(-(dx*dx + dy*dy)/(2.0f*sigma*sigma));
+        }
+    }
+    for(int r = 0; r < n; ++r)
+    {
+        int best = -1;
+        for(int p = 0; p < n; ++p)
+        {
+            if(rank[p] < 0.0f && (best < 0 || energy[p] < energy[best])) best = p;
+        }
+        rank[best] = (r + 0.5f)/n;
+        int bx = best % size, by = best / size;
+        for(int y = 0; y < size; ++y)
+        {
+            const float *row = &kernel[((y - by) & (size - 1))*size];
+            for(int x = 0; x < size; ++x) energy[y*size + x] += row[(x - bx) & (size - 1)];
+        }
+    }
+    return rank;
+}
+
+float BlueNoiseSampler::mask(int x, int y)
+{
+    static const std::vector<float> values = buildBlueNoiseMask();
+    return values[(y & 63)*64 + (x & 63)];
+}
+
+void BlueNoiseSampler::beginSample(uint32_t pixel, uint32_t sampleIndex)
+{
+    px = pixel % imageWidth;
+    py = pixel / imageWidth;
+    //Same sequence in every pixel, the mask supplies the per-pixel variation
+    pixelSeed = (uint32_t)mix(frameSeed);
+    sample = sampleIndex;
+    dimension = 0;
+}
+
+float BlueNoiseSampler::offset(uint32_t dim) const
+{
+    //Every dimension reads the mask at its own toroidal shift
+    uint32_t h = hashCombine(pixelSeed, dim);
+    return mask(px + (h & 63), py + ((h >> 6) & 63));
+}
+
+float BlueNoiseSampler::get1D()
+{
+    float o = offset(dimension);
+    float u = SobolSampler::get1D() + o;
+    return u < 1.0f ? u : u - 1.0f;
+}
+
+glm::vec2 BlueNoiseSampler::get2D()
+{
+    glm::vec2 o = glm::vec2(offset(dimension), offset(dimension + 1));
+    glm::vec2 u = SobolSampler::get2D();
+    u.x += o.x;
+    u.y += o.y;
+    return glm::vec2(u.x < 1.0f ? u.x : u.x - 1.0f, u.y < 1.0f ? u.y : u.y - 1.0f);
+}
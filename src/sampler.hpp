@@ -0,0 +1,126 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+//Source of the random numbers for one pixel sample. Every sample is a pure
+//function of (pixel, sample index, frame seed), so the numbers a sample sees
+//do not depend on which thread renders it or on what was rendered before.
+//Dimensions are consumed in order, consumers draw 2D pairs with get2D() so
+//that low-discrepancy samplers can stratify them.
+class Sampler {
+public:
+    enum Type { Independent, Sobol, BlueNoise };
+    uint64_t frameSeed;
+    explicit Sampler(uint64_t frameSeed = 0):
+        frameSeed(frameSeed) {
+    }
+    virtual ~Sampler() {}
+    static Sampler* create(Type type, uint64_t frameSeed = 0, int imageWidth = 1 << 16);
+
+    //The next call to startNextSample() begins sample firstSample of pixel
+    void startPixel(uint32_t pixel, uint32_t firstSample = 0) {
+        currentPixel = pixel;
+        nextSampleIndex = firstSample;
+        beginSample(pixel, firstSample);
+    }
+    void startNextSample() {
+        beginSample(currentPixel, nextSampleIndex++);
+    }
+    uint32_t pixel() const { return currentPixel; }
+    uint32_t sampleIndex() const { return nextSampleIndex - 1; }
+
+    virtual float get1D() = 0;              //uniform in [0, 1)
+    virtual glm::vec2 get2D() = 0;
+    virtual glm::vec2 getPixel2D() { return get2D(); }  //offset inside the pixel
+
+    static uint64_t mix(uint64_t x) {   //splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+protected:
+    uint32_t currentPixel = 0, nextSampleIndex = 0;
+    virtual void beginSample(uint32_t pixel, uint32_t sample) = 0;
+};
+
+//PCG32 stream reseeded for every sample
+class IndependentSampler: public Sampler {
+public:
+    explicit IndependentSampler(uint64_t frameSeed = 0):
+        Sampler(frameSeed) {
+        startPixel(0);
+    }
+    uint32_t nextUInt() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+    float get1D() override {
+        return (nextUInt() >> 8) * (1.0f / 16777216.0f);
+    }
+    glm::vec2 get2D() override {
+        float u = get1D();
+        return glm::vec2(u, get1D());
+    }
+
+protected:
+    uint64_t state = 0, inc = 1;
+    void beginSample(uint32_t pixel, uint32_t sample) override {
+        uint64_t key = mix(((uint64_t)pixel << 32) | sample);
+        state = 0;
+        inc = (mix(key ^ frameSeed) << 1u) | 1u;
+        nextUInt();
+        state += mix(key + mix(frameSeed));
+        nextUInt();
+    }
+};
+
+//Owen-scrambled Sobol points padded across dimensions (Burley 2020): every
+//1D or 2D draw uses the first two Sobol dimensions with its own index shuffle
+//and nested uniform scramble, so each pair is a stratified (0,2)-sequence
+//and pairs are decorrelated from each other and across pixels.
+class SobolSampler: public Sampler {
+public:
+    explicit SobolSampler(uint64_t frameSeed = 0):
+        Sampler(frameSeed) {
+        startPixel(0);
+    }
+    float get1D() override;
+    glm::vec2 get2D() override;
+
+    static uint32_t sobol(uint32_t index, int dim);     //dim 0 or 1
+    static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed);
+
+protected:
+    uint32_t pixelSeed = 0, sample = 0, dimension = 0;
+    void beginSample(uint32_t pixel, uint32_t sampleIndex) override;
+    uint32_t dimensionSeed() const;
+};
+
+//Scrambled Sobol points shared by every pixel and Cranley-Patterson rotated
+//per pixel by a 64x64 blue-noise mask, so that the error of neighbouring
+//pixels is decorrelated into high frequencies.
+class BlueNoiseSampler: public SobolSampler {
+public:
+    explicit BlueNoiseSampler(uint64_t frameSeed = 0, int imageWidth = 1 << 16):
+        SobolSampler(frameSeed),
+        imageWidth(imageWidth) {
+    }
+    int imageWidth;     //to recover (x, y) from the pixel index
+    float get1D() override;
+    glm::vec2 get2D() override;
+    static float mask(int x, int y);    //rank of (x, y) in [0, 1), tiles every 64 pixels
+
+protected:
+    int px = 0, py = 0;
+    void beginSample(uint32_t pixel, uint32_t sampleIndex) override;
+    float offset(uint32_t dim) const;
+};
+
+#endif
@@ -2,24 +2,56 @@
 
 //Scene functions
 bool Scene::inShadow(glm::vec3 p, PointLight light) const
+{
+    Interval t_range = Interval(0.0f, 0.0f);
+    Ray shadow_ray = shadowRay(p, light, t_range);
+    //Rectangles let the light through
+    return occluded(shadow_ray, t_range, true);
+}
+
+Ray Scene::shadowRay(glm::vec3 p, const PointLight &light, Interval &t_range) const
 {
     Ray shadow_ray(p, normalize(light.location-p));
-    HitRecord rec = HitRecord();
     float light_t = (glm::length(light.location - shadow_ray.o) / glm::length(shadow_ray.d));
-    Interval t_range = Interval(0.0f, light_t);
-    float bias = 0.001f, min_hit = light_t;
-    // for(auto const &obj:objects)
+    float bias = 0.001f;
     shadow_ray.o = shadow_ray.o + bias * shadow_ray.d;
-    for(int i = 0; i < objects.size(); ++i)
+    //A hit at the light itself does not count
+    t_range = Interval(0.0f, std::nextafter(light_t, 0.0f));
+    return shadow_ray;
+}
+
+bool Scene::occluded(const Ray &ray, Interval t_range, bool skipRectangles) const
+{
+    if(hasCompiledScene()) return compiled.occluded(ray, t_range, skipRectangles);
+    bool blocked = false;
+    auto visit = [&](int i, float &tmax) {
+        if(skipRectangles && objects[i]->shape->isRectangle) return false;
+        blocked = objects[i]->occluded(ray, t_range);
+        return blocked;
+    };
+    if(hasBVH())
     {
-        auto const&obj = objects[i];
-        if(obj->hit(shadow_ray, t_range, rec) and !obj->shape->isRectangle) {
-            min_hit = std::min(min_hit, std::max(rec.t, 2 * bias));
-            // if(rec.t < 0) std::cout << "negative min_hit: " << i << " " << std::endl;
-        }
+        bvh.traverse(ray, t_range, visit);
+        return blocked;
     }
-    // std::cout << "lt: " << light_t <<  " " << min_hit << std::endl;
-    return (min_hit > bias && min_hit < light_t) ? true : false;
+    float tmax = t_range.max;
+    for(int i = 0; i < (int)objects.size() && !blocked; ++i)
+    {
+        visit(i, tmax);
+    }
+    return blocked;
+}
+
+uint64_t Scene::occluded(const RayPacket &packet, bool skipRectangles) const
+{
+    if(hasCompiledScene()) return compiled.occluded(packet, skipRectangles);
+    uint64_t blocked = 0;
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(!(packet.active & (uint64_t(1) << i))) continue;
+        if(occluded(packet.ray(i), Interval(packet.tmin[i], packet.tmax[i]), skipRectangles)) blocked |= uint64_t(1) << i;
+    }
+    return blocked;
 }
 
 glm::vec3 Scene::irradiance(HitRecord &rec, PointLight light) const
@@ -58,30 +90,68 @@ color Scene::radiance(HitRecord &rec) const
     return totalRadiance;
 }
 
-float random_float_01() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd()); // static: only initialized once
-    static std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-    return dis(gen);
+void Scene::radiance(const std::pair<HitRecord,int> *hits, uint64_t mask, color *out) const
+{
+    for(int i = 0; i < RayPacket::maxSize; ++i)
+    {
+        if(mask & (uint64_t(1) << i)) out[i] = glm::vec3(0.0);
+    }
+    for(auto const &light:lights)
+    {
+        RayPacket packet;
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(!(mask & (uint64_t(1) << i))) continue;
+            Interval t_range = Interval(0.0f, 0.0f);
+            Ray shadow_ray = shadowRay(hits[i].first.p, light, t_range);
+            packet.set(i, shadow_ray, t_range);
+        }
+        uint64_t lit = mask & ~occluded(packet, true);
+        for(int i = 0; i < RayPacket::maxSize; ++i)
+        {
+            if(!(lit & (uint64_t(1) << i))) continue;
+            HitRecord rec = hits[i].first;
+            glm::vec3 v = camera->getLocation()-rec.p;
+            glm::vec3 l = light.location-rec.p;
+            color brdf = rec.mat->brdf(rec, l, v);
+            out[i] += irradiance(rec, light) * brdf;
+        }
+    }
 }
 
-color Scene::radianceFromEmissive(HitRecord &rec) const
+color Scene::radianceFromEmissive(HitRecord &rec, Sampler &sampler) const
 {
     color totalRadiance = glm::vec3(0.0);
+    //Next event estimation accounts for emitters at every vertex instead
+    if(pathSettings.nextEventEstimation) return totalRadiance;
     if(rec.mat->emission(rec, camera->getLocation()-rec.p) != glm::vec3(0.0f))
     {
         return totalRadiance;
     }
-    for(auto const &obj:objects) {
-        if(obj->shape->isRectangle) {
+    //A scene loaded from a cache has its rectangles in the compiled scene only
+    bool cached = objects.empty() && hasCompiledScene();
+    int count = cached ? compiled.rectangleSources.size() : objects.size();
+    for(int k = 0; k < count; ++k) {
+        const Object *obj = cached ? nullptr : objects[k];
+        if(cached || obj->shape->isRectangle) {
+            const CompiledScene::RectangleSource *source = cached ? &compiled.rectangleSources[k] : nullptr;
+            const Material *mat = cached ? compiled.materials[compiled.materialIndex[source->object]] : obj->mat;
             for(int i = 0; i < 5; i++) {
-                Rectangle *rect = static_cast<Rectangle*>(obj->shape);
-                glm::vec3 lo = rect->low, hi = rect->hi;
-                float sample_x = random_float_01() * (hi.x - lo.x) + lo.x;
-                float sample_z = random_float_01() * (hi.z - lo.z) + lo.z;
+                glm::vec3 lo, hi;
+                if(cached) {
+                    lo = source->low;
+                    hi = source->hi;
+                } else {
+                    Rectangle *rect = static_cast<Rectangle*>(obj->shape);
+                    lo = rect->low;
+                    hi = rect->hi;
+                }
+                glm::vec2 u = sampler.get2D();
+                float sample_x = u.x * (hi.x - lo.x) + lo.x;
+                float sample_z = u.y * (hi.z - lo.z) + lo.z;
                 glm::vec3 sample_point = glm::vec3(sample_x, lo.y, sample_z);
                 if(not inShadow(rec.p + 0.001f * rec.n, PointLight(sample_point, glm::vec3(0.0f)))) {
-                    totalRadiance += obj->mat->emission(rec, camera->getLocation()-rec.p) * glm::dot(rec.n, glm::normalize(sample_point-rec.p));
+                    totalRadiance += mat->emission(rec, camera->getLocation()-rec.p) * glm::dot(rec.n, glm::normalize(sample_point-rec.p));
                     // std::cout << "sampled point: " << to_string(sample_point) << std::endl;
                 } else {
                     // std::cout << "sampled point: " << to_string(sample_point) << std::endl;
@@ -112,32 +182,43 @@ color Scene::radianceFromEmissive(HitRecord &rec) const
     // }
     // return totalRadiance;
 }
-color Scene::computeColor(Ray ray, int numberOfBounces) const
+color Scene::computeColor(Ray ray, int numberOfBounces, Sampler &sampler) const
+{
+    return computeColor(ray, traceRay(ray), numberOfBounces, sampler);
+}
+
+//hit is traceRay(ray), the continuation hit is passed down instead of being traced twice
+color Scene::computeColor(Ray ray, const std::pair<HitRecord,int> &hit, int numberOfBounces, Sampler &sampler,
+                          const PathVertex &from) const
 {
-    std::pair<HitRecord,int> hit = traceRay(ray);
     if(!hit.second) return sky;
     glm::vec3 point = hit.first.p;
     glm::vec3 v = glm::normalize(-1.0f*ray.d);
-    color Le = hit.first.mat->emission(hit.first, v);
+    color Le = hit.first.mat->emission(hit.first, v)*emissionWeight(from, hit.first);
+    color Ld = sampleDirectLight(hit.first, v, sampler);
     color Lr = glm::vec3(0.0f);
 
     float prob = 1.0 - (1.0/(float)numberOfBounces);
 
     //Sample a direction from importance sampling
     glm::vec3 sampledNormal = glm::vec3(0.0f), kr = glm::vec3(0.0f);
-    hit.first.mat->reflection(hit.first,v,sampledNormal, kr);
+    hit.first.mat->reflection(hit.first,v,sampledNormal, kr, sampler);
     float pdfinverse = glm::length(sampledNormal);
     sampledNormal = glm::normalize(sampledNormal);
 
     //Get cos_theta_i
     float cos_theta_i = glm::dot(hit.first.n, sampledNormal);
     
-    if(probability(prob) && sampledNormal!=glm::vec3(0.0f) && pdfinverse > 1e-5)
+    if(probability(prob, sampler) && sampledNormal!=glm::vec3(0.0f) && pdfinverse > 1e-5)
     {
         std::pair<HitRecord,int> hit2 = traceRay(Ray(point+0.001f*sampledNormal, sampledNormal));
         if(hit2.second)
         {
-            Lr = computeColor(Ray(point+0.001f*sampledNormal, sampledNormal),numberOfBounces)*
+            PathVertex vertex;
+            vertex.p = point;
+            vertex.n = hit.first.n;
+            vertex.bsdfPdf = hit.first.mat->isSpecular() ? 0.0f : 1.0f/pdfinverse;
+            Lr = computeColor(Ray(point+0.001f*sampledNormal, sampledNormal),hit2,numberOfBounces,sampler,vertex)*
                  cos_theta_i*pdfinverse*hit.first.mat->brdf(hit.first, sampledNormal, v)*
                 (1.0f/prob); 
         }
@@ -147,24 +228,146 @@ color Scene::computeColor(Ray ray, int numberOfBounces) const
     {
         Lr *= kr;
     }
-    return Le + Lr;
+    return Le + Ld + Lr;
+}
+
+//Same estimator as computeColor, but carries the path throughput in a loop so
+//each segment is traced once, and terminates with Russian roulette on the
+//throughput and a hard depth limit instead of a fixed continuation probability
+color Scene::integratePath(Ray ray, Sampler &sampler) const
+{
+    return integratePath(ray, traceRay(ray), sampler);
 }
 
-color Scene::tracePath(Ray ray, int numberOfSamples, int numberOfBounces) const
+color Scene::integratePath(Ray ray, std::pair<HitRecord,int> hit, Sampler &sampler) const
+{
+    if(!hit.second) return sky;
+    color L = glm::vec3(0.0f), throughput = glm::vec3(1.0f);
+    PathVertex from;
+    for(int depth = 1; ; depth++)
+    {
+        const HitRecord &rec = hit.first;
+        glm::vec3 v = glm::normalize(-1.0f*ray.d);
+        L += throughput*rec.mat->emission(rec, v)*emissionWeight(from, rec);
+        L += throughput*sampleDirectLight(rec, v, sampler);
+        if(depth >= pathSettings.maxDepth) break;
+
+        glm::vec3 sampledNormal = glm::vec3(0.0f), kr = glm::vec3(0.0f);
+        rec.mat->reflection(rec, v, sampledNormal, kr, sampler);
+        float pdfinverse = glm::length(sampledNormal);
+        if(!(pdfinverse > 1e-5)) break;
+        sampledNormal = sampledNormal/pdfinverse;
+
+        float cos_theta_i = glm::dot(rec.n, sampledNormal);
+        throughput *= cos_theta_i*pdfinverse*rec.mat->brdf(rec, sampledNormal, v);
+        if(kr != glm::vec3(0.0f)) throughput *= kr;
+        if(throughput == glm::vec3(0.0f)) break;
+
+        if(depth >= pathSettings.rouletteDepth)
+        {
+            float q = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+            if(!probability(q, sampler)) break;
+            throughput /= q;
+        }
+
+        from.p = rec.p;
+        from.n = rec.n;
+        from.bsdfPdf = rec.mat->isSpecular() ? 0.0f : 1.0f/pdfinverse;
+        ray = Ray(rec.p + 0.001f*sampledNormal, sampledNormal);
+        hit = traceRay(ray);
+        //As in computeColor, escaping secondary rays carry no sky radiance
+        if(!hit.second) break;
+    }
+    return L;
+}
+
+color Scene::sampleRadiance(Ray ray, const std::pair<HitRecord,int> &hit, int numberOfBounces, Sampler &sampler) const
+{
+    if(pathSettings.iterative) return integratePath(ray, hit, sampler);
+    return computeColor(ray, hit, numberOfBounces, sampler);
+}
+
+color Scene::tracePath(Ray ray, int numberOfSamples, int numberOfBounces, Sampler &sampler) const
 {
     color c = glm::vec3(0.0f);
+    std::pair<HitRecord,int> hit;
+    if(pathSettings.reusePrimaryHit) hit = traceRay(ray);
     for(int i=0;i<numberOfSamples;i++)
     {
-        c += computeColor(ray, numberOfBounces);
+        sampler.startNextSample();
+        if(!pathSettings.reusePrimaryHit) hit = traceRay(ray);
+        c += sampleRadiance(ray, hit, numberOfBounces, sampler);
     }
     color direct_light = glm::vec3(0.0f);
-    std::pair<HitRecord,int> hit = traceRay(ray);
-    if(hit.second) direct_light+= radiance(hit.first);
-    if(hit.second) direct_light+= radianceFromEmissive(hit.first);
+    if(!pathSettings.reusePrimaryHit) hit = traceRay(ray);
+    //With next event estimation point lights are sampled along the path instead
+    if(hit.second && !pathSettings.nextEventEstimation) direct_light+= radiance(hit.first);
+    if(hit.second) direct_light+= radianceFromEmissive(hit.first, sampler);
 
     return (c/(float)numberOfSamples + direct_light);
 }
 
+color Scene::tracePath(Ray ray, const std::pair<HitRecord,int> &hit, color direct, int numberOfSamples,
+                       int numberOfBounces, Sampler &sampler) const
+{
+    color c = glm::vec3(0.0f);
+    for(int i=0;i<numberOfSamples;i++)
+    {
+        sampler.startNextSample();
+        c += sampleRadiance(ray, hit, numberOfBounces, sampler);
+    }
+    std::pair<HitRecord,int> primary = hit;
+    if(primary.second) direct += radianceFromEmissive(primary.first, sampler);
+    return (c/(float)numberOfSamples + direct);
+}
+
+color Scene::tracePixel(int i, int j, int w, int h, int numberOfSamples, int numberOfBounces, Sampler &sampler) const
+{
+    color c = glm::vec3(0.0f);
+    if(!pathSettings.reusePrimaryHit)
+    {
+        for(int s=0;s<numberOfSamples;s++)
+        {
+            sampler.startNextSample();
+            Ray ray = camera->make_ray(i, j, w, h, sampler.getPixel2D());
+            std::pair<HitRecord,int> hit = traceRay(ray);
+            c += sampleRadiance(ray, hit, numberOfBounces, sampler);
+            if(hit.second && !pathSettings.nextEventEstimation) c += radiance(hit.first);
+            if(hit.second) c += radianceFromEmissive(hit.first, sampler);
+        }
+        return c/(float)numberOfSamples;
+    }
+
+    //One jittered primary ray per k x k stratum of the pixel, the stratum's
+    //samples all branch from its cached hit
+    int k = std::max(1, pathSettings.primaryStrata);
+    while(k > 1 && k*k > numberOfSamples) k--;
+    int strata = k*k;
+    for(int stratum=0;stratum<strata;stratum++)
+    {
+        int first = numberOfSamples*stratum/strata, last = numberOfSamples*(stratum+1)/strata;
+        Ray ray = Ray(glm::vec3(0.0f), glm::vec3(0.0f));
+        std::pair<HitRecord,int> hit;
+        color direct = glm::vec3(0.0f);
+        for(int s=first;s<last;s++)
+        {
+            sampler.startNextSample();
+            //Every sample draws its pixel dimensions so later dimensions stay aligned
+            glm::vec2 u = sampler.getPixel2D();
+            if(s == first)
+            {
+                glm::vec2 jitter = glm::vec2((stratum % k + u.x)/k, (stratum / k + u.y)/k);
+                ray = camera->make_ray(i, j, w, h, jitter);
+                hit = traceRay(ray);
+                if(hit.second && !pathSettings.nextEventEstimation) direct = radiance(hit.first);
+            }
+            c += sampleRadiance(ray, hit, numberOfBounces, sampler);
+            if(hit.second) c += direct + radianceFromEmissive(hit.first, sampler);
+        }
+    }
+    return c/(float)numberOfSamples;
+}
+
 //Camera functions
 Camera::Camera(float fov, float width, float height) : fov(fov), width(width), height(height)
 {
@@ -175,34 +378,26 @@ Camera::Camera(float fov, float width, float height) : fov(fov), width(width), h
 }
 //Scene functions
 color Scene::getColor(Ray ray, int depth) const
+{
+    IndependentSampler sampler;
+    return getColor(ray, depth, sampler);
+}
+
+color Scene::getColor(Ray ray, int depth, Sampler &sampler) const
 {
     //exceeded the recursion depth
     if(depth<0) return glm::vec3(0.0f);
 
-    HitRecord rec = HitRecord();
-    Interval t_range = Interval(0.001f, std::numeric_limits<float>::max());
+    std::pair<HitRecord,int> hit = traceRay(ray);
+    HitRecord rec = hit.first;
+    int no_of_hits = hit.second;
     color c = glm::vec3(0);
-    int no_of_hits = 0;
-    for(auto const &obj:objects)
+    if(no_of_hits)
     {
-        if(obj->hit(ray, t_range, rec)) 
-        {
-            // std::cout<<to_string(rec.n)<<std::endl;
-            // std::cout<<to_string(rec.p)<<std::endl;
-            if(!obj->mat) {c = (float)0.5 * (rec.n + glm::vec3(1));}
-            else
-            {
-                c = radiance(rec)+rec.mat->emission(rec,ray.d); // if hit is at a light source, adjust
-                // if(depth==0) std::cout<<" "<<to_string(c)<<std::endl;
-                // std::cout<<to_string(radiance(rec))<<std::endl;
-            }
-            no_of_hits++;
-            t_range.max=std::min(t_range.max, rec.t);
-        }
+        if(!rec.mat) {c = (float)0.5 * (rec.n + glm::vec3(1));}
         else
         {
-            // std::cout<<"no hit"<<std::endl;
-            // std::cout<<to_string(ray.o)<<" "<<to_string(ray.d)<<std::endl;
+            c = radiance(rec)+rec.mat->emission(rec,ray.d); // if hit is at a light source, adjust
         }
     }
     // std::cout<<"check "<<to_string(c)<<std::endl;
@@ -212,11 +407,11 @@ color Scene::getColor(Ray ray, int depth) const
         //some object was hit, we now need to find if something was reflected from this object
         //Get the reflection coefficient and the reflected direction
         glm::vec3 kr = glm::vec3(0.0f), r = glm::vec3(0.0f), reflectedColor = glm::vec3(0.0f);
-        if(rec.mat && rec.mat->reflection(rec,ray.o-rec.p, r, kr))
+        if(rec.mat && rec.mat->reflection(rec,ray.o-rec.p, r, kr, sampler))
         {
             //calculate the reflected color. bias added
             Ray reflectedRay = Ray(rec.p + 0.001f*rec.n, r);
-            reflectedColor = getColor(reflectedRay, depth-1);
+            reflectedColor = getColor(reflectedRay, depth-1, sampler);
             // reflectedColor *= rec.mat->brdf(rec, r, ray.o-rec.p);
             if(reflectedColor.x < 0 || reflectedColor.y < 0 || reflectedColor.z < 0)
             {
@@ -8,45 +8,39 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include "sampler.hpp"
+#include "flat_array.hpp"
 #include <random>
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+#include <limits>
+#include <cmath>
 
 using color = glm::vec3;
 
 class Ray;
 class Interval;
+class AABB;
+class BVH;
 class Shape;
 class HitRecord;
 class Object;
 class Material;
 class PointLight;
 class Camera;
+class Emitter;
+class Scene;
 
-bool probability(float p);
-glm::vec3 sampleCosineHemisphere(const glm::vec3& normal);
-glm::vec3 sampleCosineHemisphereLocal();
+bool probability(float p, Sampler &sampler);
+glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, Sampler &sampler);
+glm::vec3 sampleCosineHemisphereLocal(Sampler &sampler);
 glm::vec3 toWorldSpace(const glm::vec3& local, const glm::vec3& normal);
 float cosineHemispherePDF(const glm::vec3& normal, const glm::vec3& dir);
 
-class Scene {
-public:
-    Camera *camera;
-    std::vector<Object*> objects;
-    std::vector<PointLight> lights;
-    color sky = glm::vec3(0.0f);
-    color ambientLight = glm::vec3(0.0f);
-    color getColor(Ray ray, int depth = 2) const;
-    color tracePath(Ray ray, int numberOfSamples, int numberOfBounces) const;
-    color computeColor(Ray ray, int numberOfBounces) const;
-    bool inShadow(glm::vec3 p, PointLight light) const;
-    glm::vec3 irradiance(HitRecord &rec, PointLight light) const;
-    color radiance(HitRecord &rec) const;
-    color radianceFromEmissive(HitRecord &rec) const;
-    std::pair<HitRecord,int> traceRay(Ray ray) const;
-};
-
 class Ray {
 public:
     glm::vec3 o, d;
@@ -70,6 +64,7 @@ public:
     Camera();
     Camera(float fov, float width, float height);
     Ray make_ray(float x, float y) const; // screen coordinates in [-1, 1]
+    Ray make_ray(int i, int j, int w, int h, glm::vec2 jitter) const; // pixel (i, j) of a w x h image, jitter in [0, 1)^2
     glm::vec3 getLocation();
     void transformCamera(glm::mat4 transform);
     void debugCamera();
@@ -87,27 +82,218 @@ public:
     }
 };
 
+//Up to 64 rays traced together, stored as structure of arrays. Bit i of
+//active marks ray i as in use.
+class RayPacket {
+public:
+    static const int maxSize = 64;
+    float ox[maxSize], oy[maxSize], oz[maxSize];
+    float dx[maxSize], dy[maxSize], dz[maxSize];
+    float idx[maxSize], idy[maxSize], idz[maxSize];     //1/d, as the single ray traversal computes it
+    float tmin[maxSize], tmax[maxSize];
+    uint64_t active = 0;
+    void set(int i, const Ray &ray, Interval t_range);
+    Ray ray(int i) const {
+        return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+    }
+};
+
+class AABB {
+public:
+    glm::vec3 lo, hi;
+    AABB():
+        lo(glm::vec3(std::numeric_limits<float>::max())),
+        hi(glm::vec3(-std::numeric_limits<float>::max())) {
+    }
+    AABB(glm::vec3 lo, glm::vec3 hi):
+        lo(lo),
+        hi(hi) {
+    }
+    static AABB infinite() {
+        float inf = std::numeric_limits<float>::infinity();
+        return AABB(glm::vec3(-inf), glm::vec3(inf));
+    }
+    void expand(const glm::vec3 &p) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    void expand(const AABB &b) {
+        lo = glm::min(lo, b.lo);
+        hi = glm::max(hi, b.hi);
+    }
+    glm::vec3 centroid() const {
+        return 0.5f*(lo + hi);
+    }
+    bool isEmpty() const {
+        return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z;
+    }
+    bool isFinite() const {
+        return std::isfinite(lo.x) && std::isfinite(lo.y) && std::isfinite(lo.z) &&
+               std::isfinite(hi.x) && std::isfinite(hi.y) && std::isfinite(hi.z);
+    }
+    float surfaceArea() const {
+        if(isEmpty()) return 0.0f;
+        glm::vec3 e = hi - lo;
+        return 2.0f*(e.x*e.y + e.y*e.z + e.z*e.x);
+    }
+    // Slab test, invD is 1/ray.d. Returns the entry distance through tEntry
+    bool hit(const Ray &ray, const glm::vec3 &invD, float tmin, float tmax, float &tEntry) const;
+};
+
+class BVHBuildOptions {
+public:
+    enum SplitMethod { Median, SAH };
+    SplitMethod splitMethod = SAH;
+    int maxLeafSize = 4;
+    int binCount = 16;          //SAH candidate planes per axis is binCount-1
+    float traversalCost = 1.0f; //relative to Shape::intersectionCost()
+    int parallelDepth = -1;     //levels built on separate threads, -1 picks from the core count
+    int parallelMinPrimitives = 4096;
+    int width = 4;              //children per node of the hierarchy the compiled scene traverses, 2 or 4
+};
+
+class BVHStats {
+public:
+    int nodeCount = 0, leafCount = 0, maxDepth = 0;
+    std::vector<int> leafSizeHistogram;  //leafSizeHistogram[k] is the number of leaves with k primitives
+    float sahCost = 0.0f;                //expected cost of a random ray hitting the root bounds
+    double buildMilliseconds = 0.0;
+    void print() const;
+};
+
+//Binary bounding volume hierarchy over a list of primitive bounds. Primitives
+//are referred to by their index in the list passed to build(), primitives
+//with infinite bounds (planes) are kept out of the tree and always visited.
+class BVH {
+public:
+    struct Node {
+        AABB bounds;
+        int left = -1, right = -1;  //children, internal nodes only
+        int first = 0, count = 0;   //range in indices, leaves only
+        bool isLeaf() const { return count > 0; }
+    };
+    FlatArray<Node> nodes;
+    FlatArray<int> indices;
+    FlatArray<int> unbounded;
+    std::vector<float> costs;   //per primitive intersection cost used by the SAH
+    int primitiveCount = 0;
+    BVHBuildOptions options;
+    double buildMilliseconds = 0.0;
+    static const int maxDepth = 60;  //bounds the traversal stack
+
+    //costs may be empty, every primitive then costs 1
+    void build(const std::vector<AABB> &bounds, const std::vector<float> &costs = std::vector<float>());
+    bool empty() const { return primitiveCount == 0; }
+    BVHStats stats() const;
+    //Sum of the costs of indices[first, first+count)
+    float primitiveCost(int first, int count) const;
+    //Replaces the subtree under node, whose primitives are indices[first,
+    //first+n), by sub, built over those n primitives with prims[k] as its
+    //primitive k. node keeps its index and takes sub's root, the other nodes
+    //of sub are appended and the old ones are left unused.
+    void replaceSubtree(int node, int first, const BVH &sub, const int *prims);
+
+    //Calls visit(primitive, tmax) for every primitive whose leaf the ray
+    //reaches within [t_range.min, tmax]. The visitor may shrink tmax and
+    //returns true to stop the traversal.
+    template<typename F>
+    void traverse(const Ray &ray, Interval t_range, F &&visit) const;
+    //Like traverse, but skips the unbounded primitives and calls
+    //visitLeaf(node, tmax) once per leaf reached. steps, if given, is
+    //incremented for every node visited.
+    template<typename F>
+    void traverseLeaves(const Ray &ray, Interval t_range, F &&visitLeaf, long *steps = nullptr) const;
+
+private:
+    int buildNode(std::vector<Node> &out, const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+                  int first, int count, int depth, int parallelDepth);
+    int splitMedian(const std::vector<glm::vec3> &centroids, const AABB &centroidBox, int first, int count);
+    int splitSAH(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids, const AABB &box,
+                 const AABB &centroidBox, int first, int count);
+};
+
+//Four-wide hierarchy collapsed from a binary BVH. Nodes keep the bounds of
+//their children as structure of arrays so a ray tests all four with one SIMD
+//slab test. Leaves are the leaves of the binary BVH.
+class MBVH {
+public:
+    struct Node {
+        float lox[4], loy[4], loz[4], hix[4], hiy[4], hiz[4];
+        int child[4];       //MBVH node index, or leafChild(BVH node index)
+        int count = 0;      //children in use, from slot 0
+    };
+    FlatArray<Node> nodes;
+    std::vector<int> source;    //per node, the BVH node it was collapsed from, not kept in scene caches
+
+    static int leafChild(int bvhNode) { return -1 - bvhNode; }
+    static bool isLeaf(int child) { return child < 0; }
+    static int leafNode(int child) { return -1 - child; }
+
+    void build(const BVH &bvh);
+    //Appends the nodes collapsed from the subtree of bvhNode, an internal
+    //node, and returns the index of their root, the first of them
+    int collapse(const BVH &bvh, int bvhNode);
+    bool empty() const { return nodes.empty(); }
+    //Same contract as BVH::traverseLeaves, leaves are reported by their BVH
+    //node index and in front to back order of their entry distance. root is
+    //the child code of the subtree to walk, the whole hierarchy by default.
+    template<typename F>
+    void traverseLeaves(const Ray &ray, Interval t_range, F &&visitLeaf, long *steps = nullptr, int root = 0) const;
+    //Same contract as BVH::traverse for the bvh this was built from
+    template<typename F>
+    void traverse(const BVH &bvh, const Ray &ray, Interval t_range, F &&visit) const;
+    //Bit i is set if the ray enters child i within [tmin, tmax], at tEntry[i].
+    //The slab test is AABB::hit lane by lane.
+    static unsigned intersectChildren(const Node &node, const glm::vec3 &o, const glm::vec3 &invD,
+                                      float tmin, float tmax, float *tEntry);
+};
+
 class HitRecord {
 public:
     float t;
     glm::vec3 p, n;
     Material *mat;
+    int object;     //index in Scene::objects, set by Scene::traceRay
     HitRecord();
 };
 
+//Affine transform stored as the top 3x4 block of a 4x4 matrix. Identity
+//transforms are flagged so applying them costs nothing.
+class AffineTransform {
+public:
+    glm::vec3 m[4];     //columns, m[3] is the translation
+    bool identity = true;
+    AffineTransform() {
+        m[0] = glm::vec3(1.0f, 0.0f, 0.0f);
+        m[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+        m[2] = glm::vec3(0.0f, 0.0f, 1.0f);
+        m[3] = glm::vec3(0.0f);
+    }
+    explicit AffineTransform(const glm::mat4 &M);
+    glm::vec3 point(const glm::vec3 &p) const {
+        if(identity) return p;
+        return m[0]*p.x + m[1]*p.y + m[2]*p.z + m[3];
+    }
+    glm::vec3 vector(const glm::vec3 &v) const {
+        if(identity) return v;
+        return m[0]*v.x + m[1]*v.y + m[2]*v.z;
+    }
+    glm::mat4 toMat4() const;
+};
+
 class Object {
 public:
     Shape *shape;
     Material *mat;
-    glm::mat4 transform, normalTransform, inverse;    //Metallic materials
+    AffineTransform transform, normalTransform, inverse;    //all identity unless setTransform() is called
     Object(Shape *shape, Material *mat, glm::mat4 M=glm::mat4(1.0)):
         shape(shape),
         mat(mat) {
-            transform = glm::mat4(1.0);
-            normalTransform = glm::mat4(1.0);
-            inverse = glm::mat4(1.0);
     }
-    bool hit(Ray ray, Interval t_range, HitRecord &rec) const;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const;
+    //True if the ray hits the object anywhere inside t_range
+    bool occluded(const Ray &ray, Interval t_range) const;
+    AABB worldBounds() const;
     void setTransform(glm::mat4 M);
     void debugTransform();
     ~Object() {
@@ -118,7 +304,13 @@ class Shape {
 public:
     bool isRectangle = false;
     glm::vec3 center = glm::vec3(0.0f);
-    virtual bool hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const = 0;
+    //ray is in object space and its direction need not be normalized
+    virtual bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const = 0;
+    //Any-hit test for shadow rays, no hit point or normal. Defaults to hit()
+    virtual bool occluded(const Ray &ray, Interval t_range) const;
+    virtual AABB bounds() const { return AABB::infinite(); }  //object space
+    virtual float intersectionCost() const { return 1.0f; }   //relative cost of hit(), used by the SAH
+    virtual ~Shape() {}
 };
 
 class Sphere: public Shape {
@@ -130,28 +322,60 @@ public:
         r(radius) {
             center = cent;
     }
-    bool hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const;
+    bool occluded(const Ray &ray, Interval t_range) const override;
+    AABB bounds() const override;
 };
 
 class Plane: public Shape {
 public: 
     glm::vec3 point, normal;
     Plane(glm::vec3 pt, glm::vec3 n): point(pt), normal(n) { center = point; };
-    bool hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const override;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const override;
+    bool occluded(const Ray &ray, Interval t_range) const override;
 };
 
 class Box: public Shape {
 public:
     glm::vec3 low, hi;
     Box(glm::vec3 minpt, glm::vec3 maxpt): low(minpt), hi(maxpt) { center = hi+(low-hi)/2.0f; };
-    bool hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const override;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const override;
+    bool occluded(const Ray &ray, Interval t_range) const override;
+    AABB bounds() const override;
 };
 
 class Rectangle: public Shape {
 public:
     glm::vec3 low, hi;
     Rectangle(glm::vec3 minpt, glm::vec3 maxpt): low(minpt), hi(maxpt) { center = hi+(low-hi)/2.0f; isRectangle=true; };
-    bool hit(Ray ray, Interval t_range, HitRecord &rec, glm::mat4 tf, glm::mat4 itf, glm::mat4 ntf) const override;
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const override;
+    bool occluded(const Ray &ray, Interval t_range) const override;
+    AABB bounds() const override;
+};
+
+//Shapes in a frame of their own under a BVH built once for them, used as
+//one Shape. Any number of objects may reference a group, each placing it
+//with its own transform and material: the geometry is stored once and the
+//scene BVH holds one primitive per instance, whose rays reach the group in
+//its frame only after the scene BVH reached the instance. Groups may hold
+//groups and meshes. The shapes are not owned.
+class ShapeGroup: public Shape {
+public:
+    std::vector<Object> members;    //their materials are not used, hits get the instance's
+    BVH bvh;
+    MBVH mbvh;                      //built too if bvh.options.width is 4, traversed instead
+    //Adds shape with M applied about its center, as Object::setTransform does
+    void add(Shape *shape, const glm::mat4 &M = glm::mat4(1.0f));
+    //Builds the BVH over the members, after the last add
+    void build();
+    bool hit(const Ray &ray, Interval t_range, HitRecord &rec) const override;
+    bool occluded(const Ray &ray, Interval t_range) const override;
+    AABB bounds() const override { return box; }
+    float intersectionCost() const override { return cost; }
+
+private:
+    AABB box;
+    float cost = 1.0f;
 };
 
 class Material {
@@ -163,7 +387,16 @@ public:
     }
     virtual color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const = 0;
     virtual bool reflection(const HitRecord &rec, glm::vec3 v,
-                            glm::vec3 &r, color &kr) const = 0;
+                            glm::vec3 &r, color &kr, Sampler &sampler) const = 0;
+    //Solid angle density of reflection() returning direction l
+    virtual float pdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const {
+        return 0.0f;
+    }
+    //Specular materials are skipped by light sampling
+    virtual bool isSpecular() const {
+        return false;
+    }
+    virtual ~Material() {}
 };
 
 class Lambertian: public Material {
@@ -171,7 +404,8 @@ public:
     Lambertian(color _albedo) { albedo = _albedo; }
     virtual color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const;
     virtual bool reflection(const HitRecord &rec, glm::vec3 v,
-                            glm::vec3 &r, color &kr) const;
+                            glm::vec3 &r, color &kr, Sampler &sampler) const;
+    virtual float pdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const;
 };
 
 class Metallic: public Material {
@@ -182,7 +416,8 @@ public:
         albedo = _albedo;
     }
     virtual color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const;
-    virtual bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const;
+    virtual bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const;
+    virtual bool isSpecular() const { return true; }
 };
 
 class TorrenceSparrow: public Material {
@@ -194,7 +429,8 @@ public:
         parallelReflection(parallelReflection), roughness(roughness), albedo(albedo) {
     }
     virtual color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const;
-    virtual bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr) const;
+    virtual bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const;
+    virtual bool isSpecular() const { return true; }
 };
 
 class Emissive: public Material {
@@ -208,7 +444,7 @@ public:
         return glm::vec3(1.0f);
     }
     virtual bool reflection(const HitRecord &rec, glm::vec3 v,
-                            glm::vec3 &r, color &kr) const;
+                            glm::vec3 &r, color &kr, Sampler &sampler) const;
 };
 
 class EmissiveRectangle: public Material {
@@ -222,7 +458,7 @@ public:
         return glm::vec3(1.0f);
     }
     virtual bool reflection(const HitRecord &rec, glm::vec3 v,
-                            glm::vec3 &r, color &kr) const;
+                            glm::vec3 &r, color &kr, Sampler &sampler) const;
 };
 
 class PointLight {
@@ -232,4 +468,426 @@ public:
     PointLight(glm::vec3 location, color intensity): location(location),intensity(intensity) {}
 };
 
+//Conservative bounds on the position, power and emission directions of a
+//group of lights, used to estimate their contribution at a shading point
+class LightBounds {
+public:
+    AABB bounds;
+    float power = 0.0f;
+    glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);  //emitter normals lie within acos(cosTheta_o) of axis
+    float cosTheta_o = -1.0f;
+    float cosTheta_e = 0.0f;    //and emit up to acos(cosTheta_e) away from the normal
+    bool twoSided = false;
+    //n may be zero, the receiver orientation is then ignored
+    float importance(const glm::vec3 &p, const glm::vec3 &n) const;
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+};
+
+//Binary hierarchy with one light per leaf. A light is picked by descending
+//from the root, choosing each child in proportion to its importance.
+class LightBVH {
+public:
+    struct Node {
+        LightBounds bounds;
+        int left = -1, right = -1;  //children, internal nodes only
+        int light = -1;             //leaves only
+        int parent = -1;
+    };
+    FlatArray<Node> nodes;
+    FlatArray<int> leafOf;    //leaf node of every light
+    void build(const std::vector<LightBounds> &lights);
+    bool empty() const { return nodes.empty(); }
+    //Returns -1 if no light can contribute at p
+    int sample(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const;
+    float pmf(int light, const glm::vec3 &p, const glm::vec3 &n) const;
+
+private:
+    int buildNode(const std::vector<LightBounds> &lights, std::vector<int> &order, int first, int count, int parent);
+};
+
+//A light prepared for sampling in world space: an emissive sphere or
+//rectangle object, or one of the scene's point lights
+class Emitter {
+public:
+    enum Type { SphereLight, RectangleLight, PointSource };
+    Type type = SphereLight;
+    int object = -1;            //index in Scene::objects, -1 for point lights
+    color Le = glm::vec3(0.0f); //intensity for point lights
+    glm::vec3 center = glm::vec3(0.0f);     //SphereLight and PointSource
+    float radius = 0.0f;
+    glm::vec3 corner = glm::vec3(0.0f), edge0 = glm::vec3(0.0f), edge1 = glm::vec3(0.0f);  //RectangleLight, corner + [0,1]^2 of the edges
+    glm::vec3 normal = glm::vec3(0.0f);
+    float area = 0.0f;
+    float power = 0.0f;         //emitted flux, luminance
+    bool isDelta() const { return type == PointSource; }
+    //Picks a point q on the emitter as seen from p, pdf is per solid angle at p
+    //and 1 for point lights. Returns false if p cannot be lit by the emitter.
+    bool sample(const glm::vec3 &p, glm::vec2 u, glm::vec3 &q, float &pdf) const;
+    float pdf(const glm::vec3 &p, const glm::vec3 &q) const;
+    LightBounds lightBounds() const;
+};
+
+//Where a BSDF-sampled ray started, used to MIS-weight the emission it finds
+class PathVertex {
+public:
+    glm::vec3 p = glm::vec3(0.0f), n = glm::vec3(0.0f);
+    float bsdfPdf = 0.0f;   //0 for camera rays and specular bounces, their emission counts fully
+};
+
+class PathSettings {
+public:
+    bool iterative = false;     //integratePath instead of the recursive computeColor
+    int maxDepth = 16;          //hard limit on path segments in integratePath
+    int rouletteDepth = 2;      //segments before throughput-driven Russian roulette starts
+    bool reusePrimaryHit = false;   //intersect the camera ray once and branch every sample from that hit
+    int primaryStrata = 1;      //with reusePrimaryHit, tracePixel shoots k x k jittered primary rays
+    bool nextEventEstimation = false;   //sample an emitter at every vertex, combined with BSDF sampling by MIS
+    bool lightTree = true;      //pick emitters with the light BVH, otherwise by power alone
+};
+
+//Flat copy of a scene's primitives for intersection without pointer chasing
+//or virtual calls. Each shape type has its own structure-of-arrays block,
+//filled leaf by leaf in BVH order so that the primitives of one type in a
+//leaf are contiguous. Other shape types still go through Object::hit.
+class CompiledScene {
+public:
+    enum PrimitiveType { SphereType, BoxType, PlaneType, RectangleType, OtherType, TypeCount };
+    struct Spheres {
+        FlatArray<float> cx, cy, cz, r;
+        FlatArray<int> object, transform;
+    };
+    struct Boxes {
+        FlatArray<float> lox, loy, loz, hix, hiy, hiz;
+        FlatArray<int> object, transform;
+    };
+    struct Planes {
+        FlatArray<float> px, py, pz, nx, ny, nz;
+        FlatArray<int> object, transform;
+    };
+    struct Rectangles {
+        FlatArray<float> minx, maxx, minz, maxz, y;
+        FlatArray<int> object, transform;
+    };
+    //Primitives of one BVH leaf, or the unbounded ones, in every block
+    struct Range {
+        int first[TypeCount] = {0, 0, 0, 0, 0};
+        int count[TypeCount] = {0, 0, 0, 0, 0};
+        int plain[TypeCount] = {0, 0, 0, 0, 0};     //leading primitives without a transform
+    };
+    struct ObjectTransform {
+        AffineTransform toWorld, toObject, normalToWorld;
+    };
+    //A rectangle as its shape gives it, for the light estimate of Scene::radianceFromEmissive
+    struct RectangleSource {
+        glm::vec3 low, hi;
+        int object;
+    };
+
+    Spheres spheres;
+    Boxes boxes;
+    Planes planes;
+    Rectangles rectangles;
+    std::vector<const Object*> others;
+    std::vector<int> otherIndex;                //object index of every entry in others
+    FlatArray<ObjectTransform> transforms;      //referenced by the blocks, -1 is the identity
+    std::vector<int> transformOf;               //per object, its entry in transforms or -1, not kept in scene caches
+    std::vector<Material*> materials;           //distinct materials
+    FlatArray<int> materialIndex;               //material of every object
+    FlatArray<Range> leaves;                    //per BVH node, set for leaves only
+    FlatArray<RectangleSource> rectangleSources;    //in object order
+    Range unbounded;
+    BVH bvh;
+    MBVH mbvh;                                  //traversed instead of bvh when bvh.options.width is 4
+    int objectCount = 0;
+
+    bool empty() const { return objectCount == 0; }
+    //Uses scene.bvh, which must be built
+    void build(const Scene &scene);
+    //Same results as the pointer-based scan, including ties between objects.
+    //steps, if given, counts the hierarchy nodes visited.
+    bool intersect(const Ray &ray, Interval t_range, HitRecord &rec, long *steps = nullptr) const;
+    bool occluded(const Ray &ray, Interval t_range, bool skipRectangles = false, long *steps = nullptr) const;
+    //Packet versions, every active ray gets the result the single ray query
+    //gives. Packets walk the MBVH together and are culled against each child
+    //box as a whole first. Without an MBVH the rays are traced one by one.
+    uint64_t intersect(const RayPacket &packet, HitRecord *recs, long *steps = nullptr) const;
+    uint64_t occluded(const RayPacket &packet, bool skipRectangles = false, long *steps = nullptr) const;
+    //Compiles the objects prims again, with their current transformOf, into
+    //new entries at the end of the blocks. For the leaves Scene::update
+    //changes, the old entries are left unused.
+    Range recompile(const Scene &scene, const int *prims, int count);
+
+private:
+    struct Closest;
+    Range append(const Scene &scene, const int *prims, int count);
+    //Padding so the kernels can always load 8 entries
+    void pad(bool padded);
+    void intersectRange(const Range &range, const Ray &ray, float tmin, float &tmax, Closest &best) const;
+    bool occludedRange(const Range &range, const Ray &ray, Interval t_range, bool skipRectangles) const;
+    void finish(const Closest &best, HitRecord &rec) const;
+};
+
+//Limits of Scene::update, on the SAH cost of the BVH over its cost right
+//after the last full build. Unlike BVHStats::sahCost neither is divided by
+//the surface area of the root, which grows as objects move out of it.
+class UpdateSettings {
+public:
+    float rebuildSubtrees = 1.2f;       //past this, degraded subtrees above the changed objects are rebuilt
+    float rebuildAll = 1.5f;            //past this, now or expected after the subtree rebuilds, the whole BVH is rebuilt
+    float subtreeGrowth = 2.0f;         //a subtree is degraded once its root's surface area grew this much
+    float maxSubtreeFraction = 0.25f;   //of the bounded objects, more are never rebuilt in subtrees
+};
+
+//What one Scene::update did
+class UpdateStats {
+public:
+    enum Action { Refit, PartialRebuild, FullRebuild };
+    Action action = Refit;
+    int changed = 0;
+    int nodesRefit = 0;                 //nodes whose bounds were recomputed
+    int subtreesRebuilt = 0, objectsRebuilt = 0;
+    float degradation = 1.0f;           //SAH cost over the cost after the last full build, after the update
+    double milliseconds = 0.0;
+    void print() const;
+};
+
+//Bookkeeping of Scene::update for the BVH it was set up for: where the bounds
+//of every node are kept and how far each has grown
+class BVHRefit {
+public:
+    std::vector<int> parent;            //per BVH node, -1 for the root
+    std::vector<int> primitives;        //per BVH node, primitives in its subtree
+    std::vector<float> builtArea;       //per BVH node, surface area when its subtree was built
+    std::vector<int> mbvhSlot;          //per BVH node, 4*MBVH node + slot holding its bounds, or -1
+    std::vector<int> mbvhNode;          //per BVH node, the MBVH node collapsed from it, or -1
+    std::vector<int> leafOf;            //per object, -1 if unbounded
+    double cost = 0.0;                  //SAH cost times the surface area of the root
+    double builtCost = 0.0;             //cost after the last full build
+    int unusedNodes = 0;                //left behind by subtree rebuilds
+    bool ready(const BVH &bvh) const { return !parent.empty() && parent.size() == bvh.nodes.size(); }
+};
+
+class Scene {
+public:
+    Camera *camera;
+    std::vector<Object*> objects;
+    BVH bvh;    //built by buildBVH(), must be rebuilt after objects change
+    CompiledScene compiled;     //built by buildBVH() along with bvh
+    std::vector<PointLight> lights;
+    FlatArray<Emitter> emitters;        //collected by buildEmitters(), objects first, then point lights
+    FlatArray<int> emitterOf;           //emitter index of every object, -1 if it is not sampled
+    FlatArray<float> emitterCdf;
+    LightBVH lightBVH;
+    color sky = glm::vec3(0.0f);
+    color ambientLight = glm::vec3(0.0f);
+    PathSettings pathSettings;
+    color getColor(Ray ray, int depth = 2) const;
+    color getColor(Ray ray, int depth, Sampler &sampler) const;
+    //Starts numberOfSamples samples from sampler, call sampler.startPixel() first
+    color tracePath(Ray ray, int numberOfSamples, int numberOfBounces, Sampler &sampler) const;
+    //tracePath with the primary hit and its point light radiance already known
+    color tracePath(Ray ray, const std::pair<HitRecord,int> &hit, color direct, int numberOfSamples,
+                    int numberOfBounces, Sampler &sampler) const;
+    //Like tracePath but every sample shoots its own ray jittered inside pixel (i, j)
+    color tracePixel(int i, int j, int w, int h, int numberOfSamples, int numberOfBounces, Sampler &sampler) const;
+    color computeColor(Ray ray, int numberOfBounces, Sampler &sampler) const;
+    color computeColor(Ray ray, const std::pair<HitRecord,int> &hit, int numberOfBounces, Sampler &sampler,
+                       const PathVertex &from = PathVertex()) const;
+    color integratePath(Ray ray, Sampler &sampler) const;
+    color integratePath(Ray ray, std::pair<HitRecord,int> hit, Sampler &sampler) const;
+    //Radiance along ray given its hit, with the integrator chosen in pathSettings
+    color sampleRadiance(Ray ray, const std::pair<HitRecord,int> &hit, int numberOfBounces, Sampler &sampler) const;
+    bool inShadow(glm::vec3 p, PointLight light) const;
+    //The ray and range inShadow tests, shared with the packet version of radiance
+    Ray shadowRay(glm::vec3 p, const PointLight &light, Interval &t_range) const;
+    //Any-hit query, stops at the first object hit inside t_range
+    bool occluded(const Ray &ray, Interval t_range, bool skipRectangles = false) const;
+    glm::vec3 irradiance(HitRecord &rec, PointLight light) const;
+    color radiance(HitRecord &rec) const;
+    //radiance for the hits in mask, with one shadow packet per light
+    void radiance(const std::pair<HitRecord,int> *hits, uint64_t mask, color *out) const;
+    color radianceFromEmissive(HitRecord &rec, Sampler &sampler) const;
+    //Light sampled direct illumination at rec, MIS weighted against the BSDF
+    color sampleDirectLight(const HitRecord &rec, glm::vec3 v, Sampler &sampler) const;
+    //sampleDirectLight without the visibility test: returns false if there is
+    //no contribution, otherwise Ld counts if visible(p, q)
+    bool sampleLightConnection(const HitRecord &rec, glm::vec3 v, Sampler &sampler, color &Ld,
+                               glm::vec3 &p, glm::vec3 &q) const;
+    //MIS weight of emission at rec found by a BSDF sample from 'from'
+    float emissionWeight(const PathVertex &from, const HitRecord &rec) const;
+    int pickEmitter(const glm::vec3 &p, const glm::vec3 &n, float u, float &pmf) const;
+    float emitterPmf(int emitter, const glm::vec3 &p, const glm::vec3 &n) const;
+    bool visible(glm::vec3 p, glm::vec3 q) const;
+    std::pair<HitRecord,int> traceRay(Ray ray) const;
+    //traceRay for every active ray of the packet
+    void traceRays(const RayPacket &packet, std::pair<HitRecord,int> *hits) const;
+    //Bit i is set if active ray i hits something inside its range
+    uint64_t occluded(const RayPacket &packet, bool skipRectangles = false) const;
+    //Also collects the emitters
+    void buildBVH(BVHBuildOptions options = BVHBuildOptions());
+    //Frame update after Object::setTransform was called for the objects in
+    //changed, with the same objects as the last buildBVH(): refits the
+    //bounds above them in the BVH, the compiled scene and the MBVH, at a
+    //cost that grows with changed.size() and not with the scene. Past the
+    //limits of updateSettings subtrees or the whole BVH are rebuilt. The
+    //emitters are collected again if one of the objects is one.
+    UpdateStats update(const std::vector<int> &changed);
+    UpdateSettings updateSettings;
+    BVHRefit refit;     //set up by the first update() after buildBVH()
+    void buildEmitters();
+    bool hasBVH() const;
+    bool hasCompiledScene() const;
+};
+
+template<typename F>
+void BVH::traverse(const Ray &ray, Interval t_range, F &&visit) const
+{
+    float tmax = t_range.max;
+    for(int prim: unbounded)
+    {
+        if(visit(prim, tmax)) return;
+    }
+    traverseLeaves(ray, Interval(t_range.min, tmax), [&](int node, float &tmax) {
+        for(int i = nodes[node].first; i < nodes[node].first + nodes[node].count; ++i)
+        {
+            if(visit(indices[i], tmax)) return true;
+        }
+        return false;
+    });
+}
+
+template<typename F>
+void BVH::traverseLeaves(const Ray &ray, Interval t_range, F &&visitLeaf, long *steps) const
+{
+    if(nodes.empty()) return;
+    float tmax = t_range.max;
+    glm::vec3 invD = 1.0f/ray.d;
+    int stack[maxDepth + 2];
+    int top = 0;
+    float tEntry;
+    if(!nodes[0].bounds.hit(ray, invD, t_range.min, tmax, tEntry)) return;
+    stack[top++] = 0;
+    while(top > 0)
+    {
+        int index = stack[--top];
+        const Node &node = nodes[index];
+        if(steps) ++*steps;
+        if(node.isLeaf())
+        {
+            if(visitLeaf(index, tmax)) return;
+            continue;
+        }
+        //Push the far child first so the near one is visited next
+        float tl, tr;
+        bool hl = nodes[node.left].bounds.hit(ray, invD, t_range.min, tmax, tl);
+        bool hr = nodes[node.right].bounds.hit(ray, invD, t_range.min, tmax, tr);
+        if(hl && hr)
+        {
+            if(tl <= tr) { stack[top++] = node.right; stack[top++] = node.left; }
+            else { stack[top++] = node.left; stack[top++] = node.right; }
+        }
+        else if(hl) stack[top++] = node.left;
+        else if(hr) stack[top++] = node.right;
+    }
+}
+
+inline unsigned MBVH::intersectChildren(const Node &node, const glm::vec3 &o, const glm::vec3 &invD,
+                                        float tmin, float tmax, float *tEntry)
+{
+    const float *bounds[3][2] = {{node.lox, node.hix}, {node.loy, node.hiy}, {node.loz, node.hiz}};
+#ifdef __SSE2__
+    //min_ps(t1, t0) and max_ps(t0, t1) pick like the swap in AABB::hit, and
+    //max_ps(near, tmin) and min_ps(far, tmax) ignore NaN slabs like it does
+    __m128 lo = _mm_set1_ps(tmin), hi = _mm_set1_ps(tmax);
+    for(int a = 0; a < 3; ++a)
+    {
+        __m128 origin = _mm_set1_ps(o[a]), inverse = _mm_set1_ps(invD[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[a][0]), origin), inverse);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[a][1]), origin), inverse);
+        lo = _mm_max_ps(_mm_min_ps(t1, t0), lo);
+        hi = _mm_min_ps(_mm_max_ps(t0, t1), hi);
+    }
+    _mm_storeu_ps(tEntry, lo);
+    return _mm_movemask_ps(_mm_cmple_ps(lo, hi)) & ((1u << node.count) - 1);
+#else
+    unsigned mask = 0;
+    for(int i = 0; i < node.count; ++i)
+    {
+        float lo = tmin, hi = tmax;
+        for(int a = 0; a < 3; ++a)
+        {
+            float t0 = (bounds[a][0][i] - o[a]) * invD[a];
+            float t1 = (bounds[a][1][i] - o[a]) * invD[a];
+            if(t0 > t1) std::swap(t0, t1);
+            lo = t0 > lo ? t0 : lo;
+            hi = t1 < hi ? t1 : hi;
+        }
+        tEntry[i] = lo;
+        if(lo <= hi) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+template<typename F>
+void MBVH::traverseLeaves(const Ray &ray, Interval t_range, F &&visitLeaf, long *steps, int root) const
+{
+    if(nodes.empty()) return;
+    float tmax = t_range.max;
+    glm::vec3 invD = 1.0f/ray.d;
+    //Every node pushes at most three more entries than it pops
+    int stack[3*BVH::maxDepth + 2];
+    float entry[3*BVH::maxDepth + 2];
+    int top = 0;
+    stack[top] = root;
+    entry[top++] = t_range.min;
+    while(top > 0)
+    {
+        --top;
+        //Skip subtrees that start beyond the closest hit found since the push
+        if(entry[top] > tmax) continue;
+        int index = stack[top];
+        if(steps) ++*steps;
+        if(isLeaf(index))
+        {
+            if(visitLeaf(leafNode(index), tmax)) return;
+            continue;
+        }
+        float tEntry[4];
+        unsigned mask = intersectChildren(nodes[index], ray.o, invD, t_range.min, tmax, tEntry);
+        //Sort the children hit by entry distance and push the farthest first
+        int order[4], hits = 0;
+        for(int i = 0; i < 4; ++i)
+        {
+            if(!(mask & (1u << i))) continue;
+            int k = hits++;
+            for(; k > 0 && tEntry[order[k - 1]] < tEntry[i]; --k) order[k] = order[k - 1];
+            order[k] = i;
+        }
+        for(int k = 0; k < hits; ++k)
+        {
+            stack[top] = nodes[index].child[order[k]];
+            entry[top++] = tEntry[order[k]];
+        }
+    }
+}
+
+template<typename F>
+void MBVH::traverse(const BVH &bvh, const Ray &ray, Interval t_range, F &&visit) const
+{
+    float tmax = t_range.max;
+    for(int prim: bvh.unbounded)
+    {
+        if(visit(prim, tmax)) return;
+    }
+    traverseLeaves(ray, Interval(t_range.min, tmax), [&](int node, float &tmax) {
+        const BVH::Node &leaf = bvh.nodes[node];
+        for(int i = leaf.first; i < leaf.first + leaf.count; ++i)
+        {
+            if(visit(bvh.indices[i], tmax)) return true;
+        }
+        return false;
+    });
+}
+
 #endif
@@ -0,0 +1,465 @@
+#include "scene_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+static const char cacheMagic[8] = {'R', 'T', 'S', 'C', 'A', 'C', 'H', 'E'};
+static const int maxSections = 64;
+static const size_t sectionAlignment = 64;
+
+class CacheSection {
+public:
+    uint64_t offset, bytes;
+};
+
+//Parameters of every material type, the materials are created again from them
+class StoredMaterial {
+public:
+    enum Type { LambertianType, MetallicType, TorrenceSparrowType, EmissiveType, EmissiveRectangleType };
+    int32_t type, shininess;
+    float roughness;
+    color albedo, ambientColor, parallelReflection, ownAlbedo, emittedRadiance;
+};
+
+//Everything but the arrays, followed by the sections: the arrays in the
+//order of forEachArray, then the materials
+class CacheHeader {
+public:
+    char magic[8];
+    uint32_t version, layout;
+    uint64_t fileSize, checksum;    //of the whole file, with checksum 0
+    uint64_t sourceSize;
+    int64_t sourceSeconds, sourceNanoseconds;
+    int32_t splitMethod, maxLeafSize, binCount, bvhWidth;
+    float traversalCost;
+    int32_t width, height;
+    RenderSettings settings;
+    PathSettings pathSettings;
+    float fov, cameraWidth, cameraHeight;
+    glm::vec3 center, view, up, right;
+    color sky, ambientLight;
+    CompiledScene::Range unbounded;
+    int32_t objectCount, primitiveCount;
+    uint32_t sectionCount;
+    CacheSection sections[maxSections];
+};
+
+//Changes when a stored structure does, so caches of other builds are rejected
+static uint32_t layoutSignature()
+{
+    size_t sizes[] = {sizeof(CacheHeader), sizeof(StoredMaterial), sizeof(BVH::Node), sizeof(MBVH::Node),
+                      sizeof(CompiledScene::Range), sizeof(CompiledScene::ObjectTransform),
+                      sizeof(CompiledScene::RectangleSource), sizeof(Emitter), sizeof(LightBVH::Node),
+                      sizeof(PointLight), sizeof(RenderSettings), sizeof(PathSettings)};
+    uint32_t h = 17;
+    for(size_t s:sizes) h = h*31 + (uint32_t)s;
+    return h;
+}
+
+//FNV-1a style over 64 bit words in four independent lanes
+static uint64_t checksum(const char *data, size_t size)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t lanes[4] = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull, 0x9ce484222325cbf2ull, 0x2325cbf29ce48422ull};
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32)
+    {
+        for(int l = 0; l < 4; ++l)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i + 8*l, 8);
+            lanes[l] = (lanes[l] ^ word)*prime;
+        }
+    }
+    for(; i < size; ++i) lanes[0] = (lanes[0] ^ (unsigned char)data[i])*prime;
+    uint64_t h = lanes[0];
+    for(int l = 1; l < 4; ++l) h = (h ^ lanes[l])*prime;
+    return h ^ size;
+}
+
+//Checksum of the header with its checksum field 0, then of the payload after it
+static uint64_t fileChecksum(const CacheHeader &header, const char *payload, size_t size)
+{
+    CacheHeader copy = header;
+    copy.checksum = 0;
+    return checksum(reinterpret_cast<const char*>(&copy), sizeof(copy))*0x100000001b3ull ^ checksum(payload, size);
+}
+
+//Whether range lies within the blocks of compiled
+static bool rangeFits(const CompiledScene::Range &range, const CompiledScene &compiled)
+{
+    size_t sizes[CompiledScene::TypeCount] = {compiled.spheres.object.size(), compiled.boxes.object.size(),
+                                              compiled.planes.px.size(), compiled.rectangles.y.size(),
+                                              compiled.others.size()};
+    for(int type = 0; type < CompiledScene::TypeCount; ++type)
+    {
+        if(range.first[type] < 0 || range.count[type] < 0 || range.plain[type] < 0 ||
+           range.plain[type] > range.count[type] || (size_t)range.first[type] + range.count[type] > sizes[type])
+            return false;
+    }
+    return true;
+}
+
+//Calls f on every array the cache stores, in file order
+template<typename S, typename F>
+static void forEachArray(S &scene, F &f)
+{
+    auto &c = scene.compiled;
+    f(c.spheres.cx); f(c.spheres.cy); f(c.spheres.cz); f(c.spheres.r);
+    f(c.spheres.object); f(c.spheres.transform);
+    f(c.boxes.lox); f(c.boxes.loy); f(c.boxes.loz); f(c.boxes.hix); f(c.boxes.hiy); f(c.boxes.hiz);
+    f(c.boxes.object); f(c.boxes.transform);
+    f(c.planes.px); f(c.planes.py); f(c.planes.pz); f(c.planes.nx); f(c.planes.ny); f(c.planes.nz);
+    f(c.planes.object); f(c.planes.transform);
+    f(c.rectangles.minx); f(c.rectangles.maxx); f(c.rectangles.minz); f(c.rectangles.maxz); f(c.rectangles.y);
+    f(c.rectangles.object); f(c.rectangles.transform);
+    f(c.transforms); f(c.materialIndex); f(c.leaves); f(c.rectangleSources);
+    f(c.bvh.nodes); f(c.bvh.indices); f(c.bvh.unbounded); f(c.mbvh.nodes);
+    f(scene.emitters); f(scene.emitterOf); f(scene.emitterCdf);
+    f(scene.lightBVH.nodes); f(scene.lightBVH.leafOf);
+    f(scene.lights);
+}
+
+class ArrayList {
+public:
+    std::vector<std::pair<const char*, size_t>> arrays;     //data and bytes
+    template<typename A>
+    void operator()(const A &a) {
+        arrays.push_back(std::make_pair(reinterpret_cast<const char*>(a.data()), a.size()*sizeof(*a.data())));
+    }
+};
+
+//Checks the sections against the element types, then points the arrays at them
+class ArrayMapper {
+public:
+    char *base;
+    const CacheHeader &header;
+    bool assign = false;
+    bool ok = true;
+    int next = 0;
+    ArrayMapper(char *base, const CacheHeader &header): base(base), header(header) {}
+    template<typename T>
+    void operator()(FlatArray<T> &a) {
+        const CacheSection &s = header.sections[next++];
+        if(!check<T>(s)) ok = false;
+        else if(assign) a.view(reinterpret_cast<T*>(base + s.offset), s.bytes/sizeof(T));
+    }
+    template<typename T>
+    void operator()(std::vector<T> &a) {
+        const CacheSection &s = header.sections[next++];
+        if(!check<T>(s)) ok = false;
+        else if(assign) a.assign(reinterpret_cast<T*>(base + s.offset), reinterpret_cast<T*>(base + s.offset + s.bytes));
+    }
+    template<typename T>
+    bool check(const CacheSection &s) const {
+        return s.offset >= sizeof(CacheHeader) && s.offset % sectionAlignment == 0 && s.bytes % sizeof(T) == 0 &&
+               s.offset <= header.fileSize && s.bytes <= header.fileSize - s.offset;
+    }
+};
+
+static bool sourceStamp(const std::string &path, uint64_t &size, int64_t &seconds, int64_t &nanoseconds)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return false;
+    size = st.st_size;
+    seconds = st.st_mtim.tv_sec;
+    nanoseconds = st.st_mtim.tv_nsec;
+    return true;
+}
+
+//SceneCache functions
+SceneCache::~SceneCache()
+{
+    unmap();
+}
+
+void SceneCache::unmap()
+{
+    if(mapping) munmap(mapping, mappingSize);
+    mapping = nullptr;
+    mappingSize = 0;
+    for(auto mat:materials) delete mat;
+    materials.clear();
+}
+
+bool SceneCache::open(const std::string &sourcePath, const std::string &cachePath, Scene &scene, BVHBuildOptions options)
+{
+    mapped = map(cachePath, sourcePath, options, scene);
+    if(mapped) return true;
+    if(!file.load(sourcePath, scene))
+    {
+        error = file.error;
+        return false;
+    }
+    width = file.width;
+    height = file.height;
+    settings = file.settings;
+    scene.buildBVH(options);
+    save(scene, file, sourcePath, cachePath, error);
+    return true;
+}
+
+bool SceneCache::save(const Scene &scene, const SceneFile &file, const std::string &sourcePath,
+                      const std::string &cachePath, std::string &error)
+{
+    const CompiledScene &compiled = scene.compiled;
+    if(!scene.hasCompiledScene() || !compiled.others.empty())
+    {
+        error = "the scene is not built or has shapes the cache does not know";
+        return false;
+    }
+    std::vector<StoredMaterial> stored(compiled.materials.size());
+    for(size_t k = 0; k < compiled.materials.size(); ++k)
+    {
+        const Material *mat = compiled.materials[k];
+        StoredMaterial &s = stored[k];
+        std::memset(static_cast<void*>(&s), 0, sizeof(s));
+        s.albedo = mat->albedo;
+        s.ambientColor = mat->ambientColor;
+        if(dynamic_cast<const Lambertian*>(mat)) s.type = StoredMaterial::LambertianType;
+        else if(const Metallic *m = dynamic_cast<const Metallic*>(mat))
+        {
+            s.type = StoredMaterial::MetallicType;
+            s.parallelReflection = m->parallelReflection;
+            s.shininess = m->shininess;
+        }
+        else if(const TorrenceSparrow *m = dynamic_cast<const TorrenceSparrow*>(mat))
+        {
+            s.type = StoredMaterial::TorrenceSparrowType;
+            s.parallelReflection = m->parallelReflection;
+            s.roughness = m->roughness;
+            s.ownAlbedo = m->albedo;
+        }
+        else if(const Emissive *m = dynamic_cast<const Emissive*>(mat))
+        {
+            s.type = StoredMaterial::EmissiveType;
+            s.emittedRadiance = m->emittedRadiance;
+        }
+        else if(const EmissiveRectangle *m = dynamic_cast<const EmissiveRectangle*>(mat))
+        {
+            s.type = StoredMaterial::EmissiveRectangleType;
+            s.emittedRadiance = m->emittedRadiance;
+        }
+        else
+        {
+            error = "the scene has a material the cache does not know";
+            return false;
+        }
+    }
+
+    ArrayList list;
+    forEachArray(scene, list);
+    list.arrays.push_back(std::make_pair(reinterpret_cast<const char*>(stored.data()), stored.size()*sizeof(StoredMaterial)));
+
+    CacheHeader header;
+    std::memset(static_cast<void*>(&header), 0, sizeof(header));
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.layout = layoutSignature();
+    if(!sourceStamp(sourcePath, header.sourceSize, header.sourceSeconds, header.sourceNanoseconds))
+    {
+        error = "cannot stat " + sourcePath;
+        return false;
+    }
+    const BVHBuildOptions &options = compiled.bvh.options;
+    header.splitMethod = options.splitMethod;
+    header.maxLeafSize = options.maxLeafSize;
+    header.binCount = options.binCount;
+    header.bvhWidth = options.width;
+    header.traversalCost = options.traversalCost;
+    header.width = file.width;
+    header.height = file.height;
+    header.settings = file.settings;
+    header.pathSettings = scene.pathSettings;
+    header.fov = scene.camera->fov;
+    header.cameraWidth = scene.camera->width;
+    header.cameraHeight = scene.camera->height;
+    header.center = scene.camera->center;
+    header.view = scene.camera->view;
+    header.up = scene.camera->up;
+    header.right = scene.camera->right;
+    header.sky = scene.sky;
+    header.ambientLight = scene.ambientLight;
+    header.unbounded = compiled.unbounded;
+    header.objectCount = compiled.objectCount;
+    header.primitiveCount = compiled.bvh.primitiveCount;
+    header.sectionCount = list.arrays.size();
+    uint64_t offset = sizeof(CacheHeader);
+    for(size_t k = 0; k < list.arrays.size(); ++k)
+    {
+        offset = (offset + sectionAlignment - 1)/sectionAlignment*sectionAlignment;
+        header.sections[k].offset = offset;
+        header.sections[k].bytes = list.arrays[k].second;
+        offset += list.arrays[k].second;
+    }
+    header.fileSize = offset;
+
+    //The payload goes through a buffer so the checksum covers the padding too
+    std::vector<char> payload(header.fileSize - sizeof(CacheHeader), 0);
+    for(size_t k = 0; k < list.arrays.size(); ++k)
+    {
+        if(list.arrays[k].second)
+            std::memcpy(payload.data() + header.sections[k].offset - sizeof(CacheHeader), list.arrays[k].first,
+                        list.arrays[k].second);
+    }
+    header.checksum = fileChecksum(header, payload.data(), payload.size());
+
+    //Written next to the cache and renamed, so readers never map a partial file
+    std::string temporary = cachePath + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(payload.data(), payload.size());
+        if(!out)
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            error = "cannot write " + temporary;
+            return false;
+        }
+    }
+    if(std::rename(temporary.c_str(), cachePath.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        error = "cannot write " + cachePath;
+        return false;
+    }
+    return true;
+}
+
+bool SceneCache::map(const std::string &cachePath, const std::string &sourcePath, const BVHBuildOptions &options,
+                     Scene &scene)
+{
+    unmap();
+    error.clear();
+    if(!scene.objects.empty())
+    {
+        error = "the scene is not empty";
+        return false;
+    }
+    int fd = ::open(cachePath.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        error = "no cache " + cachePath;
+        return false;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader))
+        data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        error = "cannot map " + cachePath;
+        return false;
+    }
+    mapping = data;
+    mappingSize = st.st_size;
+
+    char *base = static_cast<char*>(data);
+    const CacheHeader &header = *reinterpret_cast<const CacheHeader*>(base);
+    uint64_t sourceSize;
+    int64_t sourceSeconds, sourceNanoseconds;
+    const char *reason = nullptr;
+    if(std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0) reason = "not a scene cache";
+    else if(header.version != version || header.layout != layoutSignature()) reason = "cache of another version";
+    else if(header.fileSize != mappingSize) reason = "cache truncated";
+    else if(!sourceStamp(sourcePath, sourceSize, sourceSeconds, sourceNanoseconds) || sourceSize != header.sourceSize ||
+            sourceSeconds != header.sourceSeconds || sourceNanoseconds != header.sourceNanoseconds)
+        reason = "cache older than the scene file";
+    else if(header.splitMethod != options.splitMethod || header.maxLeafSize != options.maxLeafSize ||
+            header.binCount != options.binCount || header.bvhWidth != options.width ||
+            header.traversalCost != options.traversalCost)
+        reason = "cache built with other options";
+    if(reason)
+    {
+        error = reason;
+        unmap();
+        return false;
+    }
+
+    ArrayMapper mapper(base, header);
+    int arrays = 0;
+    {
+        ArrayList list;
+        forEachArray(scene, list);
+        arrays = list.arrays.size();
+    }
+    if(header.sectionCount == (uint32_t)arrays + 1) forEachArray(scene, mapper);
+    const CacheSection &materialSection = header.sections[arrays];
+    if(header.sectionCount != (uint32_t)arrays + 1 || !mapper.ok || !mapper.check<StoredMaterial>(materialSection) ||
+       (verify && fileChecksum(header, base + sizeof(CacheHeader), mappingSize - sizeof(CacheHeader)) != header.checksum))
+    {
+        error = "cache corrupt";
+        unmap();
+        return false;
+    }
+
+    const StoredMaterial *stored = reinterpret_cast<const StoredMaterial*>(base + materialSection.offset);
+    for(size_t k = 0; k < materialSection.bytes/sizeof(StoredMaterial); ++k)
+    {
+        const StoredMaterial &s = stored[k];
+        Material *mat;
+        switch(s.type)
+        {
+        case StoredMaterial::LambertianType: mat = new Lambertian(s.albedo); break;
+        case StoredMaterial::MetallicType: mat = new Metallic(s.parallelReflection, s.shininess, s.albedo); break;
+        case StoredMaterial::TorrenceSparrowType: mat = new TorrenceSparrow(s.parallelReflection, s.roughness, s.ownAlbedo); break;
+        case StoredMaterial::EmissiveType: mat = new Emissive(s.emittedRadiance); break;
+        case StoredMaterial::EmissiveRectangleType: mat = new EmissiveRectangle(s.emittedRadiance); break;
+        default:
+            error = "cache corrupt";
+            unmap();
+            return false;
+        }
+        mat->albedo = s.albedo;
+        mat->ambientColor = s.ambientColor;
+        materials.push_back(mat);
+    }
+
+    mapper.assign = true;
+    mapper.next = 0;
+    forEachArray(scene, mapper);
+    CompiledScene &compiled = scene.compiled;
+    //Indices into the arrays that come from the header, checked even
+    //without verify
+    if(!rangeFits(header.unbounded, compiled) || header.objectCount < 0 ||
+       (size_t)header.objectCount != compiled.materialIndex.size() || header.primitiveCount < 0)
+    {
+        scene.compiled = CompiledScene();
+        scene.emitters = FlatArray<Emitter>();
+        scene.emitterOf = FlatArray<int>();
+        scene.emitterCdf = FlatArray<float>();
+        scene.lightBVH = LightBVH();
+        scene.lights.clear();
+        error = "cache corrupt";
+        unmap();
+        return false;
+    }
+    compiled.materials = materials;
+    compiled.unbounded = header.unbounded;
+    compiled.objectCount = header.objectCount;
+    compiled.bvh.primitiveCount = header.primitiveCount;
+    compiled.bvh.options = options;
+    camera.fov = header.fov;
+    camera.width = header.cameraWidth;
+    camera.height = header.cameraHeight;
+    camera.center = header.center;
+    camera.view = header.view;
+    camera.up = header.up;
+    camera.right = header.right;
+    scene.camera = &camera;
+    scene.sky = header.sky;
+    scene.ambientLight = header.ambientLight;
+    scene.pathSettings = header.pathSettings;
+    width = header.width;
+    height = header.height;
+    settings = header.settings;
+    return true;
+}
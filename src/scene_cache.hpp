@@ -0,0 +1,49 @@
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include "scene_file.hpp"
+
+#include <string>
+
+//Built scenes saved as one file of flat arrays: the compiled primitive
+//blocks, the BVH and MBVH, emitters and light BVH, with the point lights,
+//camera, materials and settings. Mapping the file back (POSIX mmap, private)
+//points the scene's arrays at it, they are used in place without parsing or
+//building. Only the materials are created again, they have virtual methods.
+//A mapped scene has no Scene::objects, its compiled scene stands in for them.
+class SceneCache {
+public:
+    static const uint32_t version = 2;
+    int width = 800, height = 600;  //image size and render settings of the scene file
+    RenderSettings settings;
+    std::string error;              //why the last open failed, or did not use or write the cache
+    bool mapped = false;            //the last open used the cache
+    bool verify = true;             //checksum the arrays when mapping, one pass over the file
+    SceneCache() {}
+    SceneCache(const SceneCache&) = delete;
+    SceneCache &operator=(const SceneCache&) = delete;
+    ~SceneCache();
+    //Fills the empty scene with the scene file at sourcePath. Maps cachePath
+    //if it was written for the file as it is now and for options, otherwise
+    //loads the file, builds it and writes the cache again. The scene uses
+    //memory of the SceneCache, which must outlive it.
+    bool open(const std::string &sourcePath, const std::string &cachePath, Scene &scene,
+              BVHBuildOptions options = BVHBuildOptions());
+    //Maps the cache into the empty scene. Returns false if it is missing, of
+    //another version or layout, stale for sourcePath or options, or corrupt.
+    bool map(const std::string &cachePath, const std::string &sourcePath, const BVHBuildOptions &options, Scene &scene);
+    //Writes a scene built by buildBVH from the scene file at sourcePath.
+    //Fails for shapes or materials the cache does not know.
+    static bool save(const Scene &scene, const SceneFile &file, const std::string &sourcePath,
+                     const std::string &cachePath, std::string &error);
+
+private:
+    SceneFile file;
+    Camera camera;
+    std::vector<Material*> materials;
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    void unmap();
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "scene_file.hpp"
+#include "tokens.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+//SceneFile functions
+SceneFile::~SceneFile()
+{
+    for(auto obj:objects) delete obj;
+    for(auto shape:shapes) delete shape;
+    for(auto mat:materials) delete mat;
+    for(auto cam:cameras) delete cam;
+}
+
+bool SceneFile::load(const std::string &path, Scene &scene)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if(!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    begin(scene);
+    size_t slash = path.rfind('/');
+    directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    LineReader::Status status = LineReader::read(file, [this](char *begin, char *end) {
+        return parseLine(begin, end);
+    });
+    bool ok = status == LineReader::Done;
+    if(status == LineReader::LineTooLong)
+    {
+        lineNumber++;
+        fail("line too long");
+    }
+    else if(status == LineReader::ReadError) error = "cannot read " + path;
+    std::fclose(file);
+    return finish(scene, ok);
+}
+
+bool SceneFile::parse(const std::string &text, Scene &scene)
+{
+    begin(scene);
+    std::vector<char> buffer(text.begin(), text.end());
+    buffer.push_back('\n');
+    bool ok = true;
+    parseLines(buffer.data(), buffer.data() + buffer.size(), ok);
+    return finish(scene, ok);
+}
+
+void SceneFile::begin(const Scene &scene)
+{
+    error.clear();
+    materialNames.clear();
+    meshes.clear();
+    directory.clear();
+    firstObject = objects.size();
+    lineNumber = 0;
+    camera = new Camera();
+    cameras.push_back(camera);
+    lights = scene.lights;
+    sky = scene.sky;
+    ambientLight = scene.ambientLight;
+    pathSettings = scene.pathSettings;
+    transform = glm::mat4(1.0f);
+    transformed = false;
+}
+
+bool SceneFile::finish(Scene &scene, bool ok)
+{
+    if(!ok) return false;
+    camera->width = (float)width;
+    camera->height = (float)height;
+    scene.camera = camera;
+    scene.objects.insert(scene.objects.end(), objects.begin() + firstObject, objects.end());
+    scene.lights = lights;
+    scene.sky = sky;
+    scene.ambientLight = ambientLight;
+    scene.pathSettings = pathSettings;
+    return true;
+}
+
+char *SceneFile::parseLines(char *begin, char *end, bool &ok)
+{
+    while(ok)
+    {
+        char *newline = static_cast<char*>(std::memchr(begin, '\n', end - begin));
+        if(!newline) break;
+        ok = parseLine(begin, newline);
+        begin = newline + 1;
+    }
+    return begin;
+}
+
+bool SceneFile::fail(const char *message)
+{
+    error = "line " + std::to_string(lineNumber) + ": " + message;
+    return false;
+}
+
+bool SceneFile::parseLine(char *begin, char *end)
+{
+    lineNumber++;
+    Tokens tokens(begin, end);
+    if(!tokens.next()) return true;
+
+    //Shapes first, they are most of the lines of a large scene
+    bool sphere = tokens.is("sphere"), box = tokens.is("box"), rectangle = tokens.is("rectangle");
+    if(sphere || box || rectangle || tokens.is("plane"))
+    {
+        if(!tokens.next()) return fail("missing material");
+        name.assign(tokens.b, tokens.e - tokens.b);
+        auto found = materialNames.find(name);
+        if(found == materialNames.end()) return fail("unknown material");
+        glm::vec3 a, b;
+        float r;
+        if(!tokens.vec3(a) || !(sphere ? tokens.number(r) : tokens.vec3(b))) return fail("bad shape parameters");
+        Shape *shape;
+        if(sphere) shape = new Sphere(a, r);
+        else if(box) shape = new Box(a, b);
+        else if(rectangle) shape = new Rectangle(a, b);
+        else shape = new Plane(a, b);
+        shapes.push_back(shape);
+        Object *obj = new Object(shape, found->second);
+        if(transformed) obj->setTransform(transform);
+        objects.push_back(obj);
+    }
+    else if(tokens.is("mesh"))
+    {
+        if(!tokens.next()) return fail("missing material");
+        name.assign(tokens.b, tokens.e - tokens.b);
+        auto found = materialNames.find(name);
+        if(found == materialNames.end()) return fail("unknown material");
+        if(!tokens.next()) return fail("missing mesh file");
+        std::string path(tokens.b, tokens.e - tokens.b);
+        if(path[0] != '/') path = directory + path;
+        TriangleMesh *&mesh = meshes[path];
+        if(!mesh)
+        {
+            std::string meshError;
+            TriangleMesh *loaded = new TriangleMesh();
+            if(!loaded->load(path, meshError))
+            {
+                delete loaded;
+                meshes.erase(path);
+                return fail(meshError.c_str());
+            }
+            mesh = loaded;
+            shapes.push_back(mesh);
+        }
+        Object *obj = new Object(mesh, found->second);
+        if(transformed) obj->setTransform(transform);
+        objects.push_back(obj);
+    }
+    else if(tokens.is("material"))
+    {
+        if(!tokens.next()) return fail("missing material name");
+        name.assign(tokens.b, tokens.e - tokens.b);
+        if(materialNames.count(name)) return fail("material defined twice");
+        if(!tokens.next()) return fail("missing material type");
+        glm::vec3 a, b;
+        float f;
+        int n;
+        Material *mat = nullptr;
+        if(tokens.is("lambertian"))
+        {
+            if(tokens.vec3(a)) mat = new Lambertian(a);
+        }
+        else if(tokens.is("metallic"))
+        {
+            if(tokens.vec3(a) && tokens.integer(n) && tokens.vec3(b)) mat = new Metallic(a, n, b);
+        }
+        else if(tokens.is("torrance_sparrow"))
+        {
+            if(tokens.vec3(a) && tokens.number(f) && tokens.vec3(b)) mat = new TorrenceSparrow(a, f, b);
+        }
+        else if(tokens.is("emissive"))
+        {
+            if(tokens.vec3(a)) mat = new Emissive(a);
+        }
+        else if(tokens.is("emissive_rectangle"))
+        {
+            if(tokens.vec3(a)) mat = new EmissiveRectangle(a);
+        }
+        else return fail("unknown material type");
+        if(!mat) return fail("bad material parameters");
+        materials.push_back(mat);
+        materialNames[name] = mat;
+        if(tokens.next())
+        {
+            if(!tokens.is("ambient") || !tokens.vec3(mat->ambientColor)) return fail("bad material parameters");
+        }
+    }
+    else if(tokens.is("rotate"))
+    {
+        float degrees;
+        glm::vec3 axis;
+        if(!tokens.number(degrees) || !tokens.vec3(axis)) return fail("bad rotation");
+        transform = transform*glm::rotate(glm::mat4(1.0f), glm::radians(degrees), axis);
+        transformed = true;
+    }
+    else if(tokens.is("translate") || tokens.is("scale"))
+    {
+        bool translate = tokens.is("translate");
+        glm::vec3 v;
+        if(!tokens.vec3(v)) return fail("bad transform");
+        transform = transform*(translate ? glm::translate(glm::mat4(1.0f), v) : glm::scale(glm::mat4(1.0f), v));
+        transformed = true;
+    }
+    else if(tokens.is("matrix"))
+    {
+        glm::mat4 M;
+        for(int k = 0; k < 16; ++k)
+        {
+            if(!tokens.number(M[k/4][k%4])) return fail("bad matrix");
+        }
+        transform = transform*M;
+        transformed = true;
+    }
+    else if(tokens.is("identity"))
+    {
+        transform = glm::mat4(1.0f);
+        transformed = false;
+    }
+    else if(tokens.is("light"))
+    {
+        glm::vec3 p, intensity;
+        if(!tokens.vec3(p) || !tokens.vec3(intensity)) return fail("bad light");
+        lights.push_back(PointLight(p, intensity));
+    }
+    else if(tokens.is("camera"))
+    {
+        glm::vec3 position = camera->center, lookat = camera->center + camera->view, up = camera->up;
+        while(tokens.next())
+        {
+            bool ok;
+            if(tokens.is("position")) ok = tokens.vec3(position);
+            else if(tokens.is("lookat")) ok = tokens.vec3(lookat);
+            else if(tokens.is("up")) ok = tokens.vec3(up);
+            else if(tokens.is("fov")) ok = tokens.number(camera->fov);
+            else return fail("unknown camera parameter");
+            if(!ok) return fail("bad camera parameter");
+        }
+        glm::vec3 view = lookat - position;
+        if(glm::length(view) == 0.0f || glm::length(glm::cross(view, up)) == 0.0f) return fail("degenerate camera");
+        camera->center = position;
+        camera->view = glm::normalize(view);
+        camera->right = glm::normalize(glm::cross(camera->view, up));
+        camera->up = glm::cross(camera->right, camera->view);
+    }
+    else if(tokens.is("image"))
+    {
+        if(!tokens.integer(width) || !tokens.integer(height) || width <= 0 || height <= 0) return fail("bad image size");
+    }
+    else if(tokens.is("sky") || tokens.is("ambient"))
+    {
+        if(!tokens.vec3(tokens.is("sky") ? sky : ambientLight)) return fail("bad color");
+    }
+    else if(tokens.is("render"))
+    {
+        while(tokens.next())
+        {
+            bool ok = true;
+            if(tokens.is("samples")) ok = tokens.integer(settings.numberOfSamples);
+            else if(tokens.is("bounces")) ok = tokens.integer(settings.numberOfBounces);
+            else if(tokens.is("jitter")) ok = tokens.flag(settings.pixelJitter);
+            else if(tokens.is("seed"))
+            {
+                int seed;
+                ok = tokens.integer(seed) && seed >= 0;
+                settings.seed = (uint64_t)seed;
+            }
+            else if(tokens.is("integrator"))
+            {
+                ok = tokens.next();
+                if(ok && tokens.is("whitted")) settings.integrator = RenderSettings::Whitted;
+                else if(ok && tokens.is("path")) settings.integrator = RenderSettings::PathTracing;
+                else ok = false;
+            }
+            else if(tokens.is("sampler"))
+            {
+                ok = tokens.next();
+                if(ok && tokens.is("independent")) settings.samplerType = Sampler::Independent;
+                else if(ok && tokens.is("sobol")) settings.samplerType = Sampler::Sobol;
+                else if(ok && tokens.is("bluenoise")) settings.samplerType = Sampler::BlueNoise;
+                else ok = false;
+            }
+            else return fail("unknown render parameter");
+            if(!ok) return fail("bad render parameter");
+        }
+    }
+    else if(tokens.is("path"))
+    {
+        while(tokens.next())
+        {
+            bool ok;
+            if(tokens.is("maxdepth")) ok = tokens.integer(pathSettings.maxDepth);
+            else if(tokens.is("roulette")) ok = tokens.integer(pathSettings.rouletteDepth);
+            else if(tokens.is("strata")) ok = tokens.integer(pathSettings.primaryStrata);
+            else if(tokens.is("iterative")) ok = tokens.flag(pathSettings.iterative);
+            else if(tokens.is("nee")) ok = tokens.flag(pathSettings.nextEventEstimation);
+            else if(tokens.is("lighttree")) ok = tokens.flag(pathSettings.lightTree);
+            else if(tokens.is("reuseprimary")) ok = tokens.flag(pathSettings.reusePrimaryHit);
+            else return fail("unknown path parameter");
+            if(!ok) return fail("bad path parameter");
+        }
+    }
+    else return fail("unknown statement");
+    if(tokens.next()) return fail("unexpected token");
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef SCENE_FILE_HPP
+#define SCENE_FILE_HPP
+
+#include "render.hpp"
+#include "mesh.hpp"
+
+#include <string>
+#include <unordered_map>
+
+//Text scene descriptions, one statement per line, # starts a comment:
+//
+//  image 800 600
+//  render samples 100 bounces 5 seed 0 sampler independent|sobol|bluenoise jitter 0 integrator path|whitted
+//  path iterative 1 nee 1 lighttree 1 maxdepth 16 roulette 2 reuseprimary 0 strata 1
+//  camera position 0 0 0 lookat 0 0 -1 up 0 1 0 fov 60
+//  sky 0 0 0
+//  ambient 1 1 1
+//  material grey lambertian 0.5 0.5 0.5
+//  material metal metallic <F0 rgb> <exponent> <albedo rgb>
+//  material rough torrance_sparrow <F0 rgb> <roughness> <albedo rgb>
+//  material lamp emissive 10 10 10
+//  material panel emissive_rectangle 10 10 10
+//  light 0 4.5 -12 50 50 50                    point light, position and intensity
+//  sphere grey 0 0 -2 0.5                      center and radius
+//  box metal -1 -1 -3 1 1 -2                   two corners
+//  rectangle panel -1 4.8 -12 1 4.8 -14        two corners, y-aligned
+//  plane grey 0 -1 0 0 1 0                     point and normal
+//  mesh grey models/bunny.obj                  OBJ or binary PLY file, relative to the scene file
+//  rotate 45 0 1 0
+//  translate 0 1 0
+//  scale 2 1 1
+//  matrix <16 numbers, column by column>
+//  identity
+//
+//Material statements may end with "ambient r g b". The transform statements
+//compose, in the order given, the matrix that the shapes after them get
+//through Object::setTransform, until identity resets it. Every keyword of
+//render, path and camera statements is optional. Mesh files named more than
+//once in a scene file are read once, their objects share the TriangleMesh.
+
+//Shapes, materials, objects and the camera created by loading a scene file.
+//They are freed with the SceneFile, which must outlive the scenes it loaded.
+class SceneFile {
+public:
+    int width = 800, height = 600;  //of the image statement
+    RenderSettings settings;        //of the render statement
+    std::string error;              //why the last load failed, with its line
+    SceneFile() {}
+    SceneFile(const SceneFile&) = delete;
+    SceneFile &operator=(const SceneFile&) = delete;
+    ~SceneFile();
+    //Reads the file in chunks and adds what it describes to scene. Returns
+    //false and leaves scene unchanged if it cannot be read or parsed.
+    bool load(const std::string &path, Scene &scene);
+    //load for a description already in memory
+    bool parse(const std::string &text, Scene &scene);
+
+private:
+    std::vector<Shape*> shapes;
+    std::vector<Material*> materials;
+    std::vector<Object*> objects;
+    std::vector<Camera*> cameras;
+    std::unordered_map<std::string, Material*> materialNames;
+    std::unordered_map<std::string, TriangleMesh*> meshes;     //by path, of the load in progress
+    std::string directory;  //of the file being loaded, mesh paths are relative to it
+    std::string name;   //reused lookup key
+    //State of the load in progress, copied to the scene once it succeeds
+    size_t firstObject = 0;
+    long lineNumber = 0;
+    Camera *camera = nullptr;
+    std::vector<PointLight> lights;
+    color sky, ambientLight;
+    PathSettings pathSettings;
+    glm::mat4 transform;
+    bool transformed = false;
+
+    void begin(const Scene &scene);
+    bool finish(Scene &scene, bool ok);
+    //Parses the complete lines of [begin, end), returns where the last one ends
+    char *parseLines(char *begin, char *end, bool &ok);
+    bool parseLine(char *begin, char *end);
+    bool fail(const char *message);
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include "scene.hpp"
+
+#include <chrono>
+
+//Frame updates: the BVH keeps its structure and only the bounds above the
+//changed objects are recomputed. Refitting lets boxes grow and overlap as
+//objects move apart, so the SAH cost of the tree is kept up to date with
+//every bounds change and compared with its cost after the last build. The
+//cost is not divided by the root's surface area: objects moving out of the
+//root's old bounds make every ray that reaches the scene more expensive.
+
+static void setSlot(MBVH::Node &node, int i, const AABB &b)
+{
+    node.lox[i] = b.lo.x; node.loy[i] = b.lo.y; node.loz[i] = b.lo.z;
+    node.hix[i] = b.hi.x; node.hiy[i] = b.hi.y; node.hiz[i] = b.hi.z;
+}
+
+static bool sameBounds(const AABB &a, const AABB &b)
+{
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+//Cost of node in the SAH sum, before weighting by its surface area
+static float nodeCost(const BVH &bvh, int node)
+{
+    const BVH::Node &n = bvh.nodes[node];
+    return n.isLeaf() ? bvh.primitiveCost(n.first, n.count) : bvh.options.traversalCost;
+}
+
+static float sahGrowth(const BVHRefit &r)
+{
+    return r.builtCost > 0.0 ? (float)(r.cost/r.builtCost) : 1.0f;
+}
+
+//Records which MBVH slot holds the bounds of which BVH node, for the MBVH
+//nodes from first on
+static void registerMBVH(Scene &scene, int first)
+{
+    BVHRefit &r = scene.refit;
+    const MBVH &mbvh = scene.compiled.mbvh;
+    for(int m = first; m < (int)mbvh.nodes.size(); ++m)
+    {
+        int b = mbvh.source[m];
+        if(scene.bvh.nodes[b].isLeaf()) continue;   //the single leaf root
+        r.mbvhNode[b] = m;
+        for(int i = 0; i < mbvh.nodes[m].count; ++i)
+        {
+            int child = mbvh.nodes[m].child[i];
+            r.mbvhSlot[MBVH::isLeaf(child) ? MBVH::leafNode(child) : mbvh.source[child]] = 4*m + i;
+        }
+    }
+}
+
+static void setUpRefit(Scene &scene)
+{
+    BVHRefit &r = scene.refit;
+    const BVH &bvh = scene.bvh;
+    int n = bvh.nodes.size();
+    r = BVHRefit();
+    r.parent.assign(n, -1);
+    r.primitives.assign(n, 0);
+    r.builtArea.assign(n, 0.0f);
+    r.mbvhSlot.assign(n, -1);
+    r.mbvhNode.assign(n, -1);
+    r.leafOf.assign(scene.objects.size(), -1);
+    //Children always come after their parent
+    for(int k = n - 1; k >= 0; --k)
+    {
+        const BVH::Node &node = bvh.nodes[k];
+        r.builtArea[k] = node.bounds.surfaceArea();
+        r.cost += r.builtArea[k]*nodeCost(bvh, k);
+        if(node.isLeaf())
+        {
+            r.primitives[k] = node.count;
+            for(int i = node.first; i < node.first + node.count; ++i) r.leafOf[bvh.indices[i]] = k;
+        }
+        else
+        {
+            r.primitives[k] = r.primitives[node.left] + r.primitives[node.right];
+            r.parent[node.left] = r.parent[node.right] = k;
+        }
+    }
+    registerMBVH(scene, 0);
+    r.builtCost = r.cost;
+}
+
+//Expected SAH cost of the tree and unused nodes after the subtrees under roots
+//are built again. A rebuilt subtree is assumed to cost what it did when it
+//was last built, scaled by how much its root's surface area grew since.
+static void estimateRebuild(const Scene &scene, const std::vector<int> &roots, double &cost, int &unusedNodes)
+{
+    const BVHRefit &r = scene.refit;
+    const BVH &bvh = scene.bvh;
+    cost = r.cost;
+    unusedNodes = r.unusedNodes;
+    std::vector<int> stack;
+    for(int root: roots)
+    {
+        double now = 0.0, built = 0.0;
+        stack.assign(1, root);
+        while(!stack.empty())
+        {
+            int node = stack.back();
+            stack.pop_back();
+            const BVH::Node &n = bvh.nodes[node];
+            now += n.bounds.surfaceArea()*nodeCost(bvh, node);
+            built += r.builtArea[node]*nodeCost(bvh, node);
+            if(node != root) unusedNodes++;
+            if(!n.isLeaf()) { stack.push_back(n.left); stack.push_back(n.right); }
+        }
+        float grown = r.builtArea[root] > 0.0f ? bvh.nodes[root].bounds.surfaceArea()/r.builtArea[root] : 1.0f;
+        cost += built*grown - now;
+    }
+}
+
+//Sets the bounds of node everywhere they are kept
+static void setBounds(Scene &scene, int node, const AABB &b)
+{
+    BVHRefit &r = scene.refit;
+    r.cost += (b.surfaceArea() - scene.bvh.nodes[node].bounds.surfaceArea())*nodeCost(scene.bvh, node);
+    scene.bvh.nodes[node].bounds = b;
+    scene.compiled.bvh.nodes[node].bounds = b;
+    int slot = r.mbvhSlot[node];
+    if(slot >= 0) setSlot(scene.compiled.mbvh.nodes[slot/4], slot % 4, b);
+}
+
+//Builds the subtree under root again over the same objects, which keeps its
+//bounds and so those of the nodes above. The new nodes, leaves and MBVH
+//nodes are appended. Returns the number of objects in it.
+static int rebuildSubtree(Scene &scene, int root)
+{
+    BVHRefit &r = scene.refit;
+    BVH &bvh = scene.bvh;
+    CompiledScene &compiled = scene.compiled;
+    //The objects of a subtree are contiguous in indices, from its leftmost leaf on
+    int leftmost = root;
+    while(!bvh.nodes[leftmost].isLeaf()) leftmost = bvh.nodes[leftmost].left;
+    int first = bvh.nodes[leftmost].first, count = r.primitives[root];
+
+    std::vector<int> stack(1, root);
+    while(!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        const BVH::Node &n = bvh.nodes[node];
+        r.cost -= n.bounds.surfaceArea()*nodeCost(bvh, node);
+        if(node != root) r.unusedNodes++;
+        if(!n.isLeaf()) { stack.push_back(n.left); stack.push_back(n.right); }
+    }
+
+    std::vector<int> prims(bvh.indices.data() + first, bvh.indices.data() + first + count);
+    std::vector<AABB> bounds(count);
+    std::vector<float> costs(count);
+    for(int k = 0; k < count; ++k)
+    {
+        bounds[k] = scene.objects[prims[k]]->worldBounds();
+        costs[k] = bvh.costs[prims[k]];
+    }
+    BVH sub;
+    sub.options = bvh.options;
+    sub.options.parallelDepth = 0;
+    sub.build(bounds, costs);
+    int base = bvh.nodes.size();
+    bvh.replaceSubtree(root, first, sub, prims.data());
+    compiled.bvh.replaceSubtree(root, first, sub, prims.data());
+
+    int end = bvh.nodes.size();
+    r.parent.resize(end, -1);
+    r.primitives.resize(end, 0);
+    r.builtArea.resize(end, 0.0f);
+    r.mbvhSlot.resize(end, -1);
+    r.mbvhNode.resize(end, -1);
+    compiled.leaves.resize(end);
+    stack.assign(1, root);
+    while(!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        const BVH::Node &n = bvh.nodes[node];
+        r.builtArea[node] = n.bounds.surfaceArea();
+        r.cost += r.builtArea[node]*nodeCost(bvh, node);
+        if(n.isLeaf())
+        {
+            r.primitives[node] = n.count;
+            for(int i = n.first; i < n.first + n.count; ++i) r.leafOf[bvh.indices[i]] = node;
+            compiled.leaves[node] = compiled.recompile(scene, bvh.indices.data() + n.first, n.count);
+        }
+        else
+        {
+            r.parent[n.left] = r.parent[n.right] = node;
+            stack.push_back(n.left);
+            stack.push_back(n.right);
+        }
+    }
+    for(int k = end - 1; k >= base; --k)
+    {
+        const BVH::Node &n = bvh.nodes[k];
+        if(!n.isLeaf()) r.primitives[k] = r.primitives[n.left] + r.primitives[n.right];
+    }
+
+    MBVH &mbvh = compiled.mbvh;
+    if(!mbvh.empty())
+    {
+        int slot = r.mbvhSlot[root], added = mbvh.nodes.size();
+        r.mbvhNode[root] = -1;
+        int child = bvh.nodes[root].isLeaf() ? MBVH::leafChild(root) : mbvh.collapse(compiled.bvh, root);
+        mbvh.nodes[slot/4].child[slot % 4] = child;
+        registerMBVH(scene, added);
+    }
+    return count;
+}
+
+UpdateStats Scene::update(const std::vector<int> &changed)
+{
+    auto start = std::chrono::steady_clock::now();
+    UpdateStats stats;
+    stats.changed = changed.size();
+    if(objects.empty()) return stats;
+    auto rebuild = [&]() -> UpdateStats {
+        buildBVH(bvh.options);
+        setUpRefit(*this);
+        stats.action = UpdateStats::FullRebuild;
+        stats.degradation = 1.0f;
+        stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    };
+    if(!hasBVH() || compiled.objectCount != (int)objects.size() || compiled.transformOf.size() != objects.size())
+        return rebuild();
+    if(!refit.ready(bvh)) setUpRefit(*this);
+
+    //Transforms first. An object that had none gets one, the leaf holding it
+    //is compiled again with the object among the transformed primitives.
+    std::vector<int> dirty, recompiled;
+    bool unboundedMoved = false, emittersMoved = false;
+    for(int i: changed)
+    {
+        const Object *obj = objects[i];
+        int xf = compiled.transformOf[i];
+        if(xf < 0 && !obj->transform.identity)
+        {
+            xf = compiled.transformOf[i] = compiled.transforms.size();
+            compiled.transforms.push_back(CompiledScene::ObjectTransform());
+            if(refit.leafOf[i] >= 0) recompiled.push_back(refit.leafOf[i]);
+            else unboundedMoved = true;
+        }
+        if(xf >= 0)
+        {
+            compiled.transforms[xf].toWorld = obj->transform;
+            compiled.transforms[xf].toObject = obj->inverse;
+            compiled.transforms[xf].normalToWorld = obj->normalTransform;
+        }
+        if(refit.leafOf[i] >= 0) dirty.push_back(refit.leafOf[i]);
+        if(i < (int)emitterOf.size() && emitterOf[i] >= 0) emittersMoved = true;
+    }
+    std::sort(recompiled.begin(), recompiled.end());
+    recompiled.erase(std::unique(recompiled.begin(), recompiled.end()), recompiled.end());
+    for(int leaf: recompiled)
+    {
+        const BVH::Node &n = bvh.nodes[leaf];
+        compiled.leaves[leaf] = compiled.recompile(*this, bvh.indices.data() + n.first, n.count);
+    }
+    if(unboundedMoved) compiled.unbounded = compiled.recompile(*this, bvh.unbounded.data(), bvh.unbounded.size());
+
+    //Refit from every changed leaf up, until a node's bounds stay the same
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for(int leaf: dirty)
+    {
+        const BVH::Node &n = bvh.nodes[leaf];
+        AABB box;
+        for(int i = n.first; i < n.first + n.count; ++i) box.expand(objects[bvh.indices[i]]->worldBounds());
+        for(int node = leaf; node >= 0; node = refit.parent[node])
+        {
+            if(node != leaf)
+            {
+                box = bvh.nodes[bvh.nodes[node].left].bounds;
+                box.expand(bvh.nodes[bvh.nodes[node].right].bounds);
+            }
+            stats.nodesRefit++;
+            if(sameBounds(box, bvh.nodes[node].bounds)) break;
+            setBounds(*this, node, box);
+        }
+    }
+
+    stats.degradation = sahGrowth(refit);
+    if(stats.degradation > updateSettings.rebuildAll) return rebuild();
+    if(stats.degradation > updateSettings.rebuildSubtrees)
+    {
+        //Above every changed leaf, the largest subtree that is degraded and
+        //small enough. With an MBVH it must be the root of an
+        //MBVH node so that the new nodes can take its slot.
+        int limit = (int)(updateSettings.maxSubtreeFraction*bvh.indices.size());
+        std::vector<int> roots;
+        for(int leaf: dirty)
+        {
+            int pick = -1;
+            for(int node = refit.parent[leaf]; node > 0 && refit.primitives[node] <= limit; node = refit.parent[node])
+            {
+                bool collapsed = compiled.mbvh.empty() || refit.mbvhNode[node] >= 0;
+                if(collapsed && bvh.nodes[node].bounds.surfaceArea() > updateSettings.subtreeGrowth*refit.builtArea[node])
+                    pick = node;
+            }
+            if(pick >= 0) roots.push_back(pick);
+        }
+        std::sort(roots.begin(), roots.end());
+        roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+        std::vector<int> outer;
+        int total = 0;
+        for(int root: roots)
+        {
+            bool nested = false;
+            for(int node = refit.parent[root]; node >= 0 && !nested; node = refit.parent[node])
+                nested = std::binary_search(roots.begin(), roots.end(), node);
+            if(nested) continue;
+            outer.push_back(root);
+            total += refit.primitives[root];
+        }
+        //Past that one build of everything is cheaper
+        if(total > limit) return rebuild();
+        //Decided before rebuilding anything, so that one update never pays
+        //for subtree rebuilds and a full build. Unused nodes and block
+        //entries are only given back by a full build, the subtrees append
+        //about as many nodes as they leave unused.
+        double expectedCost;
+        int expectedUnused;
+        estimateRebuild(*this, outer, expectedCost, expectedUnused);
+        int expectedNodes = bvh.nodes.size() + expectedUnused - refit.unusedNodes;
+        if((refit.builtCost > 0.0 && expectedCost/refit.builtCost > updateSettings.rebuildAll) ||
+           2*expectedUnused > expectedNodes)
+            return rebuild();
+        for(int root: outer)
+        {
+            stats.objectsRebuilt += rebuildSubtree(*this, root);
+            stats.subtreesRebuilt++;
+            stats.action = UpdateStats::PartialRebuild;
+        }
+        //If the estimate was short, the next update rebuilds everything
+        stats.degradation = sahGrowth(refit);
+    }
+
+    if(emittersMoved) buildEmitters();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void UpdateStats::print() const
+{
+    static const char *names[] = {"refit", "partial rebuild", "full rebuild"};
+    std::cout<<"Update: "<<names[action]<<" for "<<changed<<" objects, "<<nodesRefit<<" nodes refit, "
+             <<subtreesRebuilt<<" subtrees of "<<objectsRebuilt<<" objects rebuilt, SAH cost x"<<degradation
+             <<", "<<milliseconds<<" ms"<<std::endl;
+}
@@ -0,0 +1,347 @@
+#include "simd.hpp"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+//The vector kernels evaluate the scalar expressions in the same order and
+//never fuse a multiply with an add. std::min(a, b) is (b < a) ? b : a, which
+//is min_ps(b, a), and std::max(a, b) is max_ps(b, a), so even NaN lanes
+//resolve like the scalar code.
+
+//Scalar kernels
+template<bool Occlusion>
+static unsigned spheresScalar(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t)
+{
+    unsigned mask = 0;
+    float qa = glm::dot(ray.d, ray.d);
+    glm::vec3 d2 = 2.0f * ray.d;
+    for(int i = 0; i < count; ++i)
+    {
+        glm::vec3 oc = ray.o - glm::vec3(block.cx[i], block.cy[i], block.cz[i]);
+        float qb = glm::dot(d2, oc);
+        float qc = glm::dot(oc, oc) - block.r[i] * block.r[i];
+        float discriminant = qb * qb - 4 * qa * qc;
+        if(discriminant < 0) continue;
+        float t1, t2;
+        if(Occlusion)
+        {
+            float root = sqrt(discriminant);
+            t1 = (-qb - root) / (2 * qa);
+            t2 = (-qb + root) / (2 * qa);
+        }
+        else
+        {
+            t1 = (-qb - sqrt(discriminant)) / (2 * qa);
+            t2 = (-qb + sqrt(discriminant)) / (2 * qa);
+        }
+        if(t1 > t2) std::swap(t1, t2);
+        if(t_range.contains(t1) && t1 > 0) { if(t) t[i] = t1; }
+        else if(t_range.contains(t2) && t2 > 0) { if(t) t[i] = t2; }
+        else continue;
+        mask |= 1u << i;
+    }
+    return mask;
+}
+
+static unsigned spheresHitScalar(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t)
+{
+    return spheresScalar<false>(ray, block, count, t_range, t);
+}
+
+static unsigned spheresOccludedScalar(const Ray &ray, const SphereBlock &block, int count, Interval t_range)
+{
+    return spheresScalar<true>(ray, block, count, t_range, nullptr);
+}
+
+template<bool Occlusion>
+static unsigned boxesScalar(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t)
+{
+    unsigned mask = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        float tminx = (block.lox[i] - ray.o.x) / ray.d.x;
+        float tmaxx = (block.hix[i] - ray.o.x) / ray.d.x;
+        float tminy = (block.loy[i] - ray.o.y) / ray.d.y;
+        float tmaxy = (block.hiy[i] - ray.o.y) / ray.d.y;
+        float tminz = (block.loz[i] - ray.o.z) / ray.d.z;
+        float tmaxz = (block.hiz[i] - ray.o.z) / ray.d.z;
+        float tmin = std::max(std::min(tminx, tmaxx), std::max(std::min(tminy, tmaxy), std::min(tminz, tmaxz)));
+        float tmax = std::min(std::max(tminx, tmaxx), std::min(std::max(tminy, tmaxy), std::max(tminz, tmaxz)));
+        bool hit = Occlusion ? tmax >= 0 && tmin <= tmax && tmin >= 0 && t_range.contains(tmin)
+                             : !(tmax < 0) && !(tmin > tmax) && !(tmin < 0) && t_range.contains(tmin);
+        if(!hit) continue;
+        if(t) t[i] = tmin;
+        mask |= 1u << i;
+    }
+    return mask;
+}
+
+static unsigned boxesHitScalar(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t)
+{
+    return boxesScalar<false>(ray, block, count, t_range, t);
+}
+
+static unsigned boxesOccludedScalar(const Ray &ray, const BoxBlock &block, int count, Interval t_range)
+{
+    return boxesScalar<true>(ray, block, count, t_range, nullptr);
+}
+
+static const PrimitiveKernels scalarKernels = {PrimitiveKernels::Scalar, "scalar", 1, spheresHitScalar,
+                                               spheresOccludedScalar, boxesHitScalar, boxesOccludedScalar};
+
+#ifdef SIMD_X86
+//SSE kernels, 4 primitives per instruction
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+template<bool Occlusion>
+static inline unsigned spheres4(const Ray &ray, const SphereBlock &block, int i, Interval t_range, float *t)
+{
+    float qa = glm::dot(ray.d, ray.d);
+    __m128 ocx = _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_loadu_ps(block.cx + i));
+    __m128 ocy = _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_loadu_ps(block.cy + i));
+    __m128 ocz = _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_loadu_ps(block.cz + i));
+    __m128 r = _mm_loadu_ps(block.r + i);
+    __m128 qb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.0f * ray.d.x), ocx),
+                                      _mm_mul_ps(_mm_set1_ps(2.0f * ray.d.y), ocy)),
+                           _mm_mul_ps(_mm_set1_ps(2.0f * ray.d.z), ocz));
+    __m128 qc = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                           _mm_mul_ps(r, r));
+    __m128 discriminant = _mm_sub_ps(_mm_mul_ps(qb, qb), _mm_mul_ps(_mm_set1_ps(4 * qa), qc));
+    //Negative discriminants give NaN roots, which fail the range tests below
+    if(!_mm_movemask_ps(_mm_cmpge_ps(discriminant, _mm_setzero_ps()))) return 0;
+    __m128 minusQb = _mm_xor_ps(qb, _mm_set1_ps(-0.0f));
+    __m128 t1, t2;
+    if(Occlusion)
+    {
+        __m128 root = _mm_sqrt_ps(discriminant);
+        __m128 denominator = _mm_set1_ps(2 * qa);
+        t1 = _mm_div_ps(_mm_sub_ps(minusQb, root), denominator);
+        t2 = _mm_div_ps(_mm_add_ps(minusQb, root), denominator);
+    }
+    else
+    {
+        //Sphere::hit takes the double sqrt and finishes the roots in double
+        __m128d denominator = _mm_set1_pd(2 * qa);
+        __m128d lowRoot = _mm_sqrt_pd(_mm_cvtps_pd(discriminant));
+        __m128d highRoot = _mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(discriminant, discriminant)));
+        __m128d lowQb = _mm_cvtps_pd(minusQb), highQb = _mm_cvtps_pd(_mm_movehl_ps(minusQb, minusQb));
+        t1 = _mm_movelh_ps(_mm_cvtpd_ps(_mm_div_pd(_mm_sub_pd(lowQb, lowRoot), denominator)),
+                           _mm_cvtpd_ps(_mm_div_pd(_mm_sub_pd(highQb, highRoot), denominator)));
+        t2 = _mm_movelh_ps(_mm_cvtpd_ps(_mm_div_pd(_mm_add_pd(lowQb, lowRoot), denominator)),
+                           _mm_cvtpd_ps(_mm_div_pd(_mm_add_pd(highQb, highRoot), denominator)));
+    }
+    __m128 swap = _mm_cmpgt_ps(t1, t2);
+    __m128 tNear = select4(swap, t2, t1), tFar = select4(swap, t1, t2);
+    __m128 lo = _mm_set1_ps(t_range.min), hi = _mm_set1_ps(t_range.max), zero = _mm_setzero_ps();
+    __m128 tNearHit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(lo, tNear), _mm_cmple_ps(tNear, hi)), _mm_cmpgt_ps(tNear, zero));
+    __m128 tFarHit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(lo, tFar), _mm_cmple_ps(tFar, hi)), _mm_cmpgt_ps(tFar, zero));
+    if(t) _mm_storeu_ps(t + i, select4(tNearHit, tNear, tFar));
+    return _mm_movemask_ps(_mm_or_ps(tNearHit, tFarHit));
+}
+
+template<bool Occlusion>
+static inline unsigned boxes4(const Ray &ray, const BoxBlock &block, int i, Interval t_range, float *t)
+{
+    __m128 ox = _mm_set1_ps(ray.o.x), oy = _mm_set1_ps(ray.o.y), oz = _mm_set1_ps(ray.o.z);
+    __m128 dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y), dz = _mm_set1_ps(ray.d.z);
+    __m128 tminx = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.lox + i), ox), dx);
+    __m128 tmaxx = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.hix + i), ox), dx);
+    __m128 tminy = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.loy + i), oy), dy);
+    __m128 tmaxy = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.hiy + i), oy), dy);
+    __m128 tminz = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.loz + i), oz), dz);
+    __m128 tmaxz = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(block.hiz + i), oz), dz);
+    __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tmaxz, tminz), _mm_min_ps(tmaxy, tminy)), _mm_min_ps(tmaxx, tminx));
+    __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tmaxz, tminz), _mm_max_ps(tmaxy, tminy)), _mm_max_ps(tmaxx, tminx));
+    __m128 zero = _mm_setzero_ps();
+    __m128 inRange = _mm_and_ps(_mm_cmple_ps(_mm_set1_ps(t_range.min), tmin), _mm_cmple_ps(tmin, _mm_set1_ps(t_range.max)));
+    __m128 hit;
+    if(Occlusion)
+        hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tmax, zero), _mm_cmple_ps(tmin, tmax)), _mm_cmpge_ps(tmin, zero));
+    else
+        hit = _mm_and_ps(_mm_and_ps(_mm_cmpnlt_ps(tmax, zero), _mm_cmpngt_ps(tmin, tmax)), _mm_cmpnlt_ps(tmin, zero));
+    if(t) _mm_storeu_ps(t + i, tmin);
+    return _mm_movemask_ps(_mm_and_ps(hit, inRange));
+}
+
+static unsigned spheresSSE(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t)
+{
+    unsigned mask = spheres4<false>(ray, block, 0, t_range, t);
+    if(count > 4) mask |= spheres4<false>(ray, block, 4, t_range, t) << 4;
+    return mask & ((1u << count) - 1);
+}
+
+static unsigned spheresOccludedSSE(const Ray &ray, const SphereBlock &block, int count, Interval t_range)
+{
+    unsigned mask = spheres4<true>(ray, block, 0, t_range, nullptr);
+    if(count > 4) mask |= spheres4<true>(ray, block, 4, t_range, nullptr) << 4;
+    return mask & ((1u << count) - 1);
+}
+
+static unsigned boxesSSE(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t)
+{
+    unsigned mask = boxes4<false>(ray, block, 0, t_range, t);
+    if(count > 4) mask |= boxes4<false>(ray, block, 4, t_range, t) << 4;
+    return mask & ((1u << count) - 1);
+}
+
+static unsigned boxesOccludedSSE(const Ray &ray, const BoxBlock &block, int count, Interval t_range)
+{
+    unsigned mask = boxes4<true>(ray, block, 0, t_range, nullptr);
+    if(count > 4) mask |= boxes4<true>(ray, block, 4, t_range, nullptr) << 4;
+    return mask & ((1u << count) - 1);
+}
+
+static const PrimitiveKernels sseKernels = {PrimitiveKernels::SSE, "SSE", 4, spheresSSE,
+                                            spheresOccludedSSE, boxesSSE, boxesOccludedSSE};
+
+//AVX2 kernels, 8 primitives per instruction. They are compiled for AVX2 with
+//a target attribute and only called after the CPU check. FMA is deliberately
+//left out of the target so no multiply-add gets fused.
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256 select8(__m256 mask, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, mask);
+}
+
+template<bool Occlusion>
+AVX2_TARGET static unsigned spheres8(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t)
+{
+    float qa = glm::dot(ray.d, ray.d);
+    __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(ray.o.x), _mm256_loadu_ps(block.cx));
+    __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(ray.o.y), _mm256_loadu_ps(block.cy));
+    __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(ray.o.z), _mm256_loadu_ps(block.cz));
+    __m256 r = _mm256_loadu_ps(block.r);
+    __m256 qb = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f * ray.d.x), ocx),
+                                            _mm256_mul_ps(_mm256_set1_ps(2.0f * ray.d.y), ocy)),
+                              _mm256_mul_ps(_mm256_set1_ps(2.0f * ray.d.z), ocz));
+    __m256 qc = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)),
+                                            _mm256_mul_ps(ocz, ocz)),
+                              _mm256_mul_ps(r, r));
+    __m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(qb, qb), _mm256_mul_ps(_mm256_set1_ps(4 * qa), qc));
+    if(!_mm256_movemask_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ))) return 0;
+    __m256 minusQb = _mm256_xor_ps(qb, _mm256_set1_ps(-0.0f));
+    __m256 t1, t2;
+    if(Occlusion)
+    {
+        __m256 root = _mm256_sqrt_ps(discriminant);
+        __m256 denominator = _mm256_set1_ps(2 * qa);
+        t1 = _mm256_div_ps(_mm256_sub_ps(minusQb, root), denominator);
+        t2 = _mm256_div_ps(_mm256_add_ps(minusQb, root), denominator);
+    }
+    else
+    {
+        __m256d denominator = _mm256_set1_pd(2 * qa);
+        __m256d lowRoot = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(discriminant)));
+        __m256d highRoot = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(discriminant, 1)));
+        __m256d lowQb = _mm256_cvtps_pd(_mm256_castps256_ps128(minusQb));
+        __m256d highQb = _mm256_cvtps_pd(_mm256_extractf128_ps(minusQb, 1));
+        t1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_sub_pd(lowQb, lowRoot), denominator))),
+                                  _mm256_cvtpd_ps(_mm256_div_pd(_mm256_sub_pd(highQb, highRoot), denominator)), 1);
+        t2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_add_pd(lowQb, lowRoot), denominator))),
+                                  _mm256_cvtpd_ps(_mm256_div_pd(_mm256_add_pd(highQb, highRoot), denominator)), 1);
+    }
+    __m256 swap = _mm256_cmp_ps(t1, t2, _CMP_GT_OQ);
+    __m256 tNear = select8(swap, t2, t1), tFar = select8(swap, t1, t2);
+    __m256 lo = _mm256_set1_ps(t_range.min), hi = _mm256_set1_ps(t_range.max), zero = _mm256_setzero_ps();
+    __m256 tNearHit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lo, tNear, _CMP_LE_OQ), _mm256_cmp_ps(tNear, hi, _CMP_LE_OQ)),
+                                   _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+    __m256 tFarHit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(lo, tFar, _CMP_LE_OQ), _mm256_cmp_ps(tFar, hi, _CMP_LE_OQ)),
+                                  _mm256_cmp_ps(tFar, zero, _CMP_GT_OQ));
+    if(t) _mm256_storeu_ps(t, select8(tNearHit, tNear, tFar));
+    return _mm256_movemask_ps(_mm256_or_ps(tNearHit, tFarHit)) & ((1u << count) - 1);
+}
+
+AVX2_TARGET static unsigned spheresAVX2(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t)
+{
+    return spheres8<false>(ray, block, count, t_range, t);
+}
+
+AVX2_TARGET static unsigned spheresOccludedAVX2(const Ray &ray, const SphereBlock &block, int count, Interval t_range)
+{
+    return spheres8<true>(ray, block, count, t_range, nullptr);
+}
+
+template<bool Occlusion>
+AVX2_TARGET static unsigned boxes8(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t)
+{
+    __m256 ox = _mm256_set1_ps(ray.o.x), oy = _mm256_set1_ps(ray.o.y), oz = _mm256_set1_ps(ray.o.z);
+    __m256 dx = _mm256_set1_ps(ray.d.x), dy = _mm256_set1_ps(ray.d.y), dz = _mm256_set1_ps(ray.d.z);
+    __m256 tminx = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.lox), ox), dx);
+    __m256 tmaxx = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.hix), ox), dx);
+    __m256 tminy = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.loy), oy), dy);
+    __m256 tmaxy = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.hiy), oy), dy);
+    __m256 tminz = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.loz), oz), dz);
+    __m256 tmaxz = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(block.hiz), oz), dz);
+    __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tmaxz, tminz), _mm256_min_ps(tmaxy, tminy)),
+                                _mm256_min_ps(tmaxx, tminx));
+    __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tmaxz, tminz), _mm256_max_ps(tmaxy, tminy)),
+                                _mm256_max_ps(tmaxx, tminx));
+    __m256 zero = _mm256_setzero_ps();
+    __m256 inRange = _mm256_and_ps(_mm256_cmp_ps(_mm256_set1_ps(t_range.min), tmin, _CMP_LE_OQ),
+                                   _mm256_cmp_ps(tmin, _mm256_set1_ps(t_range.max), _CMP_LE_OQ));
+    __m256 hit;
+    if(Occlusion)
+        hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tmax, zero, _CMP_GE_OQ), _mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ)),
+                            _mm256_cmp_ps(tmin, zero, _CMP_GE_OQ));
+    else
+        hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tmax, zero, _CMP_NLT_UQ), _mm256_cmp_ps(tmin, tmax, _CMP_NGT_UQ)),
+                            _mm256_cmp_ps(tmin, zero, _CMP_NLT_UQ));
+    if(t) _mm256_storeu_ps(t, tmin);
+    return _mm256_movemask_ps(_mm256_and_ps(hit, inRange)) & ((1u << count) - 1);
+}
+
+AVX2_TARGET static unsigned boxesAVX2(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t)
+{
+    return boxes8<false>(ray, block, count, t_range, t);
+}
+
+AVX2_TARGET static unsigned boxesOccludedAVX2(const Ray &ray, const BoxBlock &block, int count, Interval t_range)
+{
+    return boxes8<true>(ray, block, count, t_range, nullptr);
+}
+
+static const PrimitiveKernels avx2Kernels = {PrimitiveKernels::AVX2, "AVX2", 8, spheresAVX2,
+                                             spheresOccludedAVX2, boxesAVX2, boxesOccludedAVX2};
+#endif
+
+//Dispatch
+static const PrimitiveKernels *kernelsFor(PrimitiveKernels::Level level)
+{
+#ifdef SIMD_X86
+    if(level == PrimitiveKernels::AVX2) return __builtin_cpu_supports("avx2") ? &avx2Kernels : nullptr;
+    if(level == PrimitiveKernels::SSE) return &sseKernels;
+#endif
+    return level == PrimitiveKernels::Scalar ? &scalarKernels : nullptr;
+}
+
+static const PrimitiveKernels *&activeKernels()
+{
+    static const PrimitiveKernels *active = kernelsFor(PrimitiveKernels::AVX2) ? kernelsFor(PrimitiveKernels::AVX2) :
+                                            kernelsFor(PrimitiveKernels::SSE) ? kernelsFor(PrimitiveKernels::SSE) :
+                                            &scalarKernels;
+    return active;
+}
+
+const PrimitiveKernels &primitiveKernels()
+{
+    return *activeKernels();
+}
+
+bool supportsPrimitiveKernels(PrimitiveKernels::Level level)
+{
+    return kernelsFor(level) != nullptr;
+}
+
+bool selectPrimitiveKernels(PrimitiveKernels::Level level)
+{
+    const PrimitiveKernels *kernels = kernelsFor(level);
+    if(!kernels) return false;
+    activeKernels() = kernels;
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include "scene.hpp"
+
+//Structure of arrays views of the sphere and box blocks of a CompiledScene
+class SphereBlock {
+public:
+    const float *cx, *cy, *cz, *r;
+};
+
+class BoxBlock {
+public:
+    const float *lox, *loy, *loz, *hix, *hiy, *hiz;
+};
+
+//Kernels testing one ray against up to 8 primitives. Bit i of the result is
+//set when primitive i is hit inside t_range, and t[i] is then its distance.
+//count is 1 to 8, t must have room for 8 entries and the arrays must stay
+//readable for 8 entries, CompiledScene pads its blocks for this. The
+//arithmetic is that of Sphere::hit, Sphere::occluded, Box::hit and
+//Box::occluded lane by lane, so every level returns the same bits and
+//distances as the scalar code.
+class PrimitiveKernels {
+public:
+    enum Level { Scalar, SSE, AVX2 };
+    Level level;
+    const char *name;
+    int width;      //primitives per instruction
+    unsigned (*spheres)(const Ray &ray, const SphereBlock &block, int count, Interval t_range, float *t);
+    unsigned (*spheresOccluded)(const Ray &ray, const SphereBlock &block, int count, Interval t_range);
+    unsigned (*boxes)(const Ray &ray, const BoxBlock &block, int count, Interval t_range, float *t);
+    unsigned (*boxesOccluded)(const Ray &ray, const BoxBlock &block, int count, Interval t_range);
+};
+
+//Kernels in use, the widest the CPU supports unless another level was selected
+const PrimitiveKernels &primitiveKernels();
+//Returns false and keeps the current kernels if the CPU lacks the level
+bool selectPrimitiveKernels(PrimitiveKernels::Level level);
+bool supportsPrimitiveKernels(PrimitiveKernels::Level level);
+
+#endif
@@ -0,0 +1,106 @@
+#include "tokens.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+
+//Decimal numbers with up to 19 significant digits and a small exponent are
+//exact in double arithmetic, anything else goes to strtod
+static const double powersOfTen[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+                                       1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+bool Tokens::number(float &value)
+{
+    return next() && parseNumber(b, e, value);
+}
+
+bool Tokens::integer(int &value)
+{
+    return next() && parseInteger(b, e, value);
+}
+
+bool Tokens::parseNumber(char *b, char *e, float &value)
+{
+    const char *q = b;
+    bool negative = q < e && *q == '-';
+    if(q < e && (*q == '-' || *q == '+')) ++q;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false, exact = true;
+    for(; q < e && *q >= '0' && *q <= '9'; ++q)
+    {
+        any = true;
+        if(digits < 19)
+        {
+            mantissa = mantissa*10 + (*q - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+            exact = false;
+        }
+    }
+    if(q < e && *q == '.')
+    {
+        for(++q; q < e && *q >= '0' && *q <= '9'; ++q)
+        {
+            any = true;
+            if(digits >= 19)
+            {
+                exact = false;
+                continue;
+            }
+            mantissa = mantissa*10 + (*q - '0');
+            digits += mantissa != 0;
+            exponent--;
+        }
+    }
+    if(!any) return false;
+    if(q < e && (*q == 'e' || *q == 'E'))
+    {
+        ++q;
+        bool negativeExponent = q < e && *q == '-';
+        if(q < e && (*q == '-' || *q == '+')) ++q;
+        if(q == e) return false;
+        int written = 0;
+        for(; q < e && *q >= '0' && *q <= '9'; ++q) written = std::min(written*10 + (*q - '0'), 100000);
+        exponent += negativeExponent ? -written : written;
+    }
+    if(q != e) return false;
+    double v;
+    if(exact && mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+    {
+        v = (double)mantissa;
+        v = exponent < 0 ? v/powersOfTen[-exponent] : v*powersOfTen[exponent];
+        if(negative) v = -v;
+    }
+    else
+    {
+        char saved = *e;
+        *e = '\0';
+        v = std::strtod(b, nullptr);
+        *e = saved;
+    }
+    value = (float)v;
+    return true;
+}
+
+bool Tokens::parseInteger(const char *b, const char *e, int &value)
+{
+    if(b == e) return false;
+    const char *q = b;
+    bool negative = *q == '-';
+    if(*q == '-' || *q == '+') ++q;
+    if(q == e) return false;
+    long v = 0;
+    for(; q < e; ++q)
+    {
+        if(*q < '0' || *q > '9' || v > std::numeric_limits<int>::max()) return false;
+        v = v*10 + (*q - '0');
+    }
+    if(v > std::numeric_limits<int>::max()) return false;
+    value = negative ? -(int)v : (int)v;
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef TOKENS_HPP
+#define TOKENS_HPP
+
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+//Tokens of one line, pointers into the read buffer. The byte after the line
+//is writable, number parsing may put a terminator there for a moment.
+class Tokens {
+public:
+    char *p, *end;
+    char *b = nullptr, *e = nullptr;    //current token [b, e)
+    Tokens(char *begin, char *end): p(begin), end(end) {}
+    bool next() {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        if(p == end || *p == '#') return false;
+        b = p;
+        while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') ++p;
+        e = p;
+        return true;
+    }
+    bool is(const char *word) const {
+        size_t n = std::strlen(word);
+        return (size_t)(e - b) == n && std::memcmp(b, word, n) == 0;
+    }
+    bool number(float &value);
+    bool integer(int &value);
+    bool vec3(glm::vec3 &v) { return number(v.x) && number(v.y) && number(v.z); }
+    bool flag(bool &value) {
+        int n;
+        if(!integer(n)) return false;
+        value = n != 0;
+        return true;
+    }
+    //The number or integer of [begin, end), which need not be a whole token
+    static bool parseNumber(char *begin, char *end, float &value);
+    static bool parseInteger(const char *begin, const char *end, int &value);
+};
+
+//Reads text files in chunks of fixed size and hands out their lines, so
+//memory does not grow with the file
+class LineReader {
+public:
+    enum Status { Done, Stopped, LineTooLong, ReadError };
+    static const size_t chunk = 1 << 20;
+    //Calls parseLine(begin, end) for every line of file without its newline,
+    //until it returns false (Stopped). The byte at end is writable.
+    template<typename F>
+    static Status read(FILE *file, F &&parseLine);
+};
+
+template<typename F>
+LineReader::Status LineReader::read(FILE *file, F &&parseLine)
+{
+    std::vector<char> buffer(chunk + 1);    //the extra byte keeps the last line's end writable
+    size_t filled = 0;
+    while(true)
+    {
+        size_t got = std::fread(buffer.data() + filled, 1, chunk - filled, file);
+        filled += got;
+        char *begin = buffer.data(), *end = buffer.data() + filled;
+        while(char *newline = static_cast<char*>(std::memchr(begin, '\n', end - begin)))
+        {
+            if(!parseLine(begin, newline)) return Stopped;
+            begin = newline + 1;
+        }
+        if(got == 0)
+        {
+            if(std::ferror(file)) return ReadError;
+            //The last line has no newline
+            if(begin < end && !parseLine(begin, end)) return Stopped;
+            return Done;
+        }
+        filled = end - begin;
+        std::memmove(buffer.data(), begin, filled);
+        if(filled == chunk) return LineTooLong;
+    }
+}
+
+#endif
@@ -0,0 +1,293 @@
+#include "render.hpp"
+
+#include <typeinfo>
+#include <unordered_map>
+
+//PathStates functions
+PathStates::PathStates(int slots, const RenderSettings &settings, int imageWidth)
+{
+    origin.resize(slots);
+    direction.resize(slots);
+    throughput.resize(slots);
+    radiance.resize(slots);
+    fromP.resize(slots);
+    fromN.resize(slots);
+    fromPdf.resize(slots);
+    hit.resize(slots);
+    item.resize(slots);
+    depth.resize(slots);
+    for(int i = 0; i < slots; ++i) samplers.emplace_back(Sampler::create(settings.samplerType, settings.seed, imageWidth));
+}
+
+//WavefrontQueues functions
+void WavefrontQueues::addShadow(int slot, glm::vec3 p, glm::vec3 q, color contribution)
+{
+    int i = (int)shadowSlot.size();
+    shadowSlot.push_back(slot);
+    shadowP.resize(i + 1);
+    shadowQ.resize(i + 1);
+    shadowContribution.resize(i + 1);
+    shadowP.set(i, p);
+    shadowQ.set(i, q);
+    shadowContribution.set(i, contribution);
+}
+
+void WavefrontQueues::clear()
+{
+    extension.clear();
+    finished.clear();
+    shadowSlot.clear();
+}
+
+//Material bins, each shaded in its own loop
+enum MaterialBin { LambertianBin, MetallicBin, TorrenceSparrowBin, EmissiveBin, OtherBin, BinCount };
+
+//The exact type decides the bin: a class derived from one of the binned
+//materials may override its functions, so it goes to OtherBin and is
+//shaded through the vtable
+static int materialBin(const Material *mat)
+{
+    const std::type_info &type = typeid(*mat);
+    if(type == typeid(Lambertian)) return LambertianBin;
+    if(type == typeid(Metallic)) return MetallicBin;
+    if(type == typeid(TorrenceSparrow)) return TorrenceSparrowBin;
+    if(type == typeid(Emissive)) return EmissiveBin;
+    return OtherBin;
+}
+
+//Calls the overrides of M without going through the vtable, the Material
+//version dispatches as usual
+template<typename M>
+class BinMaterial {
+public:
+    const M *mat;
+    explicit BinMaterial(const Material *mat): mat(static_cast<const M*>(mat)) {}
+    color emission(const HitRecord &rec, glm::vec3 v) const { return mat->M::emission(rec, v); }
+    color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const { return mat->M::brdf(rec, l, v); }
+    bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const {
+        return mat->M::reflection(rec, v, r, kr, sampler);
+    }
+    bool isSpecular() const { return mat->M::isSpecular(); }
+};
+
+template<>
+class BinMaterial<Material> {
+public:
+    const Material *mat;
+    explicit BinMaterial(const Material *mat): mat(mat) {}
+    color emission(const HitRecord &rec, glm::vec3 v) const { return mat->emission(rec, v); }
+    color brdf(const HitRecord &rec, glm::vec3 l, glm::vec3 v) const { return mat->brdf(rec, l, v); }
+    bool reflection(const HitRecord &rec, glm::vec3 v, glm::vec3 &r, color &kr, Sampler &sampler) const {
+        return mat->reflection(rec, v, r, kr, sampler);
+    }
+    bool isSpecular() const { return mat->isSpecular(); }
+};
+
+//One iteration of the loop of Scene::integratePath for every slot of the bin,
+//with the visibility test of the light sample and the next traceRay queued
+template<typename M>
+static void shadeBin(const Scene &scene, PathStates &paths, const int *slots, int count, WavefrontQueues &queues)
+{
+    const PathSettings &settings = scene.pathSettings;
+    for(int k = 0; k < count; ++k)
+    {
+        int i = slots[k];
+        const HitRecord &rec = paths.hit[i];
+        BinMaterial<M> mat(rec.mat);
+        Sampler &sampler = *paths.samplers[i];
+        PathVertex from;
+        from.p = paths.fromP.get(i);
+        from.n = paths.fromN.get(i);
+        from.bsdfPdf = paths.fromPdf[i];
+        color throughput = paths.throughput.get(i), L = paths.radiance.get(i);
+
+        glm::vec3 v = glm::normalize(-1.0f*paths.direction.get(i));
+        L += throughput*mat.emission(rec, v)*scene.emissionWeight(from, rec);
+        paths.radiance.set(i, L);
+        color Ld = glm::vec3(0.0f);
+        glm::vec3 p, q;
+        if(scene.sampleLightConnection(rec, v, sampler, Ld, p, q)) queues.addShadow(i, p, q, throughput*Ld);
+        if(paths.depth[i] >= settings.maxDepth)
+        {
+            queues.finished.push_back(i);
+            continue;
+        }
+
+        glm::vec3 sampledNormal = glm::vec3(0.0f), kr = glm::vec3(0.0f);
+        mat.reflection(rec, v, sampledNormal, kr, sampler);
+        float pdfinverse = glm::length(sampledNormal);
+        if(!(pdfinverse > 1e-5))
+        {
+            queues.finished.push_back(i);
+            continue;
+        }
+        sampledNormal = sampledNormal/pdfinverse;
+
+        float cos_theta_i = glm::dot(rec.n, sampledNormal);
+        throughput *= cos_theta_i*pdfinverse*mat.brdf(rec, sampledNormal, v);
+        if(kr != glm::vec3(0.0f)) throughput *= kr;
+        if(throughput == glm::vec3(0.0f))
+        {
+            queues.finished.push_back(i);
+            continue;
+        }
+        if(paths.depth[i] >= settings.rouletteDepth)
+        {
+            float q = std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+            if(!probability(q, sampler))
+            {
+                queues.finished.push_back(i);
+                continue;
+            }
+            throughput /= q;
+        }
+
+        paths.throughput.set(i, throughput);
+        paths.fromP.set(i, rec.p);
+        paths.fromN.set(i, rec.n);
+        paths.fromPdf[i] = mat.isSpecular() ? 0.0f : 1.0f/pdfinverse;
+        paths.origin.set(i, rec.p + 0.001f*sampledNormal);
+        paths.direction.set(i, sampledNormal);
+        paths.depth[i]++;
+        queues.extension.push_back(i);
+    }
+}
+
+void renderTileWavefront(const Scene &scene, HDRImage &image, const Tile &tile, const RenderSettings &settings)
+{
+    int w = image.w, h = image.h, tileWidth = tile.x1 - tile.x0;
+    int pixels = tileWidth*(tile.y1 - tile.y0), n = settings.numberOfSamples;
+    if(pixels <= 0 || n <= 0) return;
+
+    //Primary hits and point light radiance, shared by the samples of a pixel
+    int padded = (pixels + RayPacket::maxSize - 1)/RayPacket::maxSize*RayPacket::maxSize;
+    std::vector<Ray> primary;
+    std::vector<std::pair<HitRecord,int> > hits(padded);
+    std::vector<color> direct(padded, glm::vec3(0.0f)), emissive(pixels, glm::vec3(0.0f));
+    for(int first = 0; first < pixels; first += RayPacket::maxSize)
+    {
+        RayPacket packet;
+        for(int k = 0; k < RayPacket::maxSize && first + k < pixels; ++k)
+        {
+            int i = tile.x0 + (first + k) % tileWidth, j = tile.y0 + (first + k) / tileWidth;
+            float x = 2*(i+0.5)/w - 1;
+            float y = 1 - 2*(j+0.5)/h;
+            primary.push_back(scene.camera->make_ray(x, y));
+            packet.set(k, primary.back(), Interval(0.001f, std::numeric_limits<float>::max()));
+        }
+        scene.traceRays(packet, &hits[first]);
+        uint64_t lit = 0;
+        for(int k = 0; k < RayPacket::maxSize; ++k)
+        {
+            if((packet.active >> k & 1) && hits[first + k].second) lit |= uint64_t(1) << k;
+        }
+        //With next event estimation point lights are sampled along the path instead
+        if(!scene.pathSettings.nextEventEstimation) scene.radiance(&hits[first], lit, &direct[first]);
+    }
+
+    int items = pixels*n;
+    PathStates paths(std::max(1, std::min(settings.wavefrontPaths, items)), settings, w);
+    std::vector<color> results(items);
+    std::vector<int> freeSlots, shade, order, binOf;
+    for(int i = paths.size() - 1; i >= 0; --i) freeSlots.push_back(i);
+    WavefrontQueues queues;
+    std::unordered_map<const Material*, int> bins;
+    int nextItem = 0;
+    while(true)
+    {
+        //Start the paths of the next items in the free slots
+        for(; nextItem < items && !freeSlots.empty(); ++nextItem)
+        {
+            int pixel = nextItem / n, sample = nextItem % n;
+            if(!hits[pixel].second)
+            {
+                results[nextItem] = scene.sky;
+                continue;
+            }
+            int i = freeSlots.back();
+            freeSlots.pop_back();
+            paths.origin.set(i, primary[pixel].o);
+            paths.direction.set(i, primary[pixel].d);
+            paths.throughput.set(i, glm::vec3(1.0f));
+            paths.radiance.set(i, glm::vec3(0.0f));
+            paths.fromP.set(i, glm::vec3(0.0f));
+            paths.fromN.set(i, glm::vec3(0.0f));
+            paths.fromPdf[i] = 0.0f;
+            paths.hit[i] = hits[pixel].first;
+            paths.item[i] = nextItem;
+            paths.depth[i] = 1;
+            int x = tile.x0 + pixel % tileWidth, y = tile.y0 + pixel / tileWidth;
+            paths.samplers[i]->startPixel(x + y*w, settings.firstSample + sample);
+            paths.samplers[i]->startNextSample();
+            shade.push_back(i);
+        }
+        if(shade.empty()) break;
+
+        //Shade the hits grouped by material type
+        int binStart[BinCount + 1] = {};
+        binOf.resize(shade.size());
+        order.resize(shade.size());
+        for(int k = 0; k < (int)shade.size(); ++k)
+        {
+            const Material *mat = paths.hit[shade[k]].mat;
+            auto found = bins.find(mat);
+            if(found == bins.end()) found = bins.emplace(mat, materialBin(mat)).first;
+            binOf[k] = found->second;
+            binStart[binOf[k] + 1]++;
+        }
+        for(int b = 0; b < BinCount; ++b) binStart[b + 1] += binStart[b];
+        int next[BinCount];
+        std::copy(binStart, binStart + BinCount, next);
+        for(int k = 0; k < (int)shade.size(); ++k) order[next[binOf[k]]++] = shade[k];
+        queues.clear();
+        const int *bin = order.data();
+        shadeBin<Lambertian>(scene, paths, bin + binStart[LambertianBin], binStart[LambertianBin + 1] - binStart[LambertianBin], queues);
+        shadeBin<Metallic>(scene, paths, bin + binStart[MetallicBin], binStart[MetallicBin + 1] - binStart[MetallicBin], queues);
+        shadeBin<TorrenceSparrow>(scene, paths, bin + binStart[TorrenceSparrowBin],
+                                  binStart[TorrenceSparrowBin + 1] - binStart[TorrenceSparrowBin], queues);
+        shadeBin<Emissive>(scene, paths, bin + binStart[EmissiveBin], binStart[EmissiveBin + 1] - binStart[EmissiveBin], queues);
+        shadeBin<Material>(scene, paths, bin + binStart[OtherBin], binStart[OtherBin + 1] - binStart[OtherBin], queues);
+        shade.clear();
+
+        //Shadow rays
+        for(int k = 0; k < (int)queues.shadowSlot.size(); ++k)
+        {
+            if(!scene.visible(queues.shadowP.get(k), queues.shadowQ.get(k))) continue;
+            int i = queues.shadowSlot[k];
+            paths.radiance.set(i, paths.radiance.get(i) + queues.shadowContribution.get(k));
+        }
+
+        //Extension rays, as in integratePath escaping rays carry no sky radiance
+        for(int i:queues.extension)
+        {
+            std::pair<HitRecord,int> hit = scene.traceRay(Ray(paths.origin.get(i), paths.direction.get(i)));
+            if(!hit.second)
+            {
+                queues.finished.push_back(i);
+                continue;
+            }
+            paths.hit[i] = hit.first;
+            shade.push_back(i);
+        }
+
+        //Retire the finished paths, the last sample of a pixel also samples
+        //the emissive rectangles with its sampler as tracePath does
+        for(int i:queues.finished)
+        {
+            int item = paths.item[i], pixel = item / n;
+            results[item] = paths.radiance.get(i);
+            if(item % n == n - 1) emissive[pixel] = scene.radianceFromEmissive(hits[pixel].first, *paths.samplers[i]);
+            freeSlots.push_back(i);
+        }
+    }
+
+    for(int pixel = 0; pixel < pixels; ++pixel)
+    {
+        color c = glm::vec3(0.0f);
+        for(int s = 0; s < n; ++s) c += results[pixel*n + s];
+        color direct_light = glm::vec3(0.0f);
+        if(hits[pixel].second && !scene.pathSettings.nextEventEstimation) direct_light += direct[pixel];
+        if(hits[pixel].second) direct_light += emissive[pixel];
+        image.pixel(tile.x0 + pixel % tileWidth, tile.y0 + pixel / tileWidth) = c/(float)n + direct_light;
+    }
+}